@@ -81,7 +81,7 @@ class ChatPhotoWindow
       out << "LOADING ";
       download();
     }
-    windows::TextEdit::render(rb, width(), out.as_cslice(), 0, out.markup(), false, false, &dir);
+    windows::TextEdit::render(rb, width(), out.as_cslice(), 0, out.markup_spans(), false, false, &dir);
     saved_images_ = dir.release();
   }
 
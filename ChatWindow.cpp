@@ -13,6 +13,7 @@
 #include "td/utils/overloaded.h"
 #include "TdObjectsOutput.h"
 #include "managers/FileManager.hpp"
+#include "MessageFormatter.hpp"
 #include "MessageInfoWindow.hpp"
 #include "MessageProcess.hpp"
 #include "common-windows/MenuWindowEdit.hpp"
@@ -95,8 +96,7 @@ void ChatWindow::handle_input(const windows::InputEvent &info) {
   set_need_refresh();
   if (info == "T-Escape") {
     if (multi_message_selection_mode_) {
-      multi_message_selection_mode_ = false;
-      selected_messages_.clear();
+      clear_multi_message_selection_mode();
       return;
     }
     set_mode(Mode{ModeDefault{}});
@@ -106,8 +106,7 @@ void ChatWindow::handle_input(const windows::InputEvent &info) {
     return;
   } else if (info == "C-q" || info == "C-Q" || info == "Q") {
     if (multi_message_selection_mode_) {
-      multi_message_selection_mode_ = false;
-      selected_messages_.clear();
+      clear_multi_message_selection_mode();
       return;
     }
     set_mode(Mode{ModeDefault{}});
@@ -147,6 +146,42 @@ void ChatWindow::handle_input(const windows::InputEvent &info) {
   }
   windows::PadWindow::handle_input(info);
   update_visible();
+  evict_far_messages();
+}
+
+void ChatWindow::evict_far_messages() {
+  // messages far away from the visible part are dropped and are fetched again, when the user scrolls back to them.
+  // A side with a running request is left as is, because the answer must be adjacent to the loaded messages
+  auto screens = global_parameters().chat_retained_screens();
+  if (screens <= 0 || effective_height() <= 0) {
+    return;
+  }
+  auto max_lines = screens * effective_height();
+  if (!running_req_top_) {
+    while (true) {
+      auto el = first_element();
+      if (!el || lines_over_window() - element_height(el) < max_lines) {
+        break;
+      }
+      auto it = messages_.find(static_cast<const Element *>(el)->message_id());
+      CHECK(it != messages_.end());
+      del_message_element(it);
+      is_completed_top_ = false;
+    }
+  }
+  // only the main mode can load newer messages again
+  if (!running_req_bottom_ && is_main_mode()) {
+    while (true) {
+      auto el = last_element();
+      if (!el || lines_under_window() - element_height(el) < max_lines) {
+        break;
+      }
+      auto it = messages_.find(static_cast<const Element *>(el)->message_id());
+      CHECK(it != messages_.end());
+      del_message_element(it);
+      is_completed_bottom_ = false;
+    }
+  }
 }
 
 void ChatWindow::update_visible() {
@@ -178,15 +213,60 @@ td::int32 ChatWindow::Element::render(windows::PadWindow &root, windows::WindowO
                                       windows::SavedRenderedImagesDirectory &dir, bool is_selected) {
   auto &chat_window = static_cast<ChatWindow &>(root);
   auto d = chat_window.multi_message_selection_mode() ? 1 : 0;
-  Outputter out;
-  out.set_chat(static_cast<ChatWindow *>(&root));
-  out << message;
+  const auto &model = render_model(chat_window);
   bool s = chat_window.multi_message_selection_mode_is_selected(ChatWindow::build_message_id(*message));
-  auto r = windows::TextEdit::render(rb, width() - d, out.as_str(), 0, out.markup(), is_selected, false, &dir, d,
+  auto r = windows::TextEdit::render(rb, width() - d, model.text, 0, model.markup, is_selected, false, &dir, d,
                                      s ? "*" : " ");
   return r;
 }
 
+bool ChatWindow::Element::is_prepared() const {
+  return render_model_ || !format_job_ || format_job_->is_ready();
+}
+
+const ChatWindow::MessageRenderModel &ChatWindow::Element::render_model(ChatWindow &window) {
+  if (!render_model_ || render_model_epoch_ != window.render_models_epoch_) {
+    // the message can be shown before the worker reached it or after it was changed
+    const PreparedMessage *prepared = nullptr;
+    if (format_job_ && format_job_->is_ready() &&
+        format_job_->is_for(message->chat_id_, message->id_, version_, window.render_models_epoch_)) {
+      prepared = &format_job_->result();
+    }
+    render_model_ = window.build_render_model(*message, prepared);
+    render_model_epoch_ = window.render_models_epoch_;
+    cancel_format_job();
+  }
+  return *render_model_;
+}
+
+std::shared_ptr<MessageFormatJob> ChatWindow::Element::create_format_job(td::int64 render_models_epoch) {
+  auto text = get_message_text(*message->content_);
+  if (text && text->text_.empty()) {
+    text = nullptr;
+  }
+  format_job_ = std::make_shared<MessageFormatJob>(version_, render_models_epoch, get_message_data(*message), text);
+  return format_job_;
+}
+
+void ChatWindow::Element::cancel_format_job() {
+  if (format_job_) {
+    format_job_->cancel();
+    format_job_ = nullptr;
+  }
+}
+
+std::shared_ptr<const ChatWindow::MessageRenderModel> ChatWindow::build_render_model(
+    const td::td_api::message &message, const PreparedMessage *prepared) {
+  Outputter out;
+  out.set_chat(this);
+  out.set_prepared_message(prepared);
+  out << message;
+  auto model = std::make_shared<MessageRenderModel>();
+  model->text = out.as_str();
+  model->markup = out.markup_spans();
+  return model;
+}
+
 void ChatWindow::request_bottom_elements_ex(td::int32 message_id) {
   if (running_req_bottom_ || messages_.size() == 0 || is_completed_bottom_ || !is_main_mode()) {
     return;
@@ -355,17 +435,29 @@ void ChatWindow::received_top_search_elements(td::Result<td::tl_object_ptr<td::t
 }
 
 void ChatWindow::add_messages(std::vector<td::tl_object_ptr<td::td_api::message>> msgs) {
+  std::vector<std::shared_ptr<windows::PadWindowElement>> elements;
+  std::vector<std::shared_ptr<MessageFormatJob>> jobs;
+  std::vector<MessageId> ids;
   for (auto &m : msgs) {
     auto id = build_message_id(*m);
     auto it = messages_.find(id);
     if (it != messages_.end()) {
     } else {
-      auto el = std::make_shared<Element>(std::move(m), get_chat_generation(m->chat_id_));
-      messages_.emplace(id, el);
-      add_file_message_pair(id, get_file_id(*el->message));
-      add_element(std::move(el));
+      auto el = std::make_shared<Element>(std::move(m), get_chat_generation(id.chat_id));
+      jobs.push_back(el->create_format_job(render_models_epoch_));
+      register_message_element(el);
+      elements.push_back(std::move(el));
+      ids.push_back(id);
     }
   }
+  if (!jobs.empty()) {
+    td::send_closure(root()->message_formatter(), &MessageFormatter::run_jobs, std::move(jobs));
+  }
+  add_elements(std::move(elements));
+  for (auto &id : ids) {
+    invalidate_replies_to(id);
+  }
+  evict_far_messages();
 }
 
 //@description A new message was received; can also be an outgoing message @message The new message
@@ -393,10 +485,7 @@ void ChatWindow::process_update(td::td_api::updateNewMessage &update) {
   auto it = messages_.find(id);
   if (it != messages_.end()) {
   } else {
-    auto el = std::make_shared<Element>(std::move(m), get_chat_generation(m->chat_id_));
-    messages_.emplace(id, el);
-    add_file_message_pair(id, get_file_id(*el->message));
-    add_element(std::move(el));
+    add_message_element(std::make_shared<Element>(std::move(m), get_chat_generation(id.chat_id)));
   }
   set_need_refresh();
 }
@@ -419,10 +508,7 @@ void ChatWindow::process_update_sent_message(td::tl_object_ptr<td::td_api::messa
     return;
   }
   auto id = build_message_id(*message);
-  auto el = std::make_shared<Element>(std::move(message), get_chat_generation(id.chat_id));
-  messages_.emplace(id, el);
-  add_file_message_pair(id, get_file_id(*el->message));
-  add_element(std::move(el));
+  add_message_element(std::make_shared<Element>(std::move(message), get_chat_generation(id.chat_id)));
 }
 
 //@description A request to send a message has reached the Telegram server. This doesn't mean that the message will be sent successfully or even that the send message request will be processed. This update will be sent only if the option "use_quick_ack" is set to true. This update may be sent multiple times for the same message
@@ -438,14 +524,9 @@ void ChatWindow::process_update(td::td_api::updateMessageSendSucceeded &update)
   auto old_id = MessageId{update.message_->chat_id_, update.old_message_id_};
   auto it = messages_.find(old_id);
   if (it != messages_.end()) {
-    del_file_message_pair(old_id, get_file_id(*it->second->message));
-    delete_element(it->second.get());
-    messages_.erase(it);
+    del_message_element(it);
     auto m = std::move(update.message_);
-    auto el = std::make_shared<Element>(std::move(m), get_chat_generation(new_id.chat_id));
-    messages_.emplace(new_id, el);
-    add_file_message_pair(new_id, get_file_id(*el->message));
-    add_element(std::move(el));
+    add_message_element(std::make_shared<Element>(std::move(m), get_chat_generation(new_id.chat_id)));
   }
 }
 
@@ -457,14 +538,9 @@ void ChatWindow::process_update(td::td_api::updateMessageSendFailed &update) {
   auto old_id = MessageId{update.message_->chat_id_, update.old_message_id_};
   auto it = messages_.find(old_id);
   if (it != messages_.end()) {
-    del_file_message_pair(old_id, get_file_id(*it->second->message));
-    delete_element(it->second.get());
-    messages_.erase(it);
+    del_message_element(it);
     auto m = std::move(update.message_);
-    auto el = std::make_shared<Element>(std::move(m), get_chat_generation(new_id.chat_id));
-    messages_.emplace(new_id, el);
-    add_file_message_pair(new_id, get_file_id(*el->message));
-    add_element(std::move(el));
+    add_message_element(std::make_shared<Element>(std::move(m), get_chat_generation(new_id.chat_id)));
   }
 }
 
@@ -481,7 +557,7 @@ void ChatWindow::process_update(td::td_api::updateMessageContent &update) {
       del_file_message_pair(id, old_f);
       add_file_message_pair(id, new_f);
     }
-    change_element(it->second.get());
+    change_message_element(it->second.get());
   }
 }
 
@@ -493,7 +569,7 @@ void ChatWindow::process_update(td::td_api::updateMessageEdited &update) {
   if (it != messages_.end()) {
     it->second->message->edit_date_ = update.edit_date_;
     it->second->message->reply_markup_ = std::move(update.reply_markup_);
-    change_element(it->second.get());
+    change_message_element(it->second.get());
   }
 }
 
@@ -504,7 +580,7 @@ void ChatWindow::process_update(td::td_api::updateMessageIsPinned &update) {
   auto it = messages_.find(id);
   if (it != messages_.end()) {
     it->second->message->is_pinned_ = update.is_pinned_;
-    change_element(it->second.get());
+    change_message_element(it->second.get());
   }
 }
 
@@ -515,7 +591,7 @@ void ChatWindow::process_update(td::td_api::updateMessageInteractionInfo &update
   auto it = messages_.find(id);
   if (it != messages_.end()) {
     it->second->message->interaction_info_ = std::move(update.interaction_info_);
-    change_element(it->second.get());
+    change_message_element(it->second.get());
   }
 }
 
@@ -526,7 +602,7 @@ void ChatWindow::process_update(td::td_api::updateMessageContentOpened &update)
   auto it = messages_.find(id);
   if (it != messages_.end()) {
     // ???
-    change_element(it->second.get());
+    change_message_element(it->second.get());
   }
 }
 
@@ -537,7 +613,7 @@ void ChatWindow::process_update(td::td_api::updateMessageMentionRead &update) {
   auto it = messages_.find(id);
   if (it != messages_.end()) {
     it->second->message->contains_unread_mention_ = false;
-    change_element(it->second.get());
+    change_message_element(it->second.get());
   }
 }
 
@@ -551,7 +627,7 @@ void ChatWindow::process_update(td::td_api::updateMessageFactCheck &update) {
   auto it = messages_.find(id);
   if (it != messages_.end()) {
     it->second->message->fact_check_ = std::move(update.fact_check_);
-    change_element(it->second.get());
+    change_message_element(it->second.get());
   }
 }
 
@@ -565,7 +641,7 @@ void ChatWindow::process_update(td::td_api::updateMessageSuggestedPostInfo &upda
   auto it = messages_.find(id);
   if (it != messages_.end()) {
     it->second->message->suggested_post_info_ = std::move(update.suggested_post_info_);
-    change_element(it->second.get());
+    change_message_element(it->second.get());
   }
 }
 
@@ -576,7 +652,7 @@ void ChatWindow::process_update(td::td_api::updateMessageUnreadReactions &update
   auto it = messages_.find(id);
   if (it != messages_.end()) {
     it->second->message->unread_reactions_ = std::move(update.unread_reactions_);
-    change_element(it->second.get());
+    change_message_element(it->second.get());
   }
 }
 
@@ -593,8 +669,7 @@ void ChatWindow::process_update(td::td_api::updateDeleteMessages &update) {
     auto id = build_message_id(update.chat_id_, x);
     auto it = messages_.find(id);
     if (it != messages_.end()) {
-      delete_element(it->second.get());
-      messages_.erase(it);
+      del_message_element(it);
     }
   }
 }
@@ -634,7 +709,7 @@ void ChatWindow::update_file(MessageId message_id, const td::td_api::file &file)
   auto it = messages_.find(message_id);
   if (it != messages_.end()) {
     update_message_file(*it->second->message, file);
-    change_element(it->second.get());
+    change_message_element(it->second.get());
   }
 }
 
@@ -664,6 +739,98 @@ void ChatWindow::add_file_message_pair(MessageId msg_id, td::int32 file_id) {
   it->second.messages.emplace(msg_id);
 }
 
+void ChatWindow::register_message_element(const std::shared_ptr<Element> &el) {
+  auto id = el->message_id();
+  messages_.emplace(id, el);
+  add_file_message_pair(id, get_file_id(*el->message));
+  add_reply_pair(*el->message);
+}
+
+void ChatWindow::add_message_element(std::shared_ptr<Element> el) {
+  auto id = el->message_id();
+  td::send_closure(root()->message_formatter(), &MessageFormatter::run_jobs,
+                   std::vector<std::shared_ptr<MessageFormatJob>>{el->create_format_job(render_models_epoch_)});
+  register_message_element(el);
+  add_element(std::move(el));
+  invalidate_replies_to(id);
+  // new messages of an open chat must not grow it without bound
+  evict_far_messages();
+}
+
+void ChatWindow::del_message_element(std::map<MessageId, std::shared_ptr<Element>>::iterator it) {
+  auto id = it->first;
+  it->second->cancel_format_job();
+  del_file_message_pair(id, get_file_id(*it->second->message));
+  del_reply_pair(*it->second->message);
+  delete_element(it->second.get());
+  messages_.erase(it);
+  invalidate_replies_to(id);
+}
+
+void ChatWindow::change_message_element(Element *el) {
+  el->on_message_changed();
+  change_element(el);
+  invalidate_replies_to(el->message_id());
+}
+
+static const td::td_api::messageReplyToMessage *get_reply_to_message(const td::td_api::message &message) {
+  if (!message.reply_to_ || message.reply_to_->get_id() != td::td_api::messageReplyToMessage::ID) {
+    return nullptr;
+  }
+  return static_cast<const td::td_api::messageReplyToMessage *>(message.reply_to_.get());
+}
+
+void ChatWindow::add_reply_pair(const td::td_api::message &message) {
+  auto r = get_reply_to_message(message);
+  if (r) {
+    replies_[build_message_id(r->chat_id_, r->message_id_)].insert(build_message_id(message));
+  }
+}
+
+void ChatWindow::del_reply_pair(const td::td_api::message &message) {
+  auto r = get_reply_to_message(message);
+  if (!r) {
+    return;
+  }
+  auto it = replies_.find(build_message_id(r->chat_id_, r->message_id_));
+  if (it != replies_.end()) {
+    it->second.erase(build_message_id(message));
+    if (it->second.size() == 0) {
+      replies_.erase(it);
+    }
+  }
+}
+
+void ChatWindow::invalidate_replies_to(MessageId message_id) {
+  auto it = replies_.find(message_id);
+  if (it == replies_.end()) {
+    return;
+  }
+  // replies only show the sender and the content of the replied message, so there is no need to go further
+  for (auto &reply_id : it->second) {
+    auto m = messages_.find(reply_id);
+    if (m != messages_.end()) {
+      m->second->invalidate_render_model();
+      change_element(m->second.get());
+    }
+  }
+}
+
+void ChatWindow::process_update(td::td_api::updateChatReadOutbox &update) {
+  // is called before the chat manager applies the update, so only messages, that become read now, change
+  auto C = chat_manager().get_chat(update.chat_id_);
+  auto from_id = C ? C->last_read_outbox_message_id() + 1 : 0;
+  auto it = messages_.lower_bound(build_message_id(update.chat_id_, from_id));
+  while (it != messages_.end() && it->first.chat_id == update.chat_id_ &&
+         it->first.message_id <= update.last_read_outbox_message_id_) {
+    if (it->second->message->is_outgoing_) {
+      it->second->invalidate_render_model();
+      change_element(it->second.get());
+    }
+    it++;
+  }
+}
+
 void ChatWindow::Element::run(ChatWindow *window) {
   auto file_id = ChatWindow::get_file_id(*message);
   if (file_id) {
@@ -686,7 +853,7 @@ void ChatWindow::Element::handle_input(PadWindow &root, const windows::InputEven
   } else if (info == " ") {
     if (!chat_window.multi_message_selection_mode_) {
       chat_window.multi_message_selection_mode_ = true;
-      chat_window.on_resize(chat_window.height(), chat_window.width(), chat_window.height(), chat_window.width());
+      chat_window.remeasure_elements();
       chat_window.selected_messages_.clear();
     }
     auto msg_id = message_id();
@@ -694,7 +861,7 @@ void ChatWindow::Element::handle_input(PadWindow &root, const windows::InputEven
       chat_window.selected_messages_.erase(msg_id);
       if (chat_window.selected_messages_.size() == 0) {
         chat_window.multi_message_selection_mode_ = false;
-        chat_window.on_resize(chat_window.height(), chat_window.width(), chat_window.height(), chat_window.width());
+        chat_window.remeasure_elements();
       }
     } else {
       chat_window.selected_messages_.insert(msg_id);
@@ -862,11 +1029,10 @@ void ChatWindow::set_mode(ChatWindow::Mode mode) {
   is_completed_bottom_ = !is_main_mode();
 
   messages_.clear();
+  replies_.clear();
 
   if (cur) {
-    messages_.emplace(cur->message_id(), cur);
-    add_file_message_pair(cur->message_id(), get_file_id(*cur->message));
-    add_element(cur);
+    add_message_element(cur);
     unglue();
   }
 
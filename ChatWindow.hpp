@@ -17,6 +17,8 @@
 namespace tdcurses {
 
 class Tdcurses;
+class MessageFormatJob;
+struct PreparedMessage;
 
 class ChatWindow
     : public windows::PadWindow
@@ -59,6 +61,12 @@ class ChatWindow
   using Mode = td::Variant<ModeDefault, ModeSearch, ModeComments>;
   ChatWindow(Tdcurses *root, td::ActorId<Tdcurses> root_actor, td::int64 chat_id);
 
+  // formatted text of a message; it is never changed after it is built, layout and rendering only read it
+  struct MessageRenderModel {
+    std::string text;
+    windows::MarkupSpans markup;
+  };
+
   class Element : public windows::PadWindowElement {
    public:
     Element(td::tl_object_ptr<td::td_api::message> message, td::int32 generation)
@@ -78,14 +86,49 @@ class ChatWindow
 
     void run(ChatWindow *window);
 
+    bool is_prepared() const override;
+
+    const MessageRenderModel &render_model(ChatWindow &window);
+    void invalidate_render_model() {
+      render_model_ = nullptr;
+    }
+
+    // the job formatting a snapshot of the message on the worker; its result is used only once and only for the
+    // same version of the message
+    std::shared_ptr<MessageFormatJob> create_format_job(td::int64 render_models_epoch);
+    void cancel_format_job();
+    void on_message_changed() {
+      version_++;
+      cancel_format_job();
+      invalidate_render_model();
+    }
+
     td::tl_object_ptr<td::td_api::message> message;
     td::int32 generation;
 
     auto message_id() const {
       return MessageId{message->chat_id_, message->id_};
     }
+
+   private:
+    std::shared_ptr<const MessageRenderModel> render_model_;
+    td::int64 render_model_epoch_{0};
+    std::shared_ptr<MessageFormatJob> format_job_;
+    // is increased on each change of the message
+    td::int64 version_{0};
   };
 
+  // prepared is the message formatted on the worker or null, if the message must be formatted synchronously
+  std::shared_ptr<const MessageRenderModel> build_render_model(const td::td_api::message &message,
+                                                               const PreparedMessage *prepared);
+
+  // formatting also depends on names and colors of users and chats, a change of them makes all built render models
+  // stale
+  void invalidate_render_models() {
+    render_models_epoch_++;
+    set_need_refresh();
+  }
+
   td::int64 main_chat_id() const {
     return main_chat_id_;
   }
@@ -124,6 +167,7 @@ class ChatWindow
   void process_update(td::td_api::updateMessageLiveLocationViewed &update);
   void process_update(td::td_api::updateDeleteMessages &update);
   void process_update(td::td_api::updateChatAction &update);
+  void process_update(td::td_api::updateChatReadOutbox &update);
   void process_file_update(const td::td_api::updateFile &update);
 
   void update_file(MessageId message_id, const td::td_api::file &file);
@@ -231,13 +275,29 @@ class ChatWindow
   }
 
   void clear_multi_message_selection_mode() {
-    multi_message_selection_mode_ = false;
+    if (multi_message_selection_mode_) {
+      multi_message_selection_mode_ = false;
+      remeasure_elements();
+    }
     selected_messages_.clear();
   }
 
   void update_visible();
+  // keeps only messages within chat_retained_screens screens from the visible part of the chat
+  void evict_far_messages();
 
  private:
+  // adds the message to the message map, file subscriptions and the reply index, but not to the pad
+  void register_message_element(const std::shared_ptr<Element> &el);
+  void add_message_element(std::shared_ptr<Element> el);
+  void del_message_element(std::map<MessageId, std::shared_ptr<Element>>::iterator it);
+  void change_message_element(Element *el);
+
+  void add_reply_pair(const td::td_api::message &message);
+  void del_reply_pair(const td::td_api::message &message);
+  // drops render models of messages, that show the message as a replied one
+  void invalidate_replies_to(MessageId message_id);
+
   const td::int64 main_chat_id_;
 
   std::map<MessageId, std::shared_ptr<Element>> messages_;
@@ -248,6 +308,8 @@ class ChatWindow
     std::set<MessageId> messages;
   };
   std::map<td::int32, FileSubscription> file_id_2_messages_;
+  // replied message -> replies to it
+  std::map<MessageId, std::set<MessageId>> replies_;
   Mode mode_{ModeDefault{}};
   bool running_req_top_{false};
   bool running_req_bottom_{false};
@@ -256,6 +318,8 @@ class ChatWindow
 
   bool multi_message_selection_mode_{false};
   std::set<MessageId> selected_messages_;
+
+  td::int64 render_models_epoch_{0};
 };
 
 }  // namespace tdcurses
@@ -62,12 +62,14 @@ void CommonGroupsWindow::got_chats(td::Result<td::tl_object_ptr<td::td_api::chat
     is_completed_ = true;
     return;
   }
+  std::vector<std::shared_ptr<windows::PadWindowElement>> elements;
   for (auto &chat_id : chats->chat_ids_) {
     auto chat = chat_manager().get_chat(chat_id);
     if (chat) {
-      add_element(std::make_shared<Element>(chat, last_idx_++));
+      elements.push_back(std::make_shared<Element>(chat, last_idx_++));
     }
   }
+  add_elements(std::move(elements));
   last_chat_id_ = chats->chat_ids_.back();
   set_need_refresh();
 }
@@ -251,7 +251,7 @@ void ComposeWindow::render(windows::WindowOutputter &rb, bool force) {
       out << "[-QUOTE]";
     }
 
-    windows::TextEdit::render(rb, width(), out.as_cslice(), 0, out.markup(), false, false);
+    windows::TextEdit::render(rb, width(), out.as_cslice(), 0, out.markup_spans(), false, false);
   }
   if (reply_message_id_) {
     rb.translate(1, 0);
@@ -263,7 +263,7 @@ void ComposeWindow::render(windows::WindowOutputter &rb, bool force) {
       Outputter out;
       out << Outputter::NoLb(true) << "reply to: " << Color::Red << msg->sender_id_ << Color::Revert << " "
           << msg->content_;
-      windows::TextEdit::render(rb, width(), out.as_cslice(), 0, out.markup(), false, false);
+      windows::TextEdit::render(rb, width(), out.as_cslice(), 0, out.markup_spans(), false, false);
     }
     rb.untranslate(1, 0);
   }
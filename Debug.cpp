@@ -5,8 +5,15 @@
 #include "managers/FileManager.hpp"
 #include "td/telegram/Version.h"
 #include "managers/GlobalParameters.hpp"
+#include "windows/ImageCache.hpp"
+#include "windows/Output.hpp"
+#include "windows/StickerAnimation.hpp"
+#include "windows/TextLayoutCache.hpp"
 #include "td/utils/SliceBuilder.h"
+#include "td/utils/JsonBuilder.h"
 
+#include <algorithm>
+#include <cmath>
 #include <notcurses/notcurses.h>
 #include <libconfig.h++>
 #if USE_LIBTICKIT
@@ -32,6 +39,55 @@ std::string DebugCounters::to_str() const {
   sb << td::tag("backend", global_parameters().backend_type()) << "\n";
   sb << td::tag("allocated_menu_windows", allocated_menu_windows) << "\n";
   sb << td::tag("file_downloads", file_manager().active_downloads()) << "\n";
+  {
+    const auto &stats = windows::output_stats();
+    sb << td::tag("pen_changes", stats.pen_changes) << "\n";
+    sb << td::tag("avoided_pen_changes", stats.pen_requests - stats.pen_changes) << "\n";
+  }
+  {
+    const auto &rate = windows::refresh_rate();
+    sb << td::tag("low_bandwidth", rate.is_low_bandwidth()) << "\n";
+    sb << td::tag("output_bytes", td::format::as_size(rate.output_bytes())) << "\n";
+    sb << td::tag("output_rate", PSTRING() << td::format::as_size(static_cast<td::uint64>(rate.output_rate())) << "/s")
+       << "\n";
+    sb << td::tag("frame_output_time",
+                  PSTRING() << td::StringBuilder::FixedDouble(rate.frame_duration() * 1000, 1) << "ms")
+       << "\n";
+    sb << td::tag("refresh_interval", PSTRING() << td::StringBuilder::FixedDouble(rate.interval() * 1000, 0) << "ms")
+       << "\n";
+  }
+  {
+    const auto &stats = windows::image_cache().stats();
+    sb << td::tag("image_cache_hits", stats.hits) << "\n";
+    sb << td::tag("image_cache_misses", stats.misses) << "\n";
+    sb << td::tag("image_cache_evictions", stats.evictions) << "\n";
+    sb << td::tag("image_cache_entries", stats.entries) << "\n";
+    sb << td::tag("image_cache_size",
+                  PSTRING() << td::format::as_size(stats.size) << "/" << td::format::as_size(stats.max_size))
+       << "\n";
+  }
+  {
+    const auto &stats = windows::text_layout_cache().stats();
+    sb << td::tag("layout_cache_hits", stats.hits) << "\n";
+    sb << td::tag("layout_cache_misses", stats.misses) << "\n";
+    sb << td::tag("layout_cache_evictions", stats.evictions) << "\n";
+    sb << td::tag("layout_cache_entries", stats.entries) << "\n";
+    sb << td::tag("layout_cache_size",
+                  PSTRING() << td::format::as_size(stats.size) << "/" << td::format::as_size(stats.max_size))
+       << "\n";
+  }
+  {
+    const auto &stats = windows::animation_player().stats();
+    sb << td::tag("playing_animations", stats.playing) << "\n";
+    sb << td::tag("animation_frames_size", td::format::as_size(stats.frames_size)) << "\n";
+    sb << td::tag("animation_frame_cost",
+                  PSTRING() << td::StringBuilder::FixedDouble(stats.frame_cost * 1000, 2) << "ms")
+       << "\n";
+    sb << td::tag("animation_frame_interval",
+                  PSTRING() << td::StringBuilder::FixedDouble(stats.min_frame_interval * 1000, 1) << "ms")
+       << "\n";
+  }
+  sb << runtime_metrics().to_str();
   return sb.as_cslice().str();
 }
 
@@ -40,4 +96,121 @@ DebugCounters &debug_counters() {
   return instance;
 }
 
+std::string RuntimeMetrics::to_str() const {
+  td::StringBuilder sb;
+  sb << td::tag("cpu_user", PSTRING() << td::StringBuilder::FixedDouble(cpu_user_percent, 1) << "%") << "\n";
+  sb << td::tag("cpu_system", PSTRING() << td::StringBuilder::FixedDouble(cpu_system_percent, 1) << "%") << "\n";
+  sb << td::tag("resident_size", td::format::as_size(resident_size)) << "\n";
+  sb << td::tag("resident_size_peak", td::format::as_size(resident_size_peak)) << "\n";
+  sb << td::tag("total_updates", total_updates) << "\n";
+  sb << td::tag("updates_per_second", td::StringBuilder::FixedDouble(updates_per_second, 1)) << "\n";
+  sb << td::tag("total_frames", total_frames) << "\n";
+  sb << td::tag("frames_per_second", td::StringBuilder::FixedDouble(frames_per_second, 1)) << "\n";
+  sb << td::tag("pending_requests", pending_requests) << "\n";
+  return sb.as_cslice().str();
+}
+
+std::string RuntimeMetrics::to_json() const {
+  td::JsonBuilder jb;
+  {
+    auto jo = jb.enter_object();
+    jo("sampled_at", td::JsonFloat(sampled_at));
+    jo("cpu_user_percent", td::JsonFloat(cpu_user_percent));
+    jo("cpu_system_percent", td::JsonFloat(cpu_system_percent));
+    jo("resident_size", td::JsonLong(static_cast<td::int64>(resident_size)));
+    jo("resident_size_peak", td::JsonLong(static_cast<td::int64>(resident_size_peak)));
+    jo("total_updates", td::JsonLong(total_updates));
+    jo("updates_per_second", td::JsonFloat(updates_per_second));
+    jo("total_frames", td::JsonLong(total_frames));
+    jo("frames_per_second", td::JsonFloat(frames_per_second));
+    jo("pending_requests", td::JsonLong(pending_requests));
+    jo.leave();
+  }
+  return jb.string_builder().as_cslice().str();
+}
+
+RuntimeMetrics &runtime_metrics() {
+  static RuntimeMetrics instance{};
+  return instance;
+}
+
+namespace {
+size_t latency_bucket(double duration) {
+  auto us = duration * 1e6;
+  if (us < 1) {
+    return 0;
+  }
+  auto b = (size_t)(std::log2(us) * 4) + 1;
+  return std::min(b, UpdateStats::BucketsCount - 1);
+}
+
+double latency_bucket_upper_bound(size_t bucket) {
+  return std::exp2((double)bucket * 0.25) * 1e-6;
+}
+}  // namespace
+
+double UpdateStats::Entry::percentile(double p) const {
+  auto need = (td::int64)std::ceil((double)count * p);
+  td::int64 seen = 0;
+  for (size_t i = 0; i < BucketsCount; i++) {
+    seen += histogram[i];
+    if (seen >= need && seen > 0) {
+      return std::min(latency_bucket_upper_bound(i), max_time);
+    }
+  }
+  return max_time;
+}
+
+void UpdateStats::Entry::add_sample(double duration) {
+  count++;
+  total_time += duration;
+  max_time = std::max(max_time, duration);
+  histogram[latency_bucket(duration)]++;
+}
+
+void UpdateStats::add_update(td::int32 constructor_id, double duration) {
+  auto &e = entries_[constructor_id];
+  e.add_sample(duration);
+  if (e.last_frame != frame_) {
+    e.last_frame = frame_;
+    updates_in_frame_.push_back(constructor_id);
+  }
+}
+
+void UpdateStats::add_frame(double duration) {
+  frames_.add_sample(duration);
+  for (auto id : updates_in_frame_) {
+    auto &e = entries_[id];
+    e.frames++;
+    e.render_time += duration;
+  }
+  updates_in_frame_.clear();
+  frame_++;
+}
+
+std::string UpdateStats::to_str() const {
+  std::vector<const Entry *> v;
+  for (auto &it : entries_) {
+    v.push_back(&it.second);
+  }
+  std::sort(v.begin(), v.end(), [](const Entry *a, const Entry *b) { return a->total_time > b->total_time; });
+
+  auto us = [](double t) { return (td::int64)(t * 1e6); };
+  td::StringBuilder sb;
+  sb << "frames: " << frames_.count << " " << us(frames_.total_time) / 1000 << " " << us(frames_.percentile(0.5))
+     << " " << us(frames_.percentile(0.99)) << " " << us(frames_.max_time) << "\n";
+  sb << "update: count total_ms p50_us p99_us max_us frames render_ms\n";
+  for (auto e : v) {
+    sb << e->name << ": " << e->count << " " << us(e->total_time) / 1000 << " " << us(e->percentile(0.5)) << " "
+       << us(e->percentile(0.99)) << " " << us(e->max_time) << " " << e->frames << " " << us(e->render_time) / 1000
+       << "\n";
+  }
+  return sb.as_cslice().str();
+}
+
+UpdateStats &update_stats() {
+  static UpdateStats instance{};
+  return instance;
+}
+
 }  // namespace tdcurses
@@ -2,6 +2,11 @@
 
 #include "td/utils/common.h"
 
+#include <array>
+#include <map>
+#include <string>
+#include <vector>
+
 namespace tdcurses {
 
 struct DebugCounters {
@@ -12,4 +17,64 @@ struct DebugCounters {
 
 DebugCounters &debug_counters();
 
+// sampled once per second by Tdcurses, read by the status line and the debug window
+struct RuntimeMetrics {
+  double sampled_at{0};
+  double cpu_user_percent{0};
+  double cpu_system_percent{0};
+  td::uint64 resident_size{0};
+  td::uint64 resident_size_peak{0};
+  td::int64 total_updates{0};
+  double updates_per_second{0};
+  td::int64 total_frames{0};
+  double frames_per_second{0};
+  td::int64 pending_requests{0};
+
+  std::string to_str() const;
+  std::string to_json() const;
+};
+
+RuntimeMetrics &runtime_metrics();
+
+// per update constructor processing time and time of the frames those updates were rendered in
+class UpdateStats {
+ public:
+  // log-scaled latency buckets, 4 per power of two microseconds
+  static constexpr size_t BucketsCount = 96;
+
+  struct Entry {
+    std::string name;
+    td::int64 count{0};
+    double total_time{0};
+    double max_time{0};
+    std::array<td::int64, BucketsCount> histogram{};
+    td::int64 frames{0};
+    double render_time{0};
+    td::int64 last_frame{-1};
+
+    void add_sample(double duration);
+    double percentile(double p) const;
+  };
+
+  Entry &get(td::int32 constructor_id) {
+    return entries_[constructor_id];
+  }
+  void add_update(td::int32 constructor_id, double duration);
+  void add_frame(double duration);
+
+  const Entry &frames() const {
+    return frames_;
+  }
+
+  std::string to_str() const;
+
+ private:
+  std::map<td::int32, Entry> entries_;
+  Entry frames_;
+  std::vector<td::int32> updates_in_frame_;
+  td::int64 frame_{0};
+};
+
+UpdateStats &update_stats();
+
 };  // namespace tdcurses
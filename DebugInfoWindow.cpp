@@ -1,4 +1,5 @@
 #include "DebugInfoWindow.hpp"
+#include "Debug.hpp"
 #include "Outputter.hpp"
 #include "td/telegram/td_api.h"
 #include "td/telegram/td_api.hpp"
@@ -61,4 +62,10 @@ void DebugInfoWindow::create_text(const td::td_api::message &message) {
   replace_text(outputter.as_str(), outputter.markup());
 }
 
+void DebugInfoWindow::create_debug_text() {
+  Outputter outputter;
+  outputter << debug_counters().to_str() << "\n" << update_stats().to_str();
+  replace_text(outputter.as_str(), outputter.markup());
+}
+
 }  // namespace tdcurses
@@ -2,17 +2,19 @@
 
 #include "td/tl/TlObject.h"
 #include "auto/td/telegram/td_api.h"
-#include "windows/ViewWindow.hpp"
+#include "common-windows/MenuWindowView.hpp"
 #include <memory>
 
 namespace tdcurses {
 
-class DebugInfoWindow : public windows::ViewWindow {
+class DebugInfoWindow : public MenuWindowView {
  public:
-  DebugInfoWindow() : windows::ViewWindow("", nullptr) {
+  DebugInfoWindow(Tdcurses *root, td::ActorId<Tdcurses> root_actor) : MenuWindowView(root, std::move(root_actor)) {
   }
 
   void create_text(const td::td_api::message &message);
+  // debug counters, runtime metrics and per update type processing stats
+  void create_debug_text();
 
  private:
 };
@@ -100,21 +100,25 @@ void GroupMembersWindow::got_members(td::Result<td::tl_object_ptr<td::td_api::ba
   }
   is_completed_ = true;
   auto info = R.move_as_ok();
+  std::vector<std::shared_ptr<windows::PadWindowElement>> elements;
   for (auto &member : info->members_) {
     td::td_api::downcast_call(*member->member_id_, td::overloaded(
                                                        [&](td::td_api::messageSenderUser &user) {
                                                          auto u = chat_manager().get_user(user.user_id_);
                                                          if (u) {
-                                                           add_element(std::make_shared<Element>(u, last_idx_++));
+                                                           elements.push_back(
+                                                               std::make_shared<Element>(u, last_idx_++));
                                                          }
                                                        },
                                                        [&](td::td_api::messageSenderChat &chat) {
                                                          auto u = chat_manager().get_chat(chat.chat_id_);
                                                          if (u) {
-                                                           add_element(std::make_shared<Element>(u, last_idx_++));
+                                                           elements.push_back(
+                                                               std::make_shared<Element>(u, last_idx_++));
                                                          }
                                                        }));
   }
+  add_elements(std::move(elements));
   set_need_refresh();
 }
 
@@ -130,21 +134,25 @@ void GroupMembersWindow::got_members(td::Result<td::tl_object_ptr<td::td_api::ch
     return;
   }
   offset_ += (td::int32)res->members_.size();
+  std::vector<std::shared_ptr<windows::PadWindowElement>> elements;
   for (auto &member : res->members_) {
     td::td_api::downcast_call(*member->member_id_, td::overloaded(
                                                        [&](td::td_api::messageSenderUser &user) {
                                                          auto u = chat_manager().get_user(user.user_id_);
                                                          if (u) {
-                                                           add_element(std::make_shared<Element>(u, last_idx_++));
+                                                           elements.push_back(
+                                                               std::make_shared<Element>(u, last_idx_++));
                                                          }
                                                        },
                                                        [&](td::td_api::messageSenderChat &chat) {
                                                          auto u = chat_manager().get_chat(chat.chat_id_);
                                                          if (u) {
-                                                           add_element(std::make_shared<Element>(u, last_idx_++));
+                                                           elements.push_back(
+                                                               std::make_shared<Element>(u, last_idx_++));
                                                          }
                                                        }));
   }
+  add_elements(std::move(elements));
   set_need_refresh();
 }
 
@@ -0,0 +1,22 @@
+#include "MessageFormatter.hpp"
+#include "Tdcurses.hpp"
+
+namespace tdcurses {
+
+void MessageFormatJob::run() {
+  result_ = prepare_message(message_, has_text_ ? &text_ : nullptr);
+  message_ = MessageData();
+  text_ = FormattedTextData();
+  is_ready_.store(true, std::memory_order_release);
+}
+
+void MessageFormatter::run_jobs(std::vector<std::shared_ptr<MessageFormatJob>> jobs) {
+  for (auto &job : jobs) {
+    if (!job->is_cancelled()) {
+      job->run();
+    }
+  }
+  td::send_closure(root_, &Tdcurses::on_messages_formatted);
+}
+
+}  // namespace tdcurses
@@ -0,0 +1,80 @@
+#pragma once
+
+#include "Outputter.hpp"
+#include "TdObjectsOutput.h"
+
+#include "td/tdactor/td/actor/actor.h"
+
+#include <atomic>
+#include <memory>
+#include <vector>
+
+namespace tdcurses {
+
+class Tdcurses;
+
+// formatting of a message on the worker. The job owns a snapshot of the message, so the message can change or be
+// deleted meanwhile. The result can be used by the main thread only after is_ready() returns true and only for the
+// same version of the message
+class MessageFormatJob {
+ public:
+  MessageFormatJob(td::int64 version, td::int64 epoch, MessageData message, const td::td_api::formattedText *text)
+      : chat_id_(message.chat_id)
+      , message_id_(message.message_id)
+      , version_(version)
+      , epoch_(epoch)
+      , message_(std::move(message))
+      , has_text_(text != nullptr) {
+    if (text) {
+      text_ = copy_formatted_text(*text);
+    }
+  }
+
+  // version of the message and epoch of the chat window, for which the job was created
+  bool is_for(td::int64 chat_id, td::int64 message_id, td::int64 version, td::int64 epoch) const {
+    return chat_id_ == chat_id && message_id_ == message_id && version_ == version && epoch_ == epoch;
+  }
+
+  void run();
+
+  bool is_ready() const {
+    return is_ready_.load(std::memory_order_acquire);
+  }
+  void cancel() {
+    is_cancelled_.store(true, std::memory_order_relaxed);
+  }
+  bool is_cancelled() const {
+    return is_cancelled_.load(std::memory_order_relaxed);
+  }
+
+  const PreparedMessage &result() const {
+    return result_;
+  }
+
+ private:
+  td::int64 chat_id_;
+  td::int64 message_id_;
+  td::int64 version_;
+  td::int64 epoch_;
+  MessageData message_;
+  bool has_text_;
+  FormattedTextData text_;
+  PreparedMessage result_;
+  std::atomic<bool> is_ready_{false};
+  std::atomic<bool> is_cancelled_{false};
+};
+
+// formats received messages on a worker scheduler, so that chats with many entities don't block input while they are
+// laid out
+class MessageFormatter : public td::Actor {
+ public:
+  explicit MessageFormatter(td::ActorId<Tdcurses> root) : root_(root) {
+  }
+
+  void run_jobs(std::vector<std::shared_ptr<MessageFormatJob>> jobs);
+
+ private:
+  td::ActorId<Tdcurses> root_;
+};
+
+}  // namespace tdcurses
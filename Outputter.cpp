@@ -74,37 +74,53 @@ void Outputter::set_color(td::Variant<Color, ColorRGB> color, bool is_fg) {
   if (color.get_offset() == color.offset<Color>() && color.get<Color>() == Color::Revert) {
     l.pop_arg(*this, sb_.as_cslice().size(), markup_idx_++);
   } else {
-    l.push_arg(*this, sb_.as_cslice().size(), markup_idx_++,
-               [color = std::move(color), is_fg](size_t from_pos, size_t from_idx, size_t to_pos,
-                                                 size_t to_idx) -> windows::MarkupElement {
-                 windows::MarkupElementPos from(from_pos, from_idx);
-                 windows::MarkupElementPos to(to_pos, to_idx);
-                 windows::MarkupElement el;
-                 if (is_fg) {
-                   color.visit(td::overloaded(
-                       [&](Color c) { el = std::make_shared<windows::MarkupElementFgColor>(from, to, c); },
-                       [&](ColorRGB c) { el = std::make_shared<windows::MarkupElementFgColorRGB>(from, to, c); }));
-                 } else {
-                   color.visit(td::overloaded(
-                       [&](Color c) { el = std::make_shared<windows::MarkupElementBgColor>(from, to, c); },
-                       [&](ColorRGB c) { el = std::make_shared<windows::MarkupElementBgColorRGB>(from, to, c); }));
-                 }
-                 return el;
-               });
+    windows::MarkupKind kind = windows::MarkupKind::FgColor;
+    td::uint32 payload = 0;
+    color.visit(td::overloaded(
+        [&](Color c) {
+          kind = is_fg ? windows::MarkupKind::FgColor : windows::MarkupKind::BgColor;
+          payload = static_cast<td::uint32>(c);
+        },
+        [&](ColorRGB c) {
+          kind = is_fg ? windows::MarkupKind::FgColorRGB : windows::MarkupKind::BgColorRGB;
+          payload = c.color;
+        }));
+    l.push_arg(*this, sb_.as_cslice().size(), markup_idx_++, kind, payload);
   }
 }
 
 std::vector<windows::MarkupElement> Outputter::markup() {
+  return markup_spans().to_elements();
+}
+
+windows::MarkupSpans Outputter::markup_spans() {
   auto res = markup_;
   fg_colors_stack_.flush_to(res, sb_.as_cslice().size(), markup_idx_++);
   bg_colors_stack_.flush_to(res, sb_.as_cslice().size(), markup_idx_++);
   pad_left_stack_.flush_to(res, sb_.as_cslice().size(), markup_idx_++);
   for (auto &e : bool_stack_) {
-    e->flush_to(res, sb_.as_cslice().size(), markup_idx_++);
+    e.flush_to(res, sb_.as_cslice().size(), markup_idx_++);
   }
+  res.sort_events();
+  return res;
+}
+
+Outputter::Fragment Outputter::as_fragment() {
+  Fragment res;
+  res.text = as_str();
+  res.markup = markup_spans();
+  res.markup_idx = markup_idx_;
   return res;
 }
 
+Outputter &Outputter::operator<<(const Fragment &x) {
+  auto pos = sb_.as_cslice().size();
+  sb_ << x.text;
+  markup_.append(x.markup, pos, markup_idx_);
+  markup_idx_ += x.markup_idx;
+  return *this;
+}
+
 const td::td_api::message *Outputter::get_message(td::int64 chat_id, td::int64 message_id) {
   if (!cur_chat_) {
     return nullptr;
@@ -114,18 +130,8 @@ const td::td_api::message *Outputter::get_message(td::int64 chat_id, td::int64 m
 
 Outputter &Outputter::operator<<(const LeftPad &x) {
   if (x.pad.size() > 0) {
-    pad_left_stack_.push_arg(
-        *this, sb_.as_cslice().size(), markup_idx_++,
-        [pad = std::move(x.pad), color = std::move(x.color)](size_t from_pos, size_t from_idx, size_t to_pos,
-                                                             size_t to_idx) -> windows::MarkupElement {
-          windows::MarkupElementPos from(from_pos, from_idx);
-          windows::MarkupElementPos to(to_pos, to_idx);
-          windows::MarkupElement el;
-          color.visit(td::overloaded(
-              [&](Color c) { el = std::make_shared<windows::MarkupElementLeftPad>(from, to, pad, c); },
-              [&](ColorRGB c) { el = std::make_shared<windows::MarkupElementLeftPad>(from, to, pad, c); }));
-          return el;
-        });
+    pad_left_stack_.push_arg(*this, sb_.as_cslice().size(), markup_idx_++, windows::MarkupKind::LeftPad,
+                             markup_.add_left_pad(x.pad, x.color));
   } else {
     pad_left_stack_.pop_arg(*this, sb_.as_cslice().size(), markup_idx_++);
   }
@@ -142,24 +148,21 @@ Outputter &Outputter::operator<<(const RightPad &x) {
 Outputter &Outputter::operator<<(const Photo &obj) {
   windows::MarkupElementPos from(sb_.as_cslice().size(), markup_idx_++);
   windows::MarkupElementPos to(sb_.as_cslice().size(), markup_idx_++);
-  markup_.push_back(std::make_shared<windows::MarkupElementImage>(from, to, obj.path.str(), obj.height, obj.width, 20,
-                                                                  1000, obj.allow_pixel));
+  markup_.add_image(from, to, false, {obj.path.str(), obj.height, obj.width, 20, 1000, obj.allow_pixel});
   return *this;
 }
 
 Outputter &Outputter::operator<<(const UserpicPhoto &obj) {
   windows::MarkupElementPos from(sb_.as_cslice().size(), markup_idx_++);
   windows::MarkupElementPos to(sb_.as_cslice().size(), markup_idx_++);
-  markup_.push_back(std::make_shared<windows::MarkupElementImage>(from, to, obj.path.str(), obj.height, obj.width, 2, 4,
-                                                                  obj.allow_pixel));
+  markup_.add_image(from, to, false, {obj.path.str(), obj.height, obj.width, 2, 4, obj.allow_pixel});
   return *this;
 }
 
 Outputter &Outputter::operator<<(const UserpicPhotoData &obj) {
   windows::MarkupElementPos from(sb_.as_cslice().size(), markup_idx_++);
   windows::MarkupElementPos to(sb_.as_cslice().size(), markup_idx_++);
-  markup_.push_back(std::make_shared<windows::MarkupElementImageData>(from, to, obj.data.str(), obj.height, obj.width,
-                                                                      2, 4, obj.allow_pixel));
+  markup_.add_image(from, to, true, {obj.data.str(), obj.height, obj.width, 2, 4, obj.allow_pixel});
   return *this;
 }
 
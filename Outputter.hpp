@@ -27,6 +27,7 @@ using Color = windows::Color;
 using ColorRGB = windows::ColorRGB;
 
 class ChatWindow;
+struct PreparedMessage;
 
 class Outputter {
  public:
@@ -36,14 +37,14 @@ class Outputter {
     int size;
   };
   Outputter() {
-    //args_.resize(windows::MarkupElement::Attr::Max);
-    bool_stack_.push_back(std::make_unique<ArgListBoolImpl<windows::MarkupElementUnderline>>());
-    bool_stack_.push_back(std::make_unique<ArgListBoolImpl<windows::MarkupElementBold>>());
-    bool_stack_.push_back(std::make_unique<ArgListBoolImpl<windows::MarkupElementItalic>>());
-    bool_stack_.push_back(std::make_unique<ArgListBoolImpl<windows::MarkupElementReverse>>());
-    bool_stack_.push_back(std::make_unique<ArgListBoolImpl<windows::MarkupElementBlink>>());
-    bool_stack_.push_back(std::make_unique<ArgListBoolImpl<windows::MarkupElementStrike>>());
-    bool_stack_.push_back(std::make_unique<ArgListBoolImpl<windows::MarkupElementNoLb>>());
+    // in the order of indices of ChangeBoolImpl
+    bool_stack_.emplace_back(windows::MarkupKind::Underline);
+    bool_stack_.emplace_back(windows::MarkupKind::Bold);
+    bool_stack_.emplace_back(windows::MarkupKind::Italic);
+    bool_stack_.emplace_back(windows::MarkupKind::Reverse);
+    bool_stack_.emplace_back(windows::MarkupKind::Blink);
+    bool_stack_.emplace_back(windows::MarkupKind::Strike);
+    bool_stack_.emplace_back(windows::MarkupKind::NoLb);
   }
   struct Date {
     td::int32 date;
@@ -99,6 +100,13 @@ class Outputter {
     td::Slice data;
   };
 
+  // text formatted by another outputter, e.g. on another thread, together with its markup
+  struct Fragment {
+    std::string text;
+    windows::MarkupSpans markup;
+    size_t markup_idx{0};
+  };
+
   using Underline = ChangeBoolImpl<windows::MarkupElementUnderline, 0>;
   using Bold = ChangeBoolImpl<windows::MarkupElementBold, 1>;
   using Italic = ChangeBoolImpl<windows::MarkupElementItalic, 2>;
@@ -137,9 +145,12 @@ class Outputter {
   }
 
   std::vector<windows::MarkupElement> markup();
+  // the same markup as plain values with sorted events, ready to be rendered
+  windows::MarkupSpans markup_spans();
   std::string as_str() {
     return sb_.as_cslice().str();
   }
+  Fragment as_fragment();
   td::CSlice as_cslice() {
     return sb_.as_cslice();
   }
@@ -162,10 +173,11 @@ class Outputter {
   }
   Outputter &operator<<(const LeftPad &x);
   Outputter &operator<<(const RightPad &x);
+  Outputter &operator<<(const Fragment &x);
 
   template <typename T, size_t x>
   Outputter &operator<<(const ChangeBoolImpl<T, x> &el) {
-    bool_stack_[x]->push_arg(*this, sb_.as_cslice().size(), markup_idx_++, el.type);
+    bool_stack_[x].push_arg(*this, sb_.as_cslice().size(), markup_idx_++, el.type);
     return *this;
   }
 
@@ -175,6 +187,25 @@ class Outputter {
     cur_chat_ = chat;
   }
 
+  // parts of the message, which were formatted in background; they are used only for the message with the same
+  // identifier
+  void set_prepared_message(const PreparedMessage *message) {
+    prepared_message_ = message;
+  }
+  const PreparedMessage *prepared_message() const {
+    return prepared_message_;
+  }
+
+  // the text is already formatted, the fragment is output instead of formatting the text again; is set only while
+  // the content of a prepared message is output
+  void set_formatted_text(const td::td_api::formattedText *text, const Fragment *fragment) {
+    formatted_text_ = text;
+    formatted_text_fragment_ = fragment;
+  }
+  const Fragment *get_formatted_text(const td::td_api::formattedText &text) const {
+    return &text == formatted_text_ ? formatted_text_fragment_ : nullptr;
+  }
+
   struct Photo {
     td::CSlice path;
     td::int32 width;
@@ -201,84 +232,78 @@ class Outputter {
  private:
   void set_color(td::Variant<Color, ColorRGB> color, bool is_fg);
 
-  std::vector<windows::MarkupElement> markup_;
+  windows::MarkupSpans markup_;
   ChatWindow *cur_chat_{nullptr};
+  const PreparedMessage *prepared_message_{nullptr};
+  const td::td_api::formattedText *formatted_text_{nullptr};
+  const Fragment *formatted_text_fragment_{nullptr};
   td::StringBuilder sb_;
 
+  // an open span: its kind and payload are known, the end isn't
   struct Arg {
-    Arg(size_t from_pos, size_t from_idx, std::function<windows::MarkupElement(size_t, size_t, size_t, size_t)> create)
-        : from_pos(from_pos), from_idx(from_idx), create(std::move(create)) {
-    }
     size_t from_pos;
     size_t from_idx;
-    std::function<windows::MarkupElement(size_t, size_t, size_t, size_t)> create;
+    windows::MarkupKind kind;
+    td::uint32 payload;
   };
   class ArgList {
    private:
-    std::list<Arg> args;
+    std::vector<Arg> args;
+
+    static void add_span(windows::MarkupSpans &markup, const Arg &arg, size_t pos, size_t idx) {
+      markup.add(windows::MarkupElementPos(arg.from_pos, arg.from_idx), windows::MarkupElementPos(pos, idx), arg.kind,
+                 arg.payload);
+    }
 
    public:
-    virtual ~ArgList() = default;
-    void push_arg(Outputter &out, size_t pos, size_t idx,
-                  std::function<windows::MarkupElement(size_t, size_t, size_t, size_t)> create) {
+    void push_arg(Outputter &out, size_t pos, size_t idx, windows::MarkupKind kind, td::uint32 payload) {
       if (args.size() > 0) {
-        out.markup_.push_back(args.back().create(args.back().from_pos, args.back().from_idx, pos, idx));
+        add_span(out.markup_, args.back(), pos, idx);
       }
-      args.emplace_back(pos, idx, std::move(create));
+      args.push_back(Arg{pos, idx, kind, payload});
     }
     void pop_arg(Outputter &out, size_t pos, size_t idx) {
       CHECK(args.size() > 0);
-      out.markup_.push_back(args.back().create(args.back().from_pos, args.back().from_idx, pos, idx));
+      add_span(out.markup_, args.back(), pos, idx);
       args.pop_back();
     }
     void flush(Outputter &out, size_t pos, size_t idx) {
       if (args.size() > 0) {
-        out.markup_.push_back(args.back().create(args.back().from_pos, args.back().from_idx, pos, idx));
+        add_span(out.markup_, args.back(), pos, idx);
         args.back().from_pos = pos;
       }
     }
-    void flush_to(std::vector<windows::MarkupElement> &markup, size_t pos, size_t idx) {
+    void flush_to(windows::MarkupSpans &markup, size_t pos, size_t idx) {
       if (args.size() > 0) {
-        markup.push_back(args.back().create(args.back().from_pos, args.back().from_idx, pos, idx));
+        add_span(markup, args.back(), pos, idx);
       }
     }
   };
 
   class ArgListBool : public ArgList {
    public:
-    virtual void push_arg(Outputter &out, size_t pos, size_t idx, ChangeBool value) = 0;
-  };
-
-  template <typename T>
-  class ArgListBoolImpl : public ArgListBool {
-   public:
-    void push_arg(Outputter &out, size_t pos, size_t idx, ChangeBool value) override {
+    explicit ArgListBool(windows::MarkupKind kind) : kind_(kind) {
+    }
+    void push_arg(Outputter &out, size_t pos, size_t idx, ChangeBool value) {
       switch (value) {
         case ChangeBool::Revert:
           pop_arg(out, pos, idx);
           return;
         case ChangeBool::Enable:
-          ArgList::push_arg(out, pos, idx,
-                            [](size_t from, size_t from_idx, size_t to, size_t to_idx) -> windows::MarkupElement {
-                              return std::make_shared<T>(windows::MarkupElementPos(from, from_idx),
-                                                         windows::MarkupElementPos(to, to_idx), true);
-                            });
-          return;
         case ChangeBool::Disable:
-          ArgList::push_arg(out, pos, idx,
-                            [](size_t from, size_t from_idx, size_t to, size_t to_idx) -> windows::MarkupElement {
-                              return std::make_shared<T>(windows::MarkupElementPos(from, from_idx),
-                                                         windows::MarkupElementPos(to, to_idx), true);
-                            });
+          ArgList::push_arg(out, pos, idx, kind_, 1);
           return;
       }
     }
+
+   private:
+    windows::MarkupKind kind_;
   };
 
   ArgList fg_colors_stack_;
   ArgList bg_colors_stack_;
   ArgList pad_left_stack_;
-  std::vector<std::unique_ptr<ArgListBool>> bool_stack_;
+  std::vector<ArgListBool> bool_stack_;
   size_t markup_idx_{100};
 };
 
@@ -0,0 +1,183 @@
+#include "SessionRecord.hpp"
+
+#include "td/telegram/td_api_json.h"
+#include "td/tl/tl_json.h"
+#include "td/utils/JsonBuilder.h"
+#include "td/utils/logging.h"
+#include "td/utils/SliceBuilder.h"
+
+#include <cstring>
+
+namespace tdcurses {
+
+namespace {
+
+constexpr char SessionRecordMagic[] = "TCREC001";
+constexpr size_t SessionRecordHeaderSize =
+    sizeof(td::uint8) + sizeof(td::uint64) + sizeof(td::int32) + sizeof(td::uint32);
+
+td::Result<td::tl_object_ptr<td::td_api::Object>> decode_object(std::string &payload) {
+  TRY_RESULT(value, td::json_decode(td::MutableSlice(payload)));
+  td::tl_object_ptr<td::td_api::Object> object;
+  using td::from_json;
+  TRY_STATUS(from_json(object, std::move(value)));
+  if (!object) {
+    return td::Status::Error("empty object in session record");
+  }
+  return std::move(object);
+}
+
+}  // namespace
+
+SessionRecorder::~SessionRecorder() {
+  if (file_) {
+    gzclose(file_);
+  }
+}
+
+td::Status SessionRecorder::open(td::CSlice file_name) {
+  CHECK(!file_);
+  file_ = gzopen(file_name.c_str(), "wb");
+  if (!file_) {
+    return td::Status::Error(PSLICE() << "failed to open record file '" << file_name << "'");
+  }
+  gzwrite(file_, SessionRecordMagic, sizeof(SessionRecordMagic) - 1);
+  return td::Status::OK();
+}
+
+void SessionRecorder::write_record(SessionRecordType type, td::uint64 id, td::int32 constructor_id,
+                                   td::Slice payload) {
+  char header[SessionRecordHeaderSize];
+  char *ptr = header;
+  auto store = [&](const auto &value) {
+    std::memcpy(ptr, &value, sizeof(value));
+    ptr += sizeof(value);
+  };
+  store(static_cast<td::uint8>(type));
+  store(id);
+  store(constructor_id);
+  store(static_cast<td::uint32>(payload.size()));
+  gzwrite(file_, header, SessionRecordHeaderSize);
+  if (payload.size() > 0) {
+    gzwrite(file_, payload.data(), (unsigned)payload.size());
+  }
+  // the client usually exits with _Exit(), so keep the file readable up to the last flushed record
+  if (++unflushed_records_ >= 1024) {
+    gzflush(file_, Z_SYNC_FLUSH);
+    unflushed_records_ = 0;
+  }
+}
+
+void SessionRecorder::write_update(const td::td_api::Update &update) {
+  write_record(SessionRecordType::Update, 0, update.get_id(), td::json_encode<std::string>(td::ToJson(update)));
+}
+
+void SessionRecorder::write_request(td::uint64 query_id, const td::td_api::Function &function) {
+  write_record(SessionRecordType::Request, query_id, function.get_id(), td::Slice());
+}
+
+void SessionRecorder::write_result(td::uint64 query_id, const td::td_api::Object &result) {
+  write_record(SessionRecordType::Result, query_id, result.get_id(), td::json_encode<std::string>(td::ToJson(result)));
+}
+
+SessionReplay::~SessionReplay() {
+  if (file_) {
+    gzclose(file_);
+  }
+}
+
+td::Result<bool> SessionReplay::read_record(Record &record) {
+  char header[SessionRecordHeaderSize];
+  auto r = gzread(file_, header, SessionRecordHeaderSize);
+  if (r == 0) {
+    return false;
+  }
+  if (r != (int)SessionRecordHeaderSize) {
+    return td::Status::Error("truncated session record header");
+  }
+  const char *ptr = header;
+  auto fetch = [&](auto &value) {
+    std::memcpy(&value, ptr, sizeof(value));
+    ptr += sizeof(value);
+  };
+  td::uint8 type;
+  td::uint32 length;
+  fetch(type);
+  fetch(record.id);
+  fetch(record.constructor_id);
+  fetch(length);
+  record.type = static_cast<SessionRecordType>(type);
+  record.payload.resize(length);
+  if (length > 0 && gzread(file_, &record.payload[0], length) != (int)length) {
+    return td::Status::Error("truncated session record");
+  }
+  return true;
+}
+
+td::Status SessionReplay::open(td::CSlice file_name) {
+  CHECK(!file_);
+  file_ = gzopen(file_name.c_str(), "rb");
+  if (!file_) {
+    return td::Status::Error(PSLICE() << "failed to open record file '" << file_name << "'");
+  }
+  char magic[sizeof(SessionRecordMagic) - 1];
+  if (gzread(file_, magic, sizeof(magic)) != (int)sizeof(magic) ||
+      std::memcmp(magic, SessionRecordMagic, sizeof(magic)) != 0) {
+    return td::Status::Error(PSLICE() << "'" << file_name << "' is not a session record file");
+  }
+  auto data_start = gztell(file_);
+
+  std::map<td::uint64, td::int32> request_functions;
+  Record record;
+  while (true) {
+    TRY_RESULT(has_record, read_record(record));
+    if (!has_record) {
+      break;
+    }
+    if (record.type == SessionRecordType::Request) {
+      request_functions[record.id] = record.constructor_id;
+    } else if (record.type == SessionRecordType::Result) {
+      auto it = request_functions.find(record.id);
+      if (it == request_functions.end()) {
+        LOG(WARNING) << "result for unknown query " << record.id << " in session record";
+        continue;
+      }
+      TRY_RESULT(object, decode_object(record.payload));
+      results_[it->second].push_back(std::move(object));
+      request_functions.erase(it);
+    }
+  }
+
+  if (gzseek(file_, data_start, SEEK_SET) != data_start) {
+    return td::Status::Error("failed to rewind session record");
+  }
+  return td::Status::OK();
+}
+
+td::Result<td::tl_object_ptr<td::td_api::Update>> SessionReplay::next_update() {
+  Record record;
+  while (true) {
+    TRY_RESULT(has_record, read_record(record));
+    if (!has_record) {
+      return td::tl_object_ptr<td::td_api::Update>();
+    }
+    if (record.type != SessionRecordType::Update) {
+      continue;
+    }
+    TRY_RESULT(object, decode_object(record.payload));
+    replayed_updates_++;
+    return td::move_tl_object_as<td::td_api::Update>(std::move(object));
+  }
+}
+
+td::tl_object_ptr<td::td_api::Object> SessionReplay::next_result(td::int32 function_constructor_id) {
+  auto it = results_.find(function_constructor_id);
+  if (it == results_.end() || it->second.empty()) {
+    return nullptr;
+  }
+  auto result = std::move(it->second.front());
+  it->second.pop_front();
+  return result;
+}
+
+}  // namespace tdcurses
@@ -0,0 +1,76 @@
+#pragma once
+
+#include "td/generate/auto/td/telegram/td_api.h"
+#include "td/tl/TlObject.h"
+#include "td/utils/Slice.h"
+#include "td/utils/Status.h"
+#include "td/utils/common.h"
+
+#include <zlib.h>
+#include <list>
+#include <map>
+#include <string>
+
+namespace tdcurses {
+
+/*
+ * Session record file is a gzip compressed stream of records. Each record is
+ *   type:uint8 id:uint64 constructor_id:int32 length:uint32 payload:bytes[length]
+ * in host byte order. Payload of updates and results is the TDLib JSON representation of the object,
+ * requests are stored without payload: replay only needs to know which function was called.
+ */
+enum class SessionRecordType : td::uint8 { Update = 1, Request = 2, Result = 3 };
+
+class SessionRecorder {
+ public:
+  SessionRecorder() = default;
+  SessionRecorder(const SessionRecorder &) = delete;
+  SessionRecorder &operator=(const SessionRecorder &) = delete;
+  ~SessionRecorder();
+
+  td::Status open(td::CSlice file_name);
+
+  void write_update(const td::td_api::Update &update);
+  void write_request(td::uint64 query_id, const td::td_api::Function &function);
+  void write_result(td::uint64 query_id, const td::td_api::Object &result);
+
+ private:
+  void write_record(SessionRecordType type, td::uint64 id, td::int32 constructor_id, td::Slice payload);
+
+  gzFile file_{nullptr};
+  td::uint32 unflushed_records_{0};
+};
+
+class SessionReplay {
+ public:
+  SessionReplay() = default;
+  SessionReplay(const SessionReplay &) = delete;
+  SessionReplay &operator=(const SessionReplay &) = delete;
+  ~SessionReplay();
+
+  // results are read in advance, updates are streamed from the file by next_update()
+  td::Status open(td::CSlice file_name);
+
+  td::Result<td::tl_object_ptr<td::td_api::Update>> next_update();
+  // result of the next not yet replayed call of the function, or nullptr if there is none
+  td::tl_object_ptr<td::td_api::Object> next_result(td::int32 function_constructor_id);
+
+  td::int64 replayed_updates() const {
+    return replayed_updates_;
+  }
+
+ private:
+  struct Record {
+    SessionRecordType type;
+    td::uint64 id;
+    td::int32 constructor_id;
+    std::string payload;
+  };
+  td::Result<bool> read_record(Record &record);
+
+  gzFile file_{nullptr};
+  std::map<td::int32, std::list<td::tl_object_ptr<td::td_api::Object>>> results_;
+  td::int64 replayed_updates_{0};
+};
+
+}  // namespace tdcurses
@@ -80,54 +80,192 @@ bool show_image(const td::tl_object_ptr<td::td_api::file> &f) {
   return global_parameters().image_path_is_allowed(f->local_->path_);
 }
 
-Outputter &operator<<(Outputter &out, const td::td_api::message &message) {
-  auto start_pos = out.as_cslice().size();
-  auto C = chat_manager().get_chat(message.chat_id_);
-  if (C->chat_type() == ChatType::SecretChat || C->chat_type() == ChatType::User) {
-    if (message.is_outgoing_) {
-      out << Color::Blue;
-    } else {
-      out << Color::Green;
+static std::string get_user_name(const std::shared_ptr<User> &user) {
+  if (!user) {
+    return "(unknown)";
+  }
+  if (user->first_name().size() > 0) {
+    if (user->last_name().size() > 0) {
+      return user->first_name() + " " + user->last_name();
     }
+    return user->first_name();
+  } else if (user->last_name().size() > 0) {
+    return user->last_name();
   } else {
-    add_color(out, *message.sender_id_, ColorScheme::Mode::NormalForeground);
+    return "(empty)";
   }
+}
 
-  out << Outputter::Date{message.date_} << " ";
+static std::string get_chat_name(const std::shared_ptr<Chat> &chat) {
+  if (!chat) {
+    return "(unknown)";
+  }
+  return chat->title();
+}
+
+static std::string get_reaction_type_text(const td::td_api::ReactionType &type) {
+  std::string res;
+  td::td_api::downcast_call(const_cast<td::td_api::ReactionType &>(type),
+                            td::overloaded([&](const td::td_api::reactionTypeEmoji &t) { res = t.emoji_; },
+                                           [&](const td::td_api::reactionTypeCustomEmoji &t) {
+                                             res = sticker_manager().get_custom_emoji(t.custom_emoji_id_).str();
+                                             if (res.empty()) {
+                                               res = "?";
+                                             }
+                                           },
+                                           [&](const td::td_api::reactionTypePaid &t) { res = "⭐"; }));
+  return res;
+}
 
+MessageData get_message_data(const td::td_api::message &message) {
+  MessageData res;
+  res.chat_id = message.chat_id_;
+  res.message_id = message.id_;
+  auto C = chat_manager().get_chat(message.chat_id_);
   if (C->chat_type() == ChatType::SecretChat || C->chat_type() == ChatType::User) {
-    // ???
+    res.color = message.is_outgoing_ ? Color::Blue : Color::Green;
   } else {
-    out << message.sender_id_ << " ";
+    res.color = get_color(*message.sender_id_, ColorScheme::Mode::NormalForeground);
+    res.show_sender = true;
+    td::td_api::downcast_call(const_cast<td::td_api::MessageSender &>(*message.sender_id_),
+                              td::overloaded(
+                                  [&](const td::td_api::messageSenderUser &u) {
+                                    res.sender = get_user_name(chat_manager().get_user(u.user_id_));
+                                  },
+                                  [&](const td::td_api::messageSenderChat &c) {
+                                    res.sender = get_chat_name(chat_manager().get_chat(c.chat_id_));
+                                  }));
   }
+  res.date = message.date_;
+  res.is_outgoing = message.is_outgoing_;
+  res.is_read = message.is_outgoing_ && C->last_read_outbox_message_id() >= message.id_;
 
-  if (message.is_outgoing_) {
-    if (C->last_read_outbox_message_id() >= message.id_) {
+  if (message.forward_info_) {
+    res.is_forwarded = true;
+    res.forward_date = message.forward_info_->date_;
+    td::td_api::downcast_call(
+        const_cast<td::td_api::MessageOrigin &>(*message.forward_info_->origin_),
+        td::overloaded(
+            [&](const td::td_api::messageOriginUser &o) {
+              res.forward_origin = get_user_name(chat_manager().get_user(o.sender_user_id_));
+            },
+            [&](const td::td_api::messageOriginChannel &o) {
+              res.forward_origin = get_chat_name(chat_manager().get_chat(o.chat_id_));
+            },
+            [&](const td::td_api::messageOriginChat &o) {
+              res.forward_origin = get_chat_name(chat_manager().get_chat(o.sender_chat_id_));
+            },
+            [&](const td::td_api::messageOriginHiddenUser &o) { res.forward_origin = o.sender_name_; }));
+  }
+
+  if (message.via_bot_user_id_) {
+    auto user = chat_manager().get_user(message.via_bot_user_id_);
+    if (user) {
+      res.via_bot = get_user_name(user);
+    }
+  }
+
+  if (message.interaction_info_) {
+    res.view_count = message.interaction_info_->view_count_;
+    res.forward_count = message.interaction_info_->forward_count_;
+    if (message.interaction_info_->reactions_) {
+      for (auto &r : message.interaction_info_->reactions_->reactions_) {
+        MessageData::Reaction reaction;
+        reaction.total_count = r->total_count_;
+        reaction.is_chosen = r->is_chosen_;
+        reaction.type = get_reaction_type_text(*r->type_);
+        res.reactions.push_back(std::move(reaction));
+      }
+    }
+  }
+  return res;
+}
+
+static void output_message_header(Outputter &out, const MessageData &message) {
+  out << message.color;
+  out << Outputter::Date{message.date} << " ";
+  if (message.show_sender) {
+    out << " " << message.sender << " ";
+  }
+
+  if (message.is_outgoing) {
+    if (message.is_read) {
       out << "\xe2\x9c\x93\xe2\x9c\x93 ";
     } else {
       out << " \xe2\x9c\x94 ";
     }
   } else {
     out << "   ";
-    /*if (C->last_read_outbox_message_id() >= message.id_) {
-      out << ">>> ";
-    } else {
-      out << "--> ";
-    }*/
   }
 
-  if (message.forward_info_) {
-    out << Color::Aqua << "fwd " << message.forward_info_ << Color::Revert << "\n";
+  if (message.is_forwarded) {
+    out << Color::Aqua << "fwd " << message.forward_origin << " " << Outputter::Date{message.forward_date}
+        << Color::Revert << "\n";
   }
 
-  if (message.via_bot_user_id_) {
-    auto user = chat_manager().get_user(message.via_bot_user_id_);
-    if (user) {
-      out << "via bot " << Outputter::FgColor{Color::Red} << user << Outputter::FgColor{Color::Revert} << "\n";
-    }
+  if (!message.via_bot.empty()) {
+    out << "via bot " << Outputter::FgColor{Color::Red} << message.via_bot << Outputter::FgColor{Color::Revert}
+        << "\n";
   }
 
   out << Color::Revert;
+}
+
+static void output_message_footer(Outputter &out, const MessageData &message) {
+  if (message.view_count > 0) {
+    out << "[" << message.view_count << "👁]";
+  }
+  if (message.forward_count > 0) {
+    out << "[" << message.forward_count << "⏭]";
+  }
+  for (auto &r : message.reactions) {
+    if (r.is_chosen) {
+      out << Outputter::FgColor(Color::Yellow);
+    }
+    out << "[" << r.total_count << r.type << "]";
+    if (r.is_chosen) {
+      out << Outputter::FgColor(Color::Revert);
+    }
+  }
+  out << " ";
+}
+
+PreparedMessage prepare_message(const MessageData &message, const FormattedTextData *text) {
+  PreparedMessage res;
+  res.chat_id = message.chat_id;
+  res.message_id = message.message_id;
+  {
+    Outputter out;
+    output_message_header(out, message);
+    res.header = out.as_fragment();
+  }
+  if (text) {
+    Outputter out;
+    out << *text;
+    res.has_text = true;
+    res.text = out.as_fragment();
+  }
+  {
+    Outputter out;
+    output_message_footer(out, message);
+    res.footer = out.as_fragment();
+  }
+  return res;
+}
+
+Outputter &operator<<(Outputter &out, const td::td_api::message &message) {
+  auto start_pos = out.as_cslice().size();
+  auto prepared = out.prepared_message();
+  if (prepared && (prepared->chat_id != message.chat_id_ || prepared->message_id != message.id_)) {
+    prepared = nullptr;
+  }
+  MessageData data;
+  if (prepared) {
+    out << prepared->header;
+  } else {
+    data = get_message_data(message);
+    output_message_header(out, data);
+  }
 
   if (message.reply_to_) {
     td::td_api::downcast_call(
@@ -157,7 +295,12 @@ Outputter &operator<<(Outputter &out, const td::td_api::message &message) {
             [&](const td::td_api::messageReplyToStory &r) {}));
   }
 
+  if (prepared && prepared->has_text) {
+    // only the text of this message is replaced, but not texts of link previews or quotes inside of it
+    out.set_formatted_text(get_message_text(*message.content_), &prepared->text);
+  }
   out << message.content_;
+  out.set_formatted_text(nullptr, nullptr);
 
   if (message.interaction_info_ &&
       (message.interaction_info_->view_count_ || message.interaction_info_->forward_count_ ||
@@ -169,24 +312,11 @@ Outputter &operator<<(Outputter &out, const td::td_api::message &message) {
     } else {
       out << "\n";
     }
-    if (message.interaction_info_->view_count_ > 0) {
-      out << "[" << message.interaction_info_->view_count_ << "👁]";
-    }
-    if (message.interaction_info_->forward_count_ > 0) {
-      out << "[" << message.interaction_info_->forward_count_ << "⏭]";
-    }
-    if (message.interaction_info_->reactions_) {
-      for (auto &r : message.interaction_info_->reactions_->reactions_) {
-        if (r->is_chosen_) {
-          out << Outputter::FgColor(Color::Yellow);
-        }
-        out << "[" << r->total_count_ << r->type_ << "]";
-        if (r->is_chosen_) {
-          out << Outputter::FgColor(Color::Revert);
-        }
-      }
+    if (prepared) {
+      out << prepared->footer;
+    } else {
+      output_message_footer(out, data);
     }
-    out << " ";
   }
   return out;
 }
@@ -654,89 +784,149 @@ Outputter &operator<<(Outputter &out, const td::td_api::messageUnsupported &cont
   return out << "[website " << content.domain_name_ << " connected]";
 }*/
 
-Outputter &operator<<(Outputter &out, const td::td_api::formattedText &content) {
-  auto enable_disable_markup = [&](const td::td_api::TextEntityType *ent, bool enable) {
-    td::td_api::downcast_call(
-        const_cast<td::td_api::TextEntityType &>(*ent),
-        td::overloaded(
-            [&](const td::td_api::textEntityTypeMention &) { out << (enable ? Color::Red : Color::Revert); },
-            [&](const td::td_api::textEntityTypeHashtag &) {}, [&](const td::td_api::textEntityTypeCashtag &) {},
-            [&](const td::td_api::textEntityTypeBotCommand &) {},
-            [&](const td::td_api::textEntityTypeUrl &) { out << Outputter::Underline(enable); },
-            [&](const td::td_api::textEntityTypeEmailAddress &) { out << Outputter::Underline(enable); },
-            [&](const td::td_api::textEntityTypePhoneNumber &) { out << Outputter::Underline(enable); },
-            [&](const td::td_api::textEntityTypeBankCardNumber &) { out << Outputter::Underline(enable); },
-            [&](const td::td_api::textEntityTypeBold &) { out << Outputter::Bold(enable); },
-            [&](const td::td_api::textEntityTypeItalic &) { out << Outputter::Italic(enable); },
-            [&](const td::td_api::textEntityTypeUnderline &) { out << Outputter::Underline(enable); },
-            [&](const td::td_api::textEntityTypeStrikethrough &) { out << Outputter::Strike(enable); },
-            [&](const td::td_api::textEntityTypeSpoiler &) {}, [&](const td::td_api::textEntityTypeCode &) {},
-            [&](const td::td_api::textEntityTypePre &) {
-              if (enable) {
-                out << "\n" << Outputter::BgColorRgb{ColorRGB{0x1C2841}};
-                out << Outputter::LeftPad{"██ ", Color::Aqua};
-              } else {
-                out << Outputter::LeftPad{"", Color::White};
-                out << Outputter::BgColor{Color::Revert};
-              }
-            },
-            [&](const td::td_api::textEntityTypePreCode &) {
-              if (enable) {
-                out << "\n" << Outputter::BgColorRgb{ColorRGB{0x1C2841}};
-                out << Outputter::LeftPad{"██ ", Color::Aqua};
-              } else {
-                out << Outputter::LeftPad{"", Color::White};
-                out << Outputter::BgColor{Color::Revert};
-              }
-            },
-            [&](const td::td_api::textEntityTypeBlockQuote &e) {
-              if (enable) {
-                out << "\n" << Outputter::BgColorRgb{ColorRGB{0x002000}};
-                out << Outputter::LeftPad{"\"\" ", Color::Aqua};
-              } else {
-                out << Outputter::LeftPad{"", Color::White};
-                out << Outputter::BgColor{Color::Revert};
-              }
-            },
-            [&](const td::td_api::textEntityTypeExpandableBlockQuote &e) {
-              if (enable) {
-                out << "\n" << Outputter::BgColorRgb{ColorRGB{0x002000}};
-                out << Outputter::LeftPad{"\"\" ", Color::Aqua};
-              } else {
-                out << Outputter::LeftPad{"", Color::White};
-                out << Outputter::BgColor{Color::Revert};
-              }
-            },
-            [&](const td::td_api::textEntityTypeTextUrl &e) {
-              out << Outputter::Underline(enable);
-              if (!enable) {
-                out << "[" << e.url_ << "]";
-              }
-            },
-            [&](const td::td_api::textEntityTypeMentionName &) { out << (enable ? Color::Red : Color::Revert); },
-            [&](const td::td_api::textEntityTypeCustomEmoji &) {},
-            [&](const td::td_api::textEntityTypeMediaTimestamp &) {}));
+FormattedTextData copy_formatted_text(const td::td_api::formattedText &text) {
+  FormattedTextData res;
+  res.text = text.text_;
+  res.entities.reserve(text.entities_.size());
+  for (auto &e : text.entities_) {
+    FormattedTextData::Entity entity;
+    entity.offset = e->offset_;
+    entity.length = e->length_;
+    entity.type_id = e->type_->get_id();
+    if (entity.type_id == td::td_api::textEntityTypeTextUrl::ID) {
+      entity.url = static_cast<const td::td_api::textEntityTypeTextUrl &>(*e->type_).url_;
+    }
+    res.entities.push_back(std::move(entity));
+  }
+  return res;
+}
+
+const td::td_api::formattedText *get_message_text(const td::td_api::MessageContent &content) {
+  const td::tl_object_ptr<td::td_api::formattedText> *res = nullptr;
+  switch (content.get_id()) {
+    case td::td_api::messageText::ID:
+      res = &static_cast<const td::td_api::messageText &>(content).text_;
+      break;
+    case td::td_api::messageAnimation::ID:
+      res = &static_cast<const td::td_api::messageAnimation &>(content).caption_;
+      break;
+    case td::td_api::messageAudio::ID:
+      res = &static_cast<const td::td_api::messageAudio &>(content).caption_;
+      break;
+    case td::td_api::messageDocument::ID:
+      res = &static_cast<const td::td_api::messageDocument &>(content).caption_;
+      break;
+    case td::td_api::messagePaidMedia::ID:
+      res = &static_cast<const td::td_api::messagePaidMedia &>(content).caption_;
+      break;
+    case td::td_api::messagePhoto::ID:
+      res = &static_cast<const td::td_api::messagePhoto &>(content).caption_;
+      break;
+    case td::td_api::messageVideo::ID:
+      res = &static_cast<const td::td_api::messageVideo &>(content).caption_;
+      break;
+    default:
+      break;
+  }
+  return res ? res->get() : nullptr;
+}
+
+// an entity of td_api::formattedText or of its copy in FormattedTextData
+struct TextEntityView {
+  td::int32 offset;
+  td::int32 length;
+  td::int32 type_id;
+  td::Slice url;
+};
+
+static TextEntityView get_text_entity_view(const FormattedTextData::Entity &e) {
+  return TextEntityView{e.offset, e.length, e.type_id, e.url};
+}
+
+static TextEntityView get_text_entity_view(const td::tl_object_ptr<td::td_api::textEntity> &e) {
+  TextEntityView res{e->offset_, e->length_, e->type_->get_id(), td::Slice()};
+  if (res.type_id == td::td_api::textEntityTypeTextUrl::ID) {
+    res.url = static_cast<const td::td_api::textEntityTypeTextUrl &>(*e->type_).url_;
+  }
+  return res;
+}
+
+template <class EntitiesT>
+static Outputter &output_formatted_text(Outputter &out, td::CSlice content_text, const EntitiesT &entities) {
+  auto enable_disable_markup = [&](const TextEntityView &e, bool enable) {
+    switch (e.type_id) {
+      case td::td_api::textEntityTypeMention::ID:
+      case td::td_api::textEntityTypeMentionName::ID:
+        out << (enable ? Color::Red : Color::Revert);
+        break;
+      case td::td_api::textEntityTypeUrl::ID:
+      case td::td_api::textEntityTypeEmailAddress::ID:
+      case td::td_api::textEntityTypePhoneNumber::ID:
+      case td::td_api::textEntityTypeBankCardNumber::ID:
+      case td::td_api::textEntityTypeUnderline::ID:
+        out << Outputter::Underline(enable);
+        break;
+      case td::td_api::textEntityTypeBold::ID:
+        out << Outputter::Bold(enable);
+        break;
+      case td::td_api::textEntityTypeItalic::ID:
+        out << Outputter::Italic(enable);
+        break;
+      case td::td_api::textEntityTypeStrikethrough::ID:
+        out << Outputter::Strike(enable);
+        break;
+      case td::td_api::textEntityTypePre::ID:
+      case td::td_api::textEntityTypePreCode::ID:
+        if (enable) {
+          out << "\n" << Outputter::BgColorRgb{ColorRGB{0x1C2841}};
+          out << Outputter::LeftPad{"██ ", Color::Aqua};
+        } else {
+          out << Outputter::LeftPad{"", Color::White};
+          out << Outputter::BgColor{Color::Revert};
+        }
+        break;
+      case td::td_api::textEntityTypeBlockQuote::ID:
+      case td::td_api::textEntityTypeExpandableBlockQuote::ID:
+        if (enable) {
+          out << "\n" << Outputter::BgColorRgb{ColorRGB{0x002000}};
+          out << Outputter::LeftPad{"\"\" ", Color::Aqua};
+        } else {
+          out << Outputter::LeftPad{"", Color::White};
+          out << Outputter::BgColor{Color::Revert};
+        }
+        break;
+      case td::td_api::textEntityTypeTextUrl::ID:
+        out << Outputter::Underline(enable);
+        if (!enable) {
+          out << "[" << e.url << "]";
+        }
+        break;
+      default:
+        break;
+    }
   };
-  std::vector<std::pair<size_t, const td::td_api::TextEntityType *>> en;
-  std::vector<std::pair<size_t, const td::td_api::TextEntityType *>> dis;
-  for (auto &m : content.entities_) {
-    if (m->length_ > 0) {
-      en.emplace_back(m->offset_, m->type_.get());
-      dis.emplace_back(m->offset_ + m->length_, m->type_.get());
+  // pairs of the offset and the index of the entity
+  std::vector<std::pair<size_t, size_t>> en;
+  std::vector<std::pair<size_t, size_t>> dis;
+  for (size_t i = 0; i < entities.size(); i++) {
+    auto m = get_text_entity_view(entities[i]);
+    if (m.length > 0) {
+      en.emplace_back(m.offset, i);
+      dis.emplace_back(m.offset + m.length, i);
     }
   }
   size_t enp = 0, disp = 0;
   std::sort(en.begin(), en.end());
   std::sort(dis.begin(), dis.end());
-  const unsigned char *text = td::CSlice(content.text_).ubegin();
+  const unsigned char *text = content_text.ubegin();
   size_t p = 0;
   while (*text) {
     while (enp < en.size() && en[enp].first <= p) {
-      enable_disable_markup(en[enp].second, true);
+      enable_disable_markup(get_text_entity_view(entities[en[enp].second]), true);
       enp++;
     }
     while (disp < dis.size() && dis[disp].first <= p) {
-      enable_disable_markup(dis[disp].second, false);
+      enable_disable_markup(get_text_entity_view(entities[dis[disp].second]), false);
       disp++;
     }
     td::uint32 code;
@@ -746,16 +936,28 @@ Outputter &operator<<(Outputter &out, const td::td_api::formattedText &content)
     p += (code <= 0xffff) ? 1 : 2;  // UTF16 codepoints =((
   }
   while (enp < en.size()) {
-    enable_disable_markup(en[enp].second, true);
+    enable_disable_markup(get_text_entity_view(entities[en[enp].second]), true);
     enp++;
   }
   while (disp < dis.size()) {
-    enable_disable_markup(dis[disp].second, false);
+    enable_disable_markup(get_text_entity_view(entities[dis[disp].second]), false);
     disp++;
   }
   return out;
 }
 
+Outputter &operator<<(Outputter &out, const td::td_api::formattedText &content) {
+  auto fragment = out.get_formatted_text(content);
+  if (fragment) {
+    return out << *fragment;
+  }
+  return output_formatted_text(out, content.text_, content.entities_);
+}
+
+Outputter &operator<<(Outputter &out, const FormattedTextData &content) {
+  return output_formatted_text(out, content.text, content.entities);
+}
+
 Outputter &operator<<(Outputter &out, const td::td_api::linkPreview &content) {
   out << content.url_;
   if (content.description_) {
@@ -943,30 +1145,11 @@ Outputter &operator<<(Outputter &out, const td::td_api::messageSenderUser &sende
 }
 
 Outputter &operator<<(Outputter &out, const std::shared_ptr<Chat> &chat) {
-  if (chat) {
-    out << chat->title();
-    return out;
-  } else {
-    return out << "(unknown)";
-  }
+  return out << get_chat_name(chat);
 }
 
 Outputter &operator<<(Outputter &out, const std::shared_ptr<User> &chat) {
-  if (chat) {
-    if (chat->first_name().size() > 0) {
-      out << chat->first_name();
-      if (chat->last_name().size() > 0) {
-        out << " " << chat->last_name();
-      }
-    } else if (chat->last_name().size() > 0) {
-      out << chat->last_name();
-    } else {
-      out << "(empty)";
-    }
-    return out;
-  } else {
-    return out << "(unknown)";
-  }
+  return out << get_user_name(chat);
 }
 
 Outputter &operator<<(Outputter &out, const td::td_api::reactionTypeEmoji &e) {
@@ -9,6 +9,8 @@
 #include "Outputter.hpp"
 #include "managers/ChatManager.hpp"
 #include <memory>
+#include <string>
+#include <vector>
 //#include "types.h"
 
 namespace tdcurses {
@@ -116,6 +118,67 @@ Outputter &operator<<(Outputter &out, const td::td_api::messageProximityAlertTri
 Outputter &operator<<(Outputter &out, const td::td_api::messageUnsupported &content);
 
 Outputter &operator<<(Outputter &, const td::td_api::formattedText &content);
+
+// formatted text with only what its output needs, so that it can be formatted on another thread
+struct FormattedTextData {
+  struct Entity {
+    td::int32 offset;
+    td::int32 length;
+    td::int32 type_id;
+    // only for textEntityTypeTextUrl
+    std::string url;
+  };
+  std::string text;
+  std::vector<Entity> entities;
+};
+
+FormattedTextData copy_formatted_text(const td::td_api::formattedText &text);
+Outputter &operator<<(Outputter &, const FormattedTextData &content);
+// text of a text message or caption of a media message, which is output with the message; nullptr, if there is none
+const td::td_api::formattedText *get_message_text(const td::td_api::MessageContent &content);
+
+// the header and the footer of a message with only what their output needs, so that they can be formatted on another
+// thread. Names and colors are looked up, when the snapshot is made
+struct MessageData {
+  struct Reaction {
+    td::int32 total_count;
+    bool is_chosen;
+    std::string type;
+  };
+
+  td::int64 chat_id{0};
+  td::int64 message_id{0};
+  td::Variant<Color, ColorRGB> color{Color::Revert};
+  td::int32 date{0};
+  // senders aren't shown in private chats
+  bool show_sender{false};
+  std::string sender;
+  bool is_outgoing{false};
+  bool is_read{false};
+  bool is_forwarded{false};
+  std::string forward_origin;
+  td::int32 forward_date{0};
+  // empty, if the message isn't sent via a bot
+  std::string via_bot;
+  td::int32 view_count{0};
+  td::int32 forward_count{0};
+  std::vector<Reaction> reactions;
+};
+
+MessageData get_message_data(const td::td_api::message &message);
+
+// a message formatted from its snapshot; replies and media depend on other messages and on files, so they are output
+// from the message itself
+struct PreparedMessage {
+  td::int64 chat_id{0};
+  td::int64 message_id{0};
+  Outputter::Fragment header;
+  bool has_text{false};
+  Outputter::Fragment text;
+  Outputter::Fragment footer;
+};
+
+PreparedMessage prepare_message(const MessageData &message, const FormattedTextData *text);
 Outputter &operator<<(Outputter &, const td::td_api::linkPreview &content);
 Outputter &operator<<(Outputter &, const td::td_api::webPageInstantView &content);
 Outputter &operator<<(Outputter &, const td::td_api::animation &content);
@@ -33,6 +33,9 @@
 #include "td/utils/port/StdStreams.h"
 
 #include "windows/EditorWindow.hpp"
+#include "windows/ImageCache.hpp"
+#include "windows/StickerAnimation.hpp"
+#include "windows/TextLayoutCache.hpp"
 #include "windows/Markup.hpp"
 #include "windows/unicode.h"
 
@@ -56,6 +59,9 @@
 #include "common-windows/YesNoWindow.hpp"
 #include "managers/NotificationManager.hpp"
 #include "MessageProcess.hpp"
+#include "MessageFormatter.hpp"
+#include "Debug.hpp"
+#include "SessionRecord.hpp"
 #include "common-windows/MenuWindowView.hpp"
 
 #include "qrcodegen/qrcodegen.hpp"
@@ -227,6 +233,26 @@ class TdcursesImpl : public Tdcurses {
 
     start_curses();
 
+    if (!global_parameters().replay_file().empty()) {
+      replay_ = std::make_unique<SessionReplay>();
+      auto S = replay_->open(global_parameters().replay_file());
+      if (S.is_error()) {
+        screen()->stop();
+        LOG(FATAL) << "failed to start replay: " << S;
+      }
+      replay_started_at_ = td::Time::now();
+      td::send_closure_later(self_, &TdcursesImpl::replay_step);
+      return;
+    }
+    if (!global_parameters().record_file().empty()) {
+      recorder_ = std::make_unique<SessionRecorder>();
+      auto S = recorder_->open(global_parameters().record_file());
+      if (S.is_error()) {
+        LOG(ERROR) << "failed to start recording: " << S;
+        recorder_ = nullptr;
+      }
+    }
+
     td_ = td::create_actor<td::ClientActor>("ClientActor", make_td_callback());
 
     send_request(td::make_tl_object<td::td_api::setOption>("notification_group_count_max",
@@ -246,12 +272,18 @@ class TdcursesImpl : public Tdcurses {
   }
 
   void on_result(td::uint64 id, td::tl_object_ptr<td::td_api::Object> result) {
+    if (recorder_) {
+      recorder_->write_result(id, *result);
+    }
     auto it = handlers_.find(id);
     it->second.set_result(std::move(result));
     handlers_.erase(it);
     refresh();
   }
   void on_error(td::uint64 id, td::tl_object_ptr<td::td_api::error> result) {
+    if (recorder_) {
+      recorder_->write_result(id, *result);
+    }
     auto it = handlers_.find(id);
     it->second.set_error(td::Status::Error(result->code_, result->message_));
     handlers_.erase(it);
@@ -260,10 +292,68 @@ class TdcursesImpl : public Tdcurses {
 
   void on_update(td::tl_object_ptr<td::td_api::Update> update) {
     total_updates++;
+    if (recorder_) {
+      recorder_->write_update(*update);
+    }
+    auto constructor_id = update->get_id();
+    auto &stats = update_stats().get(constructor_id);
+    if (stats.name.empty()) {
+      auto str = td::td_api::to_string(update);
+      stats.name = str.substr(0, std::min(str.find(' '), str.size()));
+    }
+    auto start = td::Time::now();
     td::td_api::downcast_call(*update.get(), [Self = this](auto &obj) { Self->process_update(obj); });
+    update_stats().add_update(constructor_id, td::Time::now() - start);
     refresh();
   }
 
+  void replay_step() {
+    // a bounded batch per step, so that frames are rendered in between as they would be for a live session
+    for (int i = 0; i < 100; i++) {
+      auto R = replay_->next_update();
+      if (R.is_error()) {
+        LOG(ERROR) << "failed to read session record: " << R.move_as_error();
+        finish_replay();
+        return;
+      }
+      auto update = R.move_as_ok();
+      if (!update) {
+        finish_replay();
+        return;
+      }
+      on_update(std::move(update));
+    }
+    td::send_closure_later(self_, &TdcursesImpl::replay_step);
+  }
+
+  void finish_replay() {
+    auto elapsed = td::Time::now() - replay_started_at_;
+    auto updates = replay_->replayed_updates();
+    const auto &frames = update_stats().frames();
+    auto us = [](double t) { return (td::int64)(t * 1e6); };
+    td::StringBuilder sb;
+    sb << "replayed " << updates << " updates in " << td::format::as_time(elapsed) << ": "
+       << (elapsed > 0 ? (td::int64)((double)updates / elapsed) : 0) << " updates/sec\n";
+    sb << "frames: " << frames.count << " p50=" << us(frames.percentile(0.5))
+       << "us p99=" << us(frames.percentile(0.99)) << "us max=" << us(frames.max_time) << "us\n";
+    auto M = td::mem_stat();
+    if (M.is_ok()) {
+      sb << "peak memory: " << td::format::as_size(M.ok().resident_size_peak_) << "\n";
+    }
+    sb << update_stats().to_str();
+    LOG(WARNING) << sb.as_cslice();
+    std::cout << sb.as_cslice().str() << std::flush;
+    if (!global_parameters().snapshot_file().empty()) {
+      screen()->refresh(true);
+      auto S = td::write_file(global_parameters().snapshot_file(), screen()->snapshot());
+      if (S.is_error()) {
+        LOG(ERROR) << "failed to write screen snapshot: " << S;
+      }
+    }
+    screen()->stop();
+    db_closed = true;
+  }
+
   void process_auth_state(td::td_api::authorizationStateWaitTdlibParameters &state) {
     send_request(clone_tdlib_parameters(),
                  td::PromiseCreator::lambda([self = self_](td::Result<td::tl_object_ptr<td::td_api::ok>> R) {
@@ -630,6 +720,7 @@ class TdcursesImpl : public Tdcurses {
   }
 
   void process_auth_state(td::td_api::authorizationStateClosed &state) {
+    recorder_ = nullptr;
     screen()->stop();
     _Exit(0);
     db_closed = true;
@@ -827,6 +918,7 @@ class TdcursesImpl : public Tdcurses {
   //updateChatTitle chat_id:int53 title:string = Update;
   void process_update(td::td_api::updateChatTitle &update) {
     dialog_list_window()->process_update(update);
+    invalidate_chat_window_render_models();
   }
 
   //@description A chat photo was changed
@@ -846,6 +938,7 @@ class TdcursesImpl : public Tdcurses {
   //updateChatAccentColors chat_id:int53 accent_color_id:int32 background_custom_emoji_id:int64 profile_accent_color_id:int32 profile_background_custom_emoji_id:int64 = Update;
   void process_update(td::td_api::updateChatAccentColors &update) {
     dialog_list_window()->process_update(update);
+    invalidate_chat_window_render_models();
   }
 
   //@description Chat permissions were changed
@@ -903,6 +996,10 @@ class TdcursesImpl : public Tdcurses {
   //@last_read_outbox_message_id Identifier of last read outgoing message
   //updateChatReadOutbox chat_id:int53 last_read_outbox_message_id:int53 = Update;
   void process_update(td::td_api::updateChatReadOutbox &update) {
+    auto c = chat_window();
+    if (c) {
+      c->process_update(update);
+    }
     dialog_list_window()->process_update(update);
   }
 
@@ -1314,6 +1411,7 @@ class TdcursesImpl : public Tdcurses {
   //updateUser user:user = Update;
   void process_update(td::td_api::updateUser &update) {
     dialog_list_window()->process_user_update(update);
+    invalidate_chat_window_render_models();
   }
 
   //@description Some data of a basic group has changed. This update is guaranteed to come before the basic group identifier is returned to the application
@@ -1599,6 +1697,11 @@ class TdcursesImpl : public Tdcurses {
       CHECK(update.value_->get_id() == td::td_api::optionValueBoolean::ID);
       auto value = static_cast<const td::td_api::optionValueBoolean &>(*update.value_).value_;
       global_parameters().set_show_pixel_images(value);
+      invalidate_chat_window_render_models();
+    } else if (update.name_ == "X-low-bandwidth-enabled") {
+      CHECK(update.value_->get_id() == td::td_api::optionValueBoolean::ID);
+      auto value = static_cast<const td::td_api::optionValueBoolean &>(*update.value_).value_;
+      global_parameters().set_low_bandwidth(value);
     } else if (update.name_ == "X-allowed-image-extensions") {
       CHECK(update.value_->get_id() == td::td_api::optionValueString::ID);
       auto value = static_cast<const td::td_api::optionValueString &>(*update.value_).value_;
@@ -1702,6 +1805,7 @@ class TdcursesImpl : public Tdcurses {
   //updateAccentColors colors:vector<accentColor> available_accent_color_ids:vector<int32> = Update;
   void process_update(td::td_api::updateAccentColors &update) {
     global_parameters().process_update(update);
+    invalidate_chat_window_render_models();
   }
 
   //@description The list of supported accent colors for user profiles has changed
@@ -1710,6 +1814,7 @@ class TdcursesImpl : public Tdcurses {
   //updateProfileAccentColors colors:vector<profileAccentColor> available_accent_color_ids:vector<int32> = Update;
   void process_update(td::td_api::updateProfileAccentColors &update) {
     global_parameters().process_update(update);
+    invalidate_chat_window_render_models();
   }
 
   //@description Some language pack strings have been updated
@@ -2129,6 +2234,17 @@ class TdcursesImpl : public Tdcurses {
                        td::Promise<td::tl_object_ptr<td::td_api::Object>> cb) override {
     auto id = ++last_query_id_;
     handlers_.emplace(id, std::move(cb));
+    if (replay_) {
+      auto result = replay_->next_result(func->get_id());
+      if (!result) {
+        result = td::make_tl_object<td::td_api::error>(404, "no result in session record");
+      }
+      td::send_closure_later(self_, &TdcursesImpl::on_result, id, std::move(result));
+      return;
+    }
+    if (recorder_) {
+      recorder_->write_request(id, *func);
+    }
     td::send_closure(td_, &td::ClientActor::request, id, std::move(func));
   }
 
@@ -2139,7 +2255,14 @@ class TdcursesImpl : public Tdcurses {
   void update_layout_parameters() override;
 
  private:
+  size_t pending_requests_count() const override {
+    return handlers_.size();
+  }
+
   std::map<td::uint64, td::Promise<td::tl_object_ptr<td::td_api::Object>>> handlers_;
+  std::unique_ptr<SessionRecorder> recorder_;
+  std::unique_ptr<SessionReplay> replay_;
+  double replay_started_at_{0};
   td::uint64 last_query_id_{19};
   td::int32 unread_chats_{0};
 };
@@ -2156,6 +2279,10 @@ void Tdcurses::start_curses() {
 #endif
   } else if (backend_type_str == "Notcurses") {
     backend_type = windows::Screen::BackendType::Notcurses;
+  } else if (backend_type_str == "Null") {
+    backend_type = windows::Screen::BackendType::Null;
+  } else if (backend_type_str == "Grid") {
+    backend_type = windows::Screen::BackendType::Grid;
   } else if (backend_type_str == "auto") {
     backend_type = windows::Screen::BackendType::Auto;
   } else {
@@ -2182,6 +2309,9 @@ void Tdcurses::start_curses() {
   poll_fd_.set_native_fd(td::NativeFd{poll_fd});
   td::Scheduler::subscribe(poll_fd_.extract_pollable_fd(this), td::PollFlags::Read());
   loop();
+  // texts of messages are formatted on another scheduler, so that the main one isn't blocked by them
+  message_formatter_ = td::create_actor_on_scheduler<MessageFormatter>(
+      "MessageFormatter", td::Scheduler::instance()->sched_count() - 1, actor_id(this));
   layout_ = std::make_shared<TdcursesLayout>(this, actor_id(this));
   log_window_ = std::make_shared<windows::LogWindow>();
   log_interface_ =
@@ -2215,6 +2345,10 @@ void Tdcurses::start_curses() {
                                         std::make_unique<Callback>(), true);
         return;
       }
+      if (command == ":dump_update_stats") {
+        LOG(WARNING) << "update processing stats:\n" << update_stats().to_str();
+        return;
+      }
       if (command == ":test_file_selection") {
         curses_->spawn_file_selection_window({});
         return;
@@ -2341,39 +2475,107 @@ void Tdcurses::close_compose_window() {
   }
 }
 
+void Tdcurses::invalidate_chat_window_render_models() {
+  if (chat_window_) {
+    chat_window_->invalidate_render_models();
+  }
+}
+
+void Tdcurses::on_messages_formatted() {
+  if (chat_window_) {
+    chat_window_->on_elements_prepared();
+  }
+  refresh();
+}
+
 void Tdcurses::loop() {
   poll_fd_.sync_with_poll();
+  frame_scheduled_ = false;
+  auto max_fps = global_parameters().max_fps();
+  if (max_fps > 0 && last_frame_at_) {
+    auto next_frame_at = td::Timestamp::at(last_frame_at_.at() + 1.0 / max_fps);
+    if (!next_frame_at.is_in_past()) {
+      frame_scheduled_ = true;
+      set_timeout_at(next_frame_at.at());
+      return;
+    }
+  }
+  last_frame_at_ = td::Timestamp::now();
+  total_frames_++;
+  if (next_metrics_sample_at_.is_in_past()) {
+    sample_runtime_metrics();
+    next_metrics_sample_at_ = td::Timestamp::in(1.0);
+  }
+  auto frame_start = td::Time::now();
   auto t = screen_->loop();
+  update_stats().add_frame(td::Time::now() - frame_start);
   t.relax(td::Timestamp::in(0.5));
+  t.relax(next_metrics_sample_at_);
   if (t) {
     set_timeout_at(t.at());
   }
+}
+
+void Tdcurses::sample_runtime_metrics() {
+  auto now = td::Time::now();
+  auto elapsed = now - last_metrics_sample_at_;
+  bool has_previous_sample = last_metrics_sample_at_ > 0 && elapsed > 0;
+  auto &metrics = runtime_metrics();
+
   auto R = td::cpu_stat();
   if (R.is_ok()) {
-    update_cpu_stat(R.move_as_ok());
+    auto stat = R.move_as_ok();
+    if (has_previous_sample) {
+      auto ticks_per_second = (double)sysconf(_SC_CLK_TCK);
+      auto delta_usr = (double)(stat.process_user_ticks_ - last_cpu_stat_.process_user_ticks_);
+      auto delta_sys = (double)(stat.process_system_ticks_ - last_cpu_stat_.process_system_ticks_);
+      metrics.cpu_user_percent = 100.0 * delta_usr / ticks_per_second / elapsed;
+      metrics.cpu_system_percent = 100.0 * delta_sys / ticks_per_second / elapsed;
+    }
+    last_cpu_stat_ = stat;
+  }
+  auto M = td::mem_stat();
+  if (M.is_ok()) {
+    auto stat = M.move_as_ok();
+    metrics.resident_size = stat.resident_size_;
+    metrics.resident_size_peak = stat.resident_size_peak_;
+  }
+  if (has_previous_sample) {
+    metrics.updates_per_second = (double)(total_updates - last_sampled_updates_) / elapsed;
+    metrics.frames_per_second = (double)(total_frames_ - last_sampled_frames_) / elapsed;
+  }
+  metrics.total_updates = total_updates;
+  metrics.total_frames = total_frames_;
+  metrics.pending_requests = (td::int64)pending_requests_count();
+  metrics.sampled_at = now;
+
+  last_sampled_updates_ = total_updates;
+  last_sampled_frames_ = total_frames_;
+  last_metrics_sample_at_ = now;
+
+  auto &metrics_file = global_parameters().metrics_file();
+  if (!metrics_file.empty()) {
+    auto tmp_file = metrics_file + ".tmp";
+    auto S = td::write_file(tmp_file, metrics.to_json() + "\n");
+    if (S.is_ok()) {
+      S = td::rename(tmp_file, metrics_file);
+    }
+    if (S.is_error()) {
+      LOG(WARNING) << "failed to dump metrics to '" << metrics_file << "': " << S << ", disabling metrics dump";
+      global_parameters().set_metrics_file("");
+    }
   }
-}
 
-void Tdcurses::update_cpu_stat(td::CpuStat stat) {
-  auto ts = td::Time::now();
-
-  auto delta_tot = stat.total_ticks_ - last_cpu_stat_.total_ticks_;
-  auto delta_usr = stat.process_user_ticks_ - last_cpu_stat_.process_user_ticks_;
-  auto delta_sys = stat.process_system_ticks_ - last_cpu_stat_.process_system_ticks_;
-
-  auto coef = exp(-(ts - last_cpu_stat_at_));
-  relaxed_cpu_stat_.total_ticks_ = (td::int64)(coef * (double)relaxed_cpu_stat_.total_ticks_ + (double)delta_tot * 100);
-  relaxed_cpu_stat_.process_user_ticks_ =
-      (td::int64)(coef * (double)relaxed_cpu_stat_.process_user_ticks_ + (double)delta_usr * 100);
-  relaxed_cpu_stat_.process_system_ticks_ =
-      (td::int64)(coef * (double)relaxed_cpu_stat_.process_system_ticks_ + (double)delta_sys * 100);
-  last_cpu_stat_ = stat;
-  last_cpu_stat_at_ = ts;
   update_status_line();
 }
 
 void Tdcurses::refresh() {
-  loop();
+  if (frame_scheduled_) {
+    return;
+  }
+  frame_scheduled_ = true;
+  // queued after all already received updates and results, so the whole burst is rendered in one frame
+  td::send_closure_later(actor_id(this), &Tdcurses::loop);
 }
 
 void Tdcurses::tear_down() {
@@ -2417,11 +2619,9 @@ void TdcursesImpl::update_status_line() {
     }
     out << Outputter::Reverse(Outputter::ChangeBool::Revert) << " ";
     {
-      auto r = sysconf(_SC_CLK_TCK);
-      auto usr = (int)((double)relaxed_cpu_stat().process_user_ticks_ / (double)r);
-      auto sys = (int)((double)relaxed_cpu_stat().process_system_ticks_ / (double)r);
-
-      out << usr << "% " << sys << "%";
+      const auto &metrics = runtime_metrics();
+      out << (int)metrics.cpu_user_percent << "% " << (int)metrics.cpu_system_percent << "% "
+          << td::format::as_size(metrics.resident_size);
     }
     out << Outputter::Reverse(Outputter::ChangeBool::Enable) << " ";
     out << "\n";
@@ -2563,6 +2763,24 @@ int main(int argc, char **argv) {
     return td::Status::OK();
   });
 
+  std::string record_file;
+  std::string replay_file;
+  std::string snapshot_file;
+  p.add_checked_option('\0', "record", "record updates and request results to file", [&](td::Slice arg) {
+    record_file = arg.str();
+    return td::Status::OK();
+  });
+  p.add_checked_option('\0', "replay", "replay recorded session without network and terminal and print stats",
+                       [&](td::Slice arg) {
+                         replay_file = arg.str();
+                         return td::Status::OK();
+                       });
+  p.add_checked_option('\0', "snapshot", "render replayed session into memory and write the final screen to file",
+                       [&](td::Slice arg) {
+                         snapshot_file = arg.str();
+                         return td::Status::OK();
+                       });
+
   auto S = p.run(argc, argv);
   if (S.is_error()) {
     std::cerr << "failed to parse options: " << S.move_as_error().to_string() << std::endl;
@@ -2594,6 +2812,14 @@ int main(int argc, char **argv) {
   td::int32 dialog_list_window_width = 10;
   td::int32 log_window_height = 10;
   td::int32 compose_window_height = 10;
+  td::int32 max_fps = 60;
+  td::int32 chat_retained_screens = 10;
+  td::int32 image_cache_size_mb = 64;
+  td::int32 layout_cache_size_mb = 8;
+  td::int32 animation_cpu_percent = 25;
+  td::int32 animation_frames_size_mb = 32;
+  bool low_bandwidth = false;
+  std::string metrics_file;
 
   std::string copy_command = "wl-copy";
   std::string link_open_command = "xdg-open";
@@ -2632,9 +2858,16 @@ int main(int argc, char **argv) {
     iface.add("dialog_list_window_width", libconfig::Setting::TypeInt) = dialog_list_window_width;
     iface.add("log_window_height", libconfig::Setting::TypeInt) = log_window_height;
     iface.add("compose_window_height", libconfig::Setting::TypeInt) = compose_window_height;
+    iface.add("max_fps", libconfig::Setting::TypeInt) = max_fps;
+    iface.add("chat_retained_screens", libconfig::Setting::TypeInt) = chat_retained_screens;
+    iface.add("image_cache_size_mb", libconfig::Setting::TypeInt) = image_cache_size_mb;
+    iface.add("layout_cache_size_mb", libconfig::Setting::TypeInt) = layout_cache_size_mb;
+    iface.add("animation_cpu_percent", libconfig::Setting::TypeInt) = animation_cpu_percent;
+    iface.add("animation_frames_size_mb", libconfig::Setting::TypeInt) = animation_frames_size_mb;
     iface.add("use_markdown", libconfig::Setting::TypeBoolean) = use_markdown;
     iface.add("show_images", libconfig::Setting::TypeBoolean) = show_images;
     iface.add("show_pixel_images", libconfig::Setting::TypeBoolean) = show_pixel_images;
+    iface.add("low_bandwidth", libconfig::Setting::TypeBoolean) = low_bandwidth;
     auto &utf8 = root.add("utf8", libconfig::Setting::Type::TypeGroup);
     utf8.add("vs16_makes_wide", libconfig::Setting::TypeBoolean) = vs16_makes_wide;
     auto &widecode = utf8.add("codepoints_override", libconfig::Setting::TypeList);
@@ -2649,6 +2882,7 @@ int main(int argc, char **argv) {
     os.add("copy_command", libconfig::Setting::TypeString) = copy_command;
     os.add("link_open_command", libconfig::Setting::TypeString) = link_open_command;
     os.add("file_open_command", libconfig::Setting::TypeString) = file_open_command;
+    os.add("metrics_file", libconfig::Setting::TypeString) = metrics_file;
 
     conf.writeFile(config_file_name.c_str());
   }
@@ -2683,14 +2917,22 @@ int main(int argc, char **argv) {
   config.lookupValue("iface.use_markdown", use_markdown);
   config.lookupValue("iface.show_images", show_images);
   config.lookupValue("iface.show_pixel_images", show_pixel_images);
+  config.lookupValue("iface.low_bandwidth", low_bandwidth);
   config.lookupValue("iface.log_window_enabled", log_window_enabled);
   config.lookupValue("iface.dialog_list_window_width", dialog_list_window_width);
   config.lookupValue("iface.log_window_height", log_window_height);
   config.lookupValue("iface.compose_window_height", compose_window_height);
+  config.lookupValue("iface.max_fps", max_fps);
+  config.lookupValue("iface.chat_retained_screens", chat_retained_screens);
+  config.lookupValue("iface.image_cache_size_mb", image_cache_size_mb);
+  config.lookupValue("iface.layout_cache_size_mb", layout_cache_size_mb);
+  config.lookupValue("iface.animation_cpu_percent", animation_cpu_percent);
+  config.lookupValue("iface.animation_frames_size_mb", animation_frames_size_mb);
 
   config.lookupValue("os.copy_command", copy_command);
   config.lookupValue("os.link_open_command", link_open_command);
   config.lookupValue("os.file_open_command", file_open_command);
+  config.lookupValue("os.metrics_file", metrics_file);
 
   [&]() {
     auto &root = config.getRoot();
@@ -2738,11 +2980,7 @@ int main(int argc, char **argv) {
     force_wide_codepoints = std::move(r);
   }();
 
-  if (vs16_makes_wide) {
-    enable_wide_emojis();
-  }
-
-  if (force_wide_codepoints.size() > 0) {
+  if (vs16_makes_wide || force_wide_codepoints.size() > 0) {
     std::vector<UnicodeWidthBlock> b;
     auto term = getenv("TERM");
     for (auto &x : force_wide_codepoints) {
@@ -2750,7 +2988,7 @@ int main(int argc, char **argv) {
         b.emplace_back(x.begin, x.end, x.width);
       }
     }
-    override_unicode_width(std::move(b));
+    configure_unicode_width(vs16_makes_wide, std::move(b));
   }
 
   if (profile_name.size() > 0) {
@@ -2784,14 +3022,28 @@ int main(int argc, char **argv) {
   tdcurses::global_parameters().set_log_window_height(log_window_height);
   tdcurses::global_parameters().set_dialog_list_window_width(dialog_list_window_width);
   tdcurses::global_parameters().set_compose_window_height(compose_window_height);
+  tdcurses::global_parameters().set_max_fps(max_fps);
+  tdcurses::global_parameters().set_chat_retained_screens(chat_retained_screens);
+  windows::image_cache().set_max_size(static_cast<size_t>(std::max(image_cache_size_mb, 0)) << 20);
+  windows::text_layout_cache().set_max_size(static_cast<size_t>(std::max(layout_cache_size_mb, 0)) << 20);
+  windows::animation_player().set_cpu_budget(std::max(animation_cpu_percent, 0));
+  windows::animation_player().set_max_frames_size(static_cast<size_t>(std::max(animation_frames_size_mb, 0)) << 20);
 
   tdcurses::global_parameters().set_copy_command(copy_command);
   tdcurses::global_parameters().set_link_open_command(link_open_command);
   tdcurses::global_parameters().set_file_open_command(file_open_command);
+  tdcurses::global_parameters().set_metrics_file(metrics_file);
+  if (!replay_file.empty()) {
+    backend_type_str = snapshot_file.empty() ? "Null" : "Grid";
+  }
   tdcurses::global_parameters().set_backend_type(backend_type_str);
+  tdcurses::global_parameters().set_record_file(record_file);
+  tdcurses::global_parameters().set_replay_file(replay_file);
+  tdcurses::global_parameters().set_snapshot_file(snapshot_file);
   tdcurses::global_parameters().set_use_markdown(use_markdown);
   tdcurses::global_parameters().set_show_images(show_images);
   tdcurses::global_parameters().set_show_pixel_images(show_pixel_images);
+  tdcurses::global_parameters().set_low_bandwidth(low_bandwidth);
   tdcurses::global_parameters().set_default_dir(tdcurses::detect_default_dir());
   auto image_extensions = "jpg,jpeg,webp,webm,png,tgs,mp4";
   tdcurses::global_parameters().add_allowed_image_extensions(image_extensions);
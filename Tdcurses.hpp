@@ -27,6 +27,7 @@ class Chat;
 class StatusLineWindow;
 class CommandLineWindow;
 class TdcursesWindowBase;
+class MessageFormatter;
 
 class TdcursesInterface : public td::Actor {
  private:
@@ -120,8 +121,6 @@ class Tdcurses : public TdcursesInterface {
     }
   };
 
-  void update_cpu_stat(td::CpuStat stat);
-
   auto self_id() const {
     return self_;
   }
@@ -139,12 +138,22 @@ class Tdcurses : public TdcursesInterface {
   std::shared_ptr<StatusLineWindow> status_line_window_;
   std::shared_ptr<CommandLineWindow> command_line_window_;
   std::map<td::int64, TdcursesWindowBase *> all_active_windows_;
+  td::ActorOwn<MessageFormatter> message_formatter_;
 
   std::vector<Option> options_;
 
+  // runtime_metrics() are sampled from loop() once per second instead of on every frame
+  td::Timestamp next_metrics_sample_at_;
+  double last_metrics_sample_at_{0};
   td::CpuStat last_cpu_stat_;
-  td::CpuStat relaxed_cpu_stat_;
-  double last_cpu_stat_at_{0};
+  td::int64 last_sampled_updates_{0};
+  td::int64 last_sampled_frames_{0};
+  td::int64 total_frames_{0};
+
+  // updates and results are coalesced: refresh() only schedules a frame, the frame itself runs in loop()
+  // after the mailbox is drained and not more often than global_parameters().max_fps()
+  bool frame_scheduled_{false};
+  td::Timestamp last_frame_at_;
 
   bool exiting_{false};
 
@@ -189,6 +198,14 @@ class Tdcurses : public TdcursesInterface {
   void open_compose_window(td::int64 chat_id, td::int64 thread_id, td::int64 message_id, std::string quote);
   void open_edit_window(td::int64 chat_id, td::int64 message_id);
   void close_compose_window();
+  // messages are formatted with names and colors of their senders and with image settings, a change of them makes
+  // formatted messages stale
+  void invalidate_chat_window_render_models();
+  auto message_formatter() const {
+    return message_formatter_.get();
+  }
+  // some texts of messages were formatted by the message formatter
+  void on_messages_formatted();
 
   void loop() override;
   void refresh();
@@ -232,9 +249,8 @@ class Tdcurses : public TdcursesInterface {
   virtual void update_layout_parameters() = 0;
   td::PollableFdInfo poll_fd_;
 
-  const auto &relaxed_cpu_stat() const {
-    return relaxed_cpu_stat_;
-  }
+  virtual size_t pending_requests_count() const = 0;
+  void sample_runtime_metrics();
 
   void run_exit();
   void add_event(std::string text, std::vector<windows::MarkupElement> markup);
@@ -6,6 +6,7 @@
 #include "TdcursesWindowBase.hpp"
 #include "HelpWindow.hpp"
 #include "Debug.hpp"
+#include "DebugInfoWindow.hpp"
 #include "settings-menu/MainSettingsWindow.hpp"
 #include "ChatInfoWindow.hpp"
 #include "managers/GlobalParameters.hpp"
@@ -129,8 +130,7 @@ class TdcursesLayout
       create_menu_window<MainSettingsWindow>(root(), root_actor_id());
       return;
     } else if (info == "T-F12") {
-      auto s = debug_counters().to_str();
-      root()->spawn_popup_view_window(s, 1);
+      create_menu_window<DebugInfoWindow>(root(), root_actor_id())->create_debug_text();
       return;
     } else if (info == "T-F1") {
       Outputter out;
@@ -0,0 +1,230 @@
+#include "windows/Markup.hpp"
+#include "windows/Output.hpp"
+#include "windows/TextEdit.hpp"
+#include "windows/TextLayoutCache.hpp"
+#include "windows/unicode.h"
+
+#include "td/utils/benchmark.h"
+#include "td/utils/common.h"
+#include "td/utils/logging.h"
+#include "td/utils/Slice.h"
+
+#include <memory>
+#include <string>
+#include <vector>
+
+// outputter, which draws nothing, so that only segmentation and line wrapping are measured
+class BenchOutputter final : public windows::WindowOutputter {
+ public:
+  td::int32 putstr_yx(td::int32 y, td::int32 x, const char *s, size_t len) final {
+    output_bytes_ += len;
+    return 1;
+  }
+  void putstr_run(td::int32 y, td::int32 x, td::Slice s, td::int32 width) final {
+    output_bytes_ += s.size();
+  }
+  void cursor_move_yx(td::int32 y, td::int32 x, CursorShape cursor_shape) final {
+  }
+  void set_fg_color(windows::Color color) final {
+  }
+  void set_fg_color_rgb(windows::ColorRGB color) final {
+  }
+  void unset_fg_color() final {
+  }
+  void set_bg_color(windows::Color color) final {
+  }
+  void set_bg_color_rgb(windows::ColorRGB color) final {
+  }
+  void unset_bg_color() final {
+  }
+  void set_bold(bool value) final {
+  }
+  void unset_bold() final {
+  }
+  void set_underline(bool value) final {
+  }
+  void unset_underline() final {
+  }
+  void set_italic(bool value) final {
+  }
+  void unset_italic() final {
+  }
+  void set_reverse(bool value) final {
+  }
+  void unset_reverse() final {
+  }
+  void set_strike(bool value) final {
+  }
+  void unset_strike() final {
+  }
+  void set_blink(bool value) final {
+  }
+  void unset_blink() final {
+  }
+  bool is_real() const final {
+    return true;
+  }
+  td::int32 local_cursor_y() const final {
+    return 0;
+  }
+  td::int32 local_cursor_x() const final {
+    return 0;
+  }
+  td::int32 global_cursor_y() const final {
+    return 0;
+  }
+  td::int32 global_cursor_x() const final {
+    return 0;
+  }
+  CursorShape cursor_shape() const final {
+    return CursorShape::None;
+  }
+  void translate(td::int32 delta_y, td::int32 delta_x) final {
+  }
+  std::unique_ptr<WindowOutputter> create_subwindow_outputter(windows::BackendWindow *bw, td::int32 y_offset,
+                                                              td::int32 x_offset, td::int32 height, td::int32 width,
+                                                              bool is_active) final {
+    return nullptr;
+  }
+  void update_cursor_position_from(WindowOutputter &from, windows::BackendWindow *bw, td::int32 y_offset,
+                                   td::int32 x_offset) final {
+  }
+  bool is_active() const final {
+    return true;
+  }
+
+  size_t output_bytes() const {
+    return output_bytes_;
+  }
+
+ private:
+  size_t output_bytes_{0};
+};
+
+// a chat history of n messages, built of the given lines
+static std::vector<std::string> gen_history(const std::vector<std::string> &lines, size_t n) {
+  std::vector<std::string> res;
+  for (size_t i = 0; i < n; i++) {
+    std::string message;
+    for (size_t j = 0; j <= i % 3; j++) {
+      if (!message.empty()) {
+        message += '\n';
+      }
+      message += lines[(i + j) % lines.size()];
+    }
+    res.push_back(std::move(message));
+  }
+  return res;
+}
+
+static std::vector<std::string> english_history() {
+  return gen_history({"Hi! Are we still meeting tomorrow at 10:30?",
+                      "Yes, but let's move it to the small room, the big one is booked for the whole day.",
+                      "ok",
+                      "I've pushed the fix, could you take a look when you have a minute? It should be a quick one, "
+                      "the only change is in the parser (see the second commit).",
+                      "Thanks, looks good to me. Merged.",
+                      "lol"},
+                     1000);
+}
+
+static std::vector<std::string> cyrillic_history() {
+  return gen_history({"Привет! Мы всё ещё встречаемся завтра в 10:30?",
+                      "Да, но давай перенесём в маленькую переговорку, большая занята весь день.", "ок",
+                      "Я запушил исправление, посмотришь, когда будет минутка? Там немного, поменялся только парсер "
+                      "(см. второй коммит).",
+                      "Спасибо, выглядит хорошо. Смёрджил.", "ахах"},
+                     1000);
+}
+
+class TextEditRenderBench final : public td::Benchmark {
+ public:
+  TextEditRenderBench(std::string description, std::vector<std::string> history)
+      : description_(std::move(description)), history_(std::move(history)) {
+  }
+
+  std::string get_description() const final {
+    return description_;
+  }
+
+  void run(int n) final {
+    std::vector<windows::MarkupElement> markup;
+    td::int64 height = 0;
+    for (int i = 0; i < n; i++) {
+      for (auto &message : history_) {
+        height += windows::TextEdit::render(outputter_, 80, message, 0, markup, false, false);
+      }
+    }
+    LOG_CHECK(height > 0) << outputter_.output_bytes();
+  }
+
+ private:
+  std::string description_;
+  std::vector<std::string> history_;
+  BenchOutputter outputter_;
+};
+
+// how the text was walked before runs of printable ascii characters were skipped at once
+class GraphemSegmentationBench final : public td::Benchmark {
+ public:
+  GraphemSegmentationBench(std::string description, std::vector<std::string> history, bool use_ascii_runs)
+      : description_(std::move(description)), history_(std::move(history)), use_ascii_runs_(use_ascii_runs) {
+  }
+
+  std::string get_description() const final {
+    return description_;
+  }
+
+  void run(int n) final {
+    td::int64 width = 0;
+    for (int i = 0; i < n; i++) {
+      for (auto &message : history_) {
+        td::Slice text = message;
+        size_t pos = 0;
+        while (pos < text.size()) {
+          if (use_ascii_runs_) {
+            auto ascii_size = printable_ascii_prefix(text, pos);
+            if (ascii_size > 0) {
+              width += static_cast<td::int64>(ascii_size);
+              pos += ascii_size;
+              continue;
+            }
+          }
+          auto x = next_graphem(text, pos);
+          width += x.width;
+          pos += x.data.size();
+        }
+      }
+    }
+    LOG_CHECK(width != 0);
+  }
+
+ private:
+  std::string description_;
+  std::vector<std::string> history_;
+  bool use_ascii_runs_;
+};
+
+int main() {
+  SET_VERBOSITY_LEVEL(VERBOSITY_NAME(WARNING));
+  // layouts of the same texts would be taken from the cache after the first iteration
+  windows::text_layout_cache().set_max_size(0);
+
+  {
+    GraphemSegmentationBench bench("Segment english history by graphemes", english_history(), false);
+    td::bench(bench);
+  }
+  {
+    GraphemSegmentationBench bench("Segment english history with ascii runs", english_history(), true);
+    td::bench(bench);
+  }
+  {
+    TextEditRenderBench bench("TextEdit::render english history", english_history());
+    td::bench(bench);
+  }
+  {
+    TextEditRenderBench bench("TextEdit::render cyrillic history", cyrillic_history());
+    td::bench(bench);
+  }
+  return 0;
+}
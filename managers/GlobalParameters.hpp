@@ -183,6 +183,14 @@ class GlobalParameters {
     return file_open_command_;
   }
 
+  void set_metrics_file(std::string file_name) {
+    metrics_file_ = std::move(file_name);
+  }
+
+  const auto &metrics_file() const {
+    return metrics_file_;
+  }
+
   void update_my_user_id(td::int64 id) {
     my_user_id_ = id;
   }
@@ -218,6 +226,30 @@ class GlobalParameters {
     return backend_type_;
   }
 
+  void set_record_file(std::string file_name) {
+    record_file_ = std::move(file_name);
+  }
+
+  const auto &record_file() const {
+    return record_file_;
+  }
+
+  void set_replay_file(std::string file_name) {
+    replay_file_ = std::move(file_name);
+  }
+
+  const auto &replay_file() const {
+    return replay_file_;
+  }
+
+  void set_snapshot_file(std::string file_name) {
+    snapshot_file_ = std::move(file_name);
+  }
+
+  const auto &snapshot_file() const {
+    return snapshot_file_;
+  }
+
   bool notifications_enabled() const {
     return notifications_enabled_;
   }
@@ -275,6 +307,13 @@ class GlobalParameters {
     show_pixel_images_ = value;
   }
 
+  bool low_bandwidth() const {
+    return windows::refresh_rate().is_low_bandwidth();
+  }
+  void set_low_bandwidth(bool value) {
+    windows::refresh_rate().set_low_bandwidth(value);
+  }
+
   td::CSlice control_key() {
     return "C-a";
   }
@@ -357,6 +396,18 @@ class GlobalParameters {
   void set_compose_window_height(td::int32 value) {
     compose_window_height_ = value;
   }
+  auto max_fps() const {
+    return max_fps_;
+  }
+  void set_max_fps(td::int32 value) {
+    max_fps_ = value;
+  }
+  auto chat_retained_screens() const {
+    return chat_retained_screens_;
+  }
+  void set_chat_retained_screens(td::int32 value) {
+    chat_retained_screens_ = value;
+  }
 
  private:
   std::array<td::tl_object_ptr<td::td_api::scopeNotificationSettings>, NotificationScopeCount>
@@ -390,6 +441,7 @@ class GlobalParameters {
   std::string copy_command_;
   std::string link_open_command_;
   std::string file_open_command_;
+  std::string metrics_file_;
 
   td::int64 my_user_id_{0};
 
@@ -403,9 +455,14 @@ class GlobalParameters {
   td::int32 log_window_height_{10};
   td::int32 dialog_list_window_width_{10};
   td::int32 compose_window_height_{10};
+  td::int32 max_fps_{60};
+  td::int32 chat_retained_screens_{10};
 
   std::string tdlib_version_;
   std::string backend_type_;
+  std::string record_file_;
+  std::string replay_file_;
+  std::string snapshot_file_;
 
   std::string default_dir_;
 };
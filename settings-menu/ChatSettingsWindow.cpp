@@ -85,6 +85,7 @@ void ChatSettingsWindow::build_menu() {
               [](td::Result<td::tl_object_ptr<td::td_api::ok>> R) { R.ensure(); });
 
           global_parameters().set_show_pixel_images(enabled);
+          w.root()->invalidate_chat_window_render_models();
           Outputter out;
           if (enabled) {
             out << "enabled" << Outputter::RightPad{"<disable>"};
@@ -96,6 +97,34 @@ void ChatSettingsWindow::build_menu() {
           return false;
         });
   }
+  {
+    bool low_bandwidth_enabled = global_parameters().low_bandwidth();
+    Outputter out;
+    if (low_bandwidth_enabled) {
+      out << "enabled" << Outputter::RightPad{"<disable>"};
+    } else {
+      out << "disabled" << Outputter::RightPad{"<enable>"};
+    }
+    low_bandwidth_enabled_el_ = add_element("low bandwidth", out.as_str(), out.markup(), [](MenuWindowCommon &w) {
+      bool enabled = !global_parameters().low_bandwidth();
+      loading_window_send_request(
+          w, "changing settings", {},
+          td::make_tl_object<td::td_api::setOption>("X-low-bandwidth-enabled",
+                                                    td::make_tl_object<td::td_api::optionValueBoolean>(enabled)),
+          [](td::Result<td::tl_object_ptr<td::td_api::ok>> R) { R.ensure(); });
+
+      global_parameters().set_low_bandwidth(enabled);
+      Outputter out;
+      if (enabled) {
+        out << "enabled" << Outputter::RightPad{"<disable>"};
+      } else {
+        out << "disabled" << Outputter::RightPad{"<enable>"};
+      }
+      static_cast<ChatSettingsWindow &>(w).low_bandwidth_enabled_el_->menu_element()->data = out.as_str();
+      static_cast<ChatSettingsWindow &>(w).low_bandwidth_enabled_el_->menu_element()->markup = out.markup();
+      return false;
+    });
+  }
   {
     std::string allowed_extensions = global_parameters().export_allowed_image_extensions();
     Outputter out;
@@ -16,6 +16,7 @@ class ChatSettingsWindow : public MenuWindowCommon {
   std::shared_ptr<ElInfo> markdown_enabled_el_;
   std::shared_ptr<ElInfo> show_images_enabled_el_;
   std::shared_ptr<ElInfo> show_pixel_images_enabled_el_;
+  std::shared_ptr<ElInfo> low_bandwidth_enabled_el_;
   std::shared_ptr<ElInfo> allowed_image_extensions_el_;
   std::shared_ptr<ElInfo> log_window_enabled_el_;
   std::shared_ptr<ElInfo> log_window_height_el_;
@@ -4,32 +4,115 @@
 #include "td/utils/SharedSlice.h"
 #include "td/utils/filesystem.h"
 #include "unicode.h"
-
-#include "rlottie/inc/rlottie.h"
+#include "ImageCache.hpp"
+#include "ImageDecoder.hpp"
+#include "StickerAnimation.hpp"
+#include "td/utils/crypto.h"
+#include "td/utils/misc.h"
+#include "td/utils/Time.h"
 
 #include <memory>
 #include <notcurses/notcurses.h>
-#include <jpeglib.h>
 #include <vector>
-#include <zlib.h>
 
 namespace windows {
 
-std::vector<int> color_to_rgb{0x000000, 0xcc0403, 0x19cb00, 0xcecb00, 0x0d73cc, 0xcb1ed1, 0x0dcdcd, 0xdddddd,
-                              0x767676, 0xf2201f, 0x23fd00, 0xfffd00, 0x1a8fff, 0xfd28ff, 0x14ffff, 0xffffff};
+// size of a cell in pixels of the pixel blitter. It changes only with the terminal, so it is computed once and
+// reset on resize
+static std::pair<td::int32, td::int32> cached_cell_pixel_scale{0, 0};
+
+static void reset_cell_pixel_scale() {
+  cached_cell_pixel_scale = {0, 0};
+}
+
+static std::pair<td::int32, td::int32> cell_pixel_scale(struct notcurses *nc, struct ncplane *plane) {
+  if (cached_cell_pixel_scale.first > 0 && cached_cell_pixel_scale.second > 0) {
+    return cached_cell_pixel_scale;
+  }
+  struct ncvisual_options opts = {.n = plane,
+                                  .scaling = NCSCALE_NONE,
+                                  .y = 0,
+                                  .x = 0,
+                                  .begy = 0,
+                                  .begx = 0,
+                                  .leny = 0,
+                                  .lenx = 0,
+                                  .blitter = NCBLIT_PIXEL,
+                                  .flags = NCVISUAL_OPTION_CHILDPLANE,
+                                  .transcolor = 0,
+                                  .pxoffy = 0,
+                                  .pxoffx = 0};
+
+  struct ncvgeom geom;
+
+  CHECK(ncvisual_geom(nc, nullptr, &opts, &geom) >= 0);
+  cached_cell_pixel_scale = {(td::int32)geom.scaley, (td::int32)geom.scalex};
+  return cached_cell_pixel_scale;
+}
+
+// size in pixels of an image; if the caller doesn't know it, the size remembered after the file was decoded is used
+static std::pair<td::int32, td::int32> image_pixel_size(td::int32 image_height, td::int32 image_width,
+                                                        const std::string &path) {
+  if (image_height && image_width) {
+    return {image_height, image_width};
+  }
+  return image_cache().file_image_size(path);
+}
+
+// size in cells of an image of the given size in pixels, scaled to fit into max_height x max_width cells
+static std::pair<td::int32, td::int32> fit_image_to_cells(td::int32 max_height, td::int32 max_width,
+                                                          td::int32 image_height, td::int32 image_width,
+                                                          std::pair<td::int32, td::int32> scale) {
+  max_height *= scale.first;
+  max_width *= scale.second;
+
+  td::int32 real_height, real_width;
+
+  if (1ll * max_width * image_height > 1ll * max_height * image_width) {
+    real_height = max_height;
+    real_width = (int)(1ll * max_height * image_width / image_height);
+  } else {
+    real_height = (int)(1ll * max_width * image_height / image_width);
+    real_width = max_width;
+  }
+
+  return {(real_height + scale.first - 1) / scale.first, (real_width + scale.second - 1) / scale.second};
+}
 
 class RenderedImageNotcurses : public RenderedImage {
  public:
-  RenderedImageNotcurses(td::int32 renderd_to_width, td::int32 height, td::int32 width, td::int32 pix_height,
-                         td::int32 pix_width, bool allow_pixel, struct ncplane *plane, struct ncvisual *visual)
+  RenderedImageNotcurses(td::int32 renderd_to_width, std::pair<td::int32, td::int32> scale, bool allow_pixel,
+                         std::shared_ptr<DecodedImage> image)
+      : renderd_to_width_(renderd_to_width), scale_(scale), allow_pixel_(allow_pixel), plane_(nullptr) {
+    set_image(std::move(image));
+  }
+  // the image is empty until the job is finished; until then it only reserves height x width cells
+  RenderedImageNotcurses(td::int32 renderd_to_width, td::int32 height, td::int32 width,
+                         std::pair<td::int32, td::int32> scale, bool allow_pixel, std::shared_ptr<ImageDecodeJob> job,
+                         std::string cache_key, std::string file_path)
       : renderd_to_width_(renderd_to_width)
       , height_(height)
       , width_(width)
-      , pix_height_(pix_height)
-      , pix_width_(pix_width)
+      , scale_(scale)
       , allow_pixel_(allow_pixel)
-      , plane_(plane)
-      , visual_(visual) {
+      , plane_(nullptr)
+      , job_(std::move(job))
+      , cache_key_(std::move(cache_key))
+      , file_path_(std::move(file_path)) {
+    rendered_height_ = height;
+  }
+  // frames of animated stickers are taken from the animation
+  RenderedImageNotcurses(td::int32 renderd_to_width, td::int32 height, td::int32 width,
+                         std::pair<td::int32, td::int32> scale, bool allow_pixel,
+                         std::shared_ptr<StickerAnimation> animation, std::string file_path)
+      : renderd_to_width_(renderd_to_width)
+      , height_(height)
+      , width_(width)
+      , scale_(scale)
+      , allow_pixel_(allow_pixel)
+      , plane_(nullptr)
+      , animation_(std::move(animation))
+      , file_path_(std::move(file_path)) {
     rendered_height_ = height;
   }
 
@@ -37,7 +120,40 @@ class RenderedImageNotcurses : public RenderedImage {
     if (plane_) {
       ncplane_destroy(plane_);
     }
-    ncvisual_destroy(visual_);
+    if (job_) {
+      job_->cancel();
+    }
+  }
+
+  // returns true, if the image is still being decoded
+  bool is_pending() {
+    if (animation_) {
+      animation_->update();
+      if (animation_->is_loading()) {
+        return true;
+      }
+      auto frame = animation_->current_frame();
+      if (frame != image_) {
+        if (!image_ && frame) {
+          image_cache().set_file_image_size(file_path_, animation_->source_pix_height(),
+                                            animation_->source_pix_width());
+        }
+        set_image(std::move(frame));
+      }
+      return false;
+    }
+    if (job_ && job_->is_ready()) {
+      auto image = job_->release_image();
+      if (image) {
+        image_cache().put(cache_key_, image);
+        if (!file_path_.empty()) {
+          image_cache().set_file_image_size(file_path_, job_->source_pix_height(), job_->source_pix_width());
+        }
+      }
+      set_image(std::move(image));
+      job_ = nullptr;
+    }
+    return job_ != nullptr;
   }
 
   void hide() {
@@ -55,17 +171,24 @@ class RenderedImageNotcurses : public RenderedImage {
 
   void render_slice(struct notcurses *nc, struct ncplane *baseplane, td::int32 offset, td::int32 slice_height,
                     bool is_active) {
-    if (plane_ && offset_ == offset && rendered_height_ == slice_height && is_active_ == is_active) {
+    // pixel images are sent to the terminal in full on each redraw, so they are not used on slow connections
+    auto use_pixel = is_active && allow_pixel_ && !refresh_rate().is_low_bandwidth();
+    if (plane_ && offset_ == offset && rendered_height_ == slice_height && is_active_ == is_active &&
+        use_pixel_ == use_pixel && blitted_image_ == image_.get()) {
       return;
     }
+    auto start = td::Time::now();
     hide();
+    if (!image_) {
+      return;
+    }
     CHECK(slice_height >= 0 && slice_height <= height_);
     if (slice_height == 0) {
       return;
     }
     struct ncvgeom geom;
     memset(&geom, 0, sizeof(geom));
-    CHECK(ncvisual_geom(nc, visual_, nullptr, &geom) >= 0);
+    CHECK(ncvisual_geom(nc, image_->visual, nullptr, &geom) >= 0);
     CHECK(geom.cdimy > 0 && geom.cdimx > 0);
 
     struct ncplane *tmp_plane = nullptr;
@@ -83,19 +206,19 @@ class RenderedImageNotcurses : public RenderedImage {
       tmp_plane = ncplane_create(baseplane, &plane_opts);
       CHECK(tmp_plane);
       struct ncvisual_options opts = {.n = tmp_plane,
-                                      .scaling = (is_active && allow_pixel_) ? NCSCALE_NONE_HIRES : NCSCALE_STRETCH,
+                                      .scaling = use_pixel ? NCSCALE_NONE_HIRES : NCSCALE_STRETCH,
                                       .y = 0,
                                       .x = 0,
                                       .begy = (unsigned int)(offset * geom.cdimy),
                                       .begx = 0,
                                       .leny = (unsigned int)(slice_height * geom.cdimy),
-                                      .lenx = (unsigned int)pix_width_,
-                                      .blitter = (is_active && allow_pixel_) ? NCBLIT_PIXEL : NCBLIT_DEFAULT,
+                                      .lenx = (unsigned int)image_->pix_width,
+                                      .blitter = use_pixel ? NCBLIT_PIXEL : NCBLIT_DEFAULT,
                                       .flags = 0,
                                       .transcolor = 0,
                                       .pxoffy = 0,
                                       .pxoffx = 0};
-      plane_ = ncvisual_blit(nc, visual_, &opts);
+      plane_ = ncvisual_blit(nc, image_->visual, &opts);
     } else if (true) {
       struct ncvisual_options opts = {.n = nullptr,
                                       .scaling = is_active ? NCSCALE_NONE_HIRES : NCSCALE_SCALE,
@@ -104,13 +227,13 @@ class RenderedImageNotcurses : public RenderedImage {
                                       .begy = (unsigned int)(offset * geom.cdimy),
                                       .begx = 0,
                                       .leny = (unsigned int)(slice_height * geom.cdimy),
-                                      .lenx = (unsigned int)pix_width_,
+                                      .lenx = (unsigned int)image_->pix_width,
                                       .blitter = NCBLIT_PIXEL,
                                       .flags = 0,
                                       .transcolor = 0,
                                       .pxoffy = 0,
                                       .pxoffx = 0};
-      plane_ = ncvisual_blit(nc, visual_, &opts);
+      plane_ = ncvisual_blit(nc, image_->visual, &opts);
       if (plane_) {
         ncplane_reparent(plane_, baseplane);
         unsigned int y, x;
@@ -118,7 +241,7 @@ class RenderedImageNotcurses : public RenderedImage {
         if (y != (unsigned int)slice_height) {
           memset(&geom, 0, sizeof(geom));
           struct ncvgeom geom;
-          CHECK(ncvisual_geom(nc, visual_, &opts, &geom) >= 0);
+          CHECK(ncvisual_geom(nc, image_->visual, &opts, &geom) >= 0);
           LOG(ERROR) << "opts: origin=" << opts.begy << "x" << opts.begx << " size=" << opts.leny << "x" << opts.lenx;
           LOG(ERROR) << "geom: origin=" << geom.begy << "x" << geom.begx << " size=" << geom.leny << "x" << geom.lenx
                      << " rpix=" << geom.rpixy << "x" << geom.rpixx << " rcell=" << geom.rcelly << "x" << geom.rcellx;
@@ -133,14 +256,14 @@ class RenderedImageNotcurses : public RenderedImage {
                                       .x = 0,
                                       .begy = 0,
                                       .begx = 0,
-                                      .leny = (unsigned int)pix_height_,
-                                      .lenx = (unsigned int)pix_width_,
+                                      .leny = (unsigned int)image_->pix_height,
+                                      .lenx = (unsigned int)image_->pix_width,
                                       .blitter = NCBLIT_PIXEL,
                                       .flags = NCVISUAL_OPTION_CHILDPLANE,
                                       .transcolor = 0,
                                       .pxoffy = 0,
                                       .pxoffx = 0};
-      plane_ = ncvisual_blit(nc, visual_, &opts);
+      plane_ = ncvisual_blit(nc, image_->visual, &opts);
     } else {
       struct ncplane_options plane_opts = {.y = 0,
                                            .x = 0,
@@ -165,6 +288,18 @@ class RenderedImageNotcurses : public RenderedImage {
     offset_ = offset;
     rendered_height_ = slice_height;
     is_active_ = is_active;
+    use_pixel_ = use_pixel;
+    blitted_image_ = image_.get();
+    if (is_animated()) {
+      animation_player().add_draw_cost(td::Time::now() - start);
+    }
+  }
+
+  bool is_animated() const {
+    return animation_ && animation_->is_animated();
+  }
+  const std::shared_ptr<StickerAnimation> &animation() const {
+    return animation_;
   }
 
   td::int32 rendered_to_width() override {
@@ -182,17 +317,34 @@ class RenderedImageNotcurses : public RenderedImage {
   }
 
  private:
+  void set_image(std::shared_ptr<DecodedImage> image) {
+    image_ = std::move(image);
+    if (image_) {
+      height_ = (image_->pix_height + scale_.first - 1) / scale_.first;
+      width_ = (image_->pix_width + scale_.second - 1) / scale_.second;
+    } else {
+      height_ = 0;
+      width_ = 0;
+    }
+    rendered_height_ = height_;
+  }
+
   td::int32 renderd_to_width_;
-  td::int32 height_;
-  td::int32 width_;
-  td::int32 pix_height_;
-  td::int32 pix_width_;
+  td::int32 height_{0};
+  td::int32 width_{0};
+  std::pair<td::int32, td::int32> scale_;
   bool allow_pixel_;
   td::int32 offset_{0};
   td::int32 rendered_height_{0};
   bool is_active_{false};
+  bool use_pixel_{false};
   struct ncplane *plane_;
-  struct ncvisual *visual_;
+  std::shared_ptr<DecodedImage> image_;
+  const DecodedImage *blitted_image_{nullptr};
+  std::shared_ptr<ImageDecodeJob> job_;
+  std::shared_ptr<StickerAnimation> animation_;
+  std::string cache_key_;
+  std::string file_path_;
 };
 
 class WindowOutputterNotcurses : public WindowOutputter {
@@ -245,7 +397,9 @@ class WindowOutputterNotcurses : public WindowOutputter {
       , is_active_(is_active) {
     fg_channels_.push_back(default_fg_channel);
     bg_channels_.push_back(default_bg_channel);
-    set_channels();
+    if (rb_) {
+      styles_ = ncplane_styles(rb_);
+    }
   }
   ~WindowOutputterNotcurses() {
   }
@@ -260,29 +414,73 @@ class WindowOutputterNotcurses : public WindowOutputter {
       len = strlen(s);
     }
     if (rb_) {
-      char *tmp = strndup(s, len);
-
-      ncplane_putstr_yx(rb_, y + y_offset_, x + x_offset_, tmp);
-
-      free(tmp);
+      apply_pen();
+      ncplane_putnstr_yx(rb_, y + y_offset_, x + x_offset_, len, s);
     }
     return (td::int32)len;
   }
+  void putstr_run(td::int32 y, td::int32 x, td::Slice s, td::int32 width) override {
+    if (y + y_offset_ < base_y_offset_ || y + y_offset_ >= base_y_offset_ + height_ || s.empty()) {
+      return;
+    }
+    if (x + x_offset_ >= base_x_offset_ && x + x_offset_ + width <= base_x_offset_ + width_) {
+      if (rb_) {
+        apply_pen();
+        ncplane_putnstr_yx(rb_, y + y_offset_, x + x_offset_, s.size(), s.data());
+      }
+      return;
+    }
+    // run is clipped, graphemes starting outside of the window must be dropped
+    size_t pos = 0;
+    while (pos < s.size()) {
+      auto g = next_graphem(s, pos);
+      if (g.data.empty()) {
+        break;
+      }
+      putstr_yx(y, x, g.data.data(), g.data.size());
+      x += std::max(g.width, 0);
+      pos += g.data.size();
+    }
+  }
   void cursor_move_yx(td::int32 y, td::int32 x, WindowOutputter::CursorShape cursor_shape) override {
     cursor_y_ = y + y_offset_;
     cursor_x_ = x + x_offset_;
     cursor_shape_ = cursor_shape;
   }
 
+  // the pen is applied to the plane lazily, only when something is written with it
   void set_channels() {
-    auto fg = fg_channels_.back();
-    auto bg = bg_channels_.back();
-    if (is_reversed_) {
-      std::swap(fg, bg);
+    output_stats().pen_requests++;
+    is_channels_dirty_ = true;
+  }
+  void set_style(td::uint16 style, bool value) {
+    output_stats().pen_requests++;
+    if (value) {
+      styles_ = static_cast<td::uint16>(styles_ | style);
+    } else {
+      styles_ = static_cast<td::uint16>(styles_ & ~style);
+    }
+  }
+  void apply_pen() {
+    if (is_channels_dirty_) {
+      auto fg = fg_channels_.back();
+      auto bg = bg_channels_.back();
+      if (is_reversed_) {
+        std::swap(fg, bg);
+      }
+      channels_ = NCCHANNELS_INITIALIZER((fg >> 16) & 0xff, (fg >> 8) & 0xff, (fg) & 0xff, (bg >> 16) & 0xff,
+                                         (bg >> 8) & 0xff, (bg) & 0xff);
+      is_channels_dirty_ = false;
+    }
+    // the plane is shared with outputters of subwindows, so its current pen is compared instead of a remembered one
+    if (ncplane_channels(rb_) != channels_) {
+      ncplane_set_channels(rb_, channels_);
+      output_stats().pen_changes++;
+    }
+    if (ncplane_styles(rb_) != styles_) {
+      ncplane_set_styles(rb_, styles_);
+      output_stats().pen_changes++;
     }
-    auto chan = NCCHANNELS_INITIALIZER((fg >> 16) & 0xff, (fg >> 8) & 0xff, (fg) & 0xff, (bg >> 16) & 0xff,
-                                       (bg >> 8) & 0xff, (bg) & 0xff);
-    ncplane_set_channels(rb_, chan);
   }
 
   void set_channels_transparent() {
@@ -292,7 +490,7 @@ class WindowOutputterNotcurses : public WindowOutputter {
   }
 
   void set_fg_color(Color color) override {
-    fg_channels_.push_back(color_to_rgb[(td::int32)color]);
+    fg_channels_.push_back(color_to_rgb(color));
     set_channels();
   }
   void set_fg_color_rgb(ColorRGB color) override {
@@ -305,7 +503,7 @@ class WindowOutputterNotcurses : public WindowOutputter {
     set_channels();
   }
   void set_bg_color(Color color) override {
-    bg_channels_.push_back(color_to_rgb[(td::int32)color]);
+    bg_channels_.push_back(color_to_rgb(color));
     set_channels();
   }
   void set_bg_color_rgb(ColorRGB color) override {
@@ -318,34 +516,22 @@ class WindowOutputterNotcurses : public WindowOutputter {
     set_channels();
   }
   void set_bold(bool value) override {
-    if (value) {
-      ncplane_on_styles(rb_, NCSTYLE_BOLD);
-    } else {
-      ncplane_off_styles(rb_, NCSTYLE_BOLD);
-    }
+    set_style(NCSTYLE_BOLD, value);
   }
   void unset_bold() override {
-    ncplane_off_styles(rb_, NCSTYLE_BOLD);
+    set_style(NCSTYLE_BOLD, false);
   }
   void set_underline(bool value) override {
-    if (value) {
-      ncplane_on_styles(rb_, NCSTYLE_UNDERLINE);
-    } else {
-      ncplane_off_styles(rb_, NCSTYLE_UNDERLINE);
-    }
+    set_style(NCSTYLE_UNDERLINE, value);
   }
   void unset_underline() override {
-    ncplane_off_styles(rb_, NCSTYLE_UNDERLINE);
+    set_style(NCSTYLE_UNDERLINE, false);
   }
   void set_italic(bool value) override {
-    if (value) {
-      ncplane_on_styles(rb_, NCSTYLE_ITALIC);
-    } else {
-      ncplane_off_styles(rb_, NCSTYLE_ITALIC);
-    }
+    set_style(NCSTYLE_ITALIC, value);
   }
   void unset_italic() override {
-    ncplane_off_styles(rb_, NCSTYLE_ITALIC);
+    set_style(NCSTYLE_ITALIC, false);
   }
   void set_reverse(bool value) override {
     is_reversed_ = value;
@@ -356,14 +542,10 @@ class WindowOutputterNotcurses : public WindowOutputter {
     set_channels();
   }
   void set_strike(bool value) override {
-    if (value) {
-      ncplane_on_styles(rb_, NCSTYLE_STRUCK);
-    } else {
-      ncplane_off_styles(rb_, NCSTYLE_STRUCK);
-    }
+    set_style(NCSTYLE_STRUCK, value);
   }
   void unset_strike() override {
-    ncplane_off_styles(rb_, NCSTYLE_STRUCK);
+    set_style(NCSTYLE_STRUCK, false);
   }
   void set_blink(bool value) override {
   }
@@ -398,13 +580,12 @@ class WindowOutputterNotcurses : public WindowOutputter {
     if (!bw) {
       return std::make_unique<WindowOutputterNotcurses>(
           nc_, rb_, y_offset + y_offset_, x_offset + x_offset_, height, width,
-          color_to_rgb[(td::int32)(is_active ? Color::White : Color::Grey)], color_to_rgb[(td::int32)Color::Black],
-          is_active);
+          color_to_rgb(is_active ? Color::White : Color::Grey), color_to_rgb(Color::Black), is_active);
     } else {
       auto b = static_cast<BackendWindowNotcurses *>(bw);
       return std::make_unique<WindowOutputterNotcurses>(
-          nc_, b->plane(), 0, 0, height, width, color_to_rgb[(td::int32)(is_active ? Color::White : Color::Grey)],
-          color_to_rgb[(td::int32)Color::Black], is_active);
+          nc_, b->plane(), 0, 0, height, width, color_to_rgb(is_active ? Color::White : Color::Grey),
+          color_to_rgb(Color::Black), is_active);
     }
   }
 
@@ -432,196 +613,64 @@ class WindowOutputterNotcurses : public WindowOutputter {
   std::pair<td::int32, td::int32> rendered_image_height(td::int32 max_height, td::int32 max_width,
                                                         td::int32 image_height, td::int32 image_width,
                                                         std::string path) override {
-    struct ncvisual *v = nullptr;
-    SCOPE_EXIT {
-      if (v) {
-        ncvisual_destroy(v);
-      }
-    };
-    struct ncvisual_options opts = {.n = rb_,
-                                    .scaling = NCSCALE_NONE,
-                                    .y = 0,
-                                    .x = 0,
-                                    .begy = 0,
-                                    .begx = 0,
-                                    .leny = 0,
-                                    .lenx = 0,
-                                    .blitter = NCBLIT_PIXEL,
-                                    .flags = NCVISUAL_OPTION_CHILDPLANE,
-                                    .transcolor = 0,
-                                    .pxoffy = 0,
-                                    .pxoffx = 0};
-
-    struct ncvgeom geom;
-
-    CHECK(ncvisual_geom(nc_, v, &opts, &geom) >= 0);
-
-    if (!image_height || !image_width) {
-      if (!geom.pixx || !geom.pixy) {
-        return {0, 0};
-      }
-      image_height = geom.pixy;
-      image_width = geom.pixx;
+    auto size = image_pixel_size(image_height, image_width, path);
+    if (!size.first || !size.second) {
+      return {0, 0};
     }
-
-    max_height *= geom.scaley;
-    max_width *= geom.scalex;
-
-    td::int32 real_height, real_width;
-
-    if (1ll * max_width * image_height > 1ll * max_height * image_width) {
-      real_height = max_height;
-      real_width = (int)(1ll * max_height * image_width / image_height);
-    } else {
-      real_height = (int)(1ll * max_width * image_height / image_width);
-      real_width = max_width;
+    return fit_image_to_cells(max_height, max_width, size.first, size.second, cell_pixel_scale(nc_, rb_));
+  }
+
+  std::unique_ptr<RenderedImage> start_image_decoding(td::int32 max_height, td::int32 max_width,
+                                                      td::int32 image_height, td::int32 image_width, bool allow_pixel,
+                                                      ImageDecodeJob::Source source, std::string path_or_data) {
+    auto scale = cell_pixel_scale(nc_, rb_);
+    // the placeholder takes the same space as the image is given by rendered_image_height in fake renders
+    auto pix_size = image_pixel_size(image_height, image_width,
+                                     source == ImageDecodeJob::Source::File ? path_or_data : std::string());
+    if (!pix_size.first || !pix_size.second) {
+      pix_size = {10, 10};
     }
-
-    return {(real_height + geom.scaley - 1) / geom.scaley, (real_width + geom.scalex - 1) / geom.scalex};
-  }
-
-  std::unique_ptr<RenderedImage> render_image_common(td::int32 max_height, td::int32 max_width, bool allow_pixel,
-                                                     struct ncvisual *v) {
-    auto saved_max_width = max_width;
-    SCOPE_EXIT {
-      if (v) {
-        ncvisual_destroy(v);
-      }
-    };
-    struct ncvisual_options opts = {.n = rb_,
-                                    .scaling = NCSCALE_NONE,
-                                    .y = 0,
-                                    .x = 0,
-                                    .begy = 0,
-                                    .begx = 0,
-                                    .leny = 0,
-                                    .lenx = 0,
-                                    .blitter = NCBLIT_PIXEL,
-                                    .flags = NCVISUAL_OPTION_CHILDPLANE,
-                                    .transcolor = 0,
-                                    .pxoffy = 0,
-                                    .pxoffx = 0};
-
-    struct ncvgeom geom;
-
-    CHECK(ncvisual_geom(nc_, v, &opts, &geom) >= 0);
-
-    if (!geom.pixx || !geom.pixy) {
-      return nullptr;
+    auto size = fit_image_to_cells(max_height, max_width, pix_size.first, pix_size.second, scale);
+    auto max_pix_height = max_height * scale.first;
+    auto max_pix_width = max_width * scale.second;
+    if (source == ImageDecodeJob::Source::File && td::ends_with(path_or_data, ".tgs")) {
+      auto animation = animation_player().get_animation(path_or_data, max_pix_height, max_pix_width);
+      return std::make_unique<RenderedImageNotcurses>(max_width, size.first, size.second, scale, allow_pixel,
+                                                      std::move(animation), std::move(path_or_data));
     }
-
-    max_height *= geom.scaley;
-    max_width *= geom.scalex;
-
-    td::int32 real_height, real_width;
-
-    if (1ll * max_width * geom.pixy > 1ll * max_height * geom.pixx) {
-      real_height = max_height;
-      real_width = (int)(1ll * max_height * geom.pixx / geom.pixy);
-    } else {
-      real_height = (int)(1ll * max_width * geom.pixy / geom.pixx);
-      real_width = max_width;
+    std::string source_key = source == ImageDecodeJob::Source::File
+                                 ? PSTRING() << "file:" << path_or_data
+                                 : PSTRING() << "data:" << td::crc64(path_or_data);
+    auto cache_key = ImageCache::make_key(source_key, max_pix_height, max_pix_width);
+    auto image = image_cache().get(cache_key);
+    if (image) {
+      return std::make_unique<RenderedImageNotcurses>(max_width, scale, allow_pixel, std::move(image));
     }
-
-    ncvisual_resize(v, real_height, real_width);
-
-    /*d::int32 renderd_to_width, td::int32 height, td::int32 width, struct ncplane *plane,
-                         struct ncvisual *visual*/
-    auto img = std::make_unique<RenderedImageNotcurses>(saved_max_width, (real_height + geom.scaley - 1) / geom.scaley,
-                                                        (real_width + geom.scalex - 1) / geom.scalex, real_height,
-                                                        real_width, allow_pixel, nullptr, v);
-    v = nullptr;
-
-    return img;
+    auto file_path = source == ImageDecodeJob::Source::File ? path_or_data : std::string();
+    auto job = std::make_shared<ImageDecodeJob>(source, std::move(path_or_data), max_pix_height, max_pix_width);
+    image_decoder().add_job(job);
+    return std::make_unique<RenderedImageNotcurses>(max_width, size.first, size.second, scale, allow_pixel,
+                                                    std::move(job), std::move(cache_key), std::move(file_path));
   }
 
-  std::unique_ptr<RenderedImage> render_image(td::int32 max_height, td::int32 max_width, bool allow_pixel,
-                                              std::string path) override {
-    if (path.size() >= 4 && td::Slice(path).remove_prefix(path.size() - 4) == ".tgs") {
-      auto f = gzopen(path.c_str(), "rb");
-      if (!f) {
-        LOG(ERROR) << "failed to read tgs";
-        return nullptr;
-      }
-      SCOPE_EXIT {
-        gzclose_r(f);
-      };
-
-      td::UniqueSlice buf(1 << 20);
-      auto r = gzread(f, buf.as_mutable_slice().data(), (unsigned int)buf.size());
-      if (r < 0) {
-        LOG(ERROR) << "failed to uncompress tgs: " << r;
-        return nullptr;
-      }
-      if ((unsigned int)r >= buf.size()) {
-        LOG(ERROR) << "uncompressed sticker is bigger than " << buf.size();
-        return nullptr;
-      }
-
-      auto animation = rlottie::Animation::loadFromData(buf.as_slice().truncate(r).str(), path);
-      if (!animation) {
-        LOG(ERROR) << "failed to parse animation";
-        return nullptr;
-      }
-
-      td::uint32 buffer[512 * 512];
-      rlottie::Surface surface(buffer, 512, 512, 512 * 4);
-      animation->renderSync(0, surface);
-
-      auto v = ncvisual_from_rgba(buffer, 512, 512 * 4, 512);
-      if (!v) {
-        LOG(ERROR) << "failed to create ncvisual";
-        return nullptr;
-      }
-      return render_image_common(max_height, max_width, allow_pixel, v);
-    }
-    auto v = ncvisual_from_file(path.c_str());
-    if (!v) {
-      return nullptr;
-    }
-    return render_image_common(max_height, max_width, allow_pixel, v);
+  std::unique_ptr<RenderedImage> render_image(td::int32 max_height, td::int32 max_width, td::int32 image_height,
+                                              td::int32 image_width, bool allow_pixel, std::string path) override {
+    return start_image_decoding(max_height, max_width, image_height, image_width, allow_pixel,
+                                ImageDecodeJob::Source::File, std::move(path));
   }
 
-  std::unique_ptr<RenderedImage> render_image_data(td::int32 max_height, td::int32 max_width, bool allow_pixel,
+  std::unique_ptr<RenderedImage> render_image_data(td::int32 max_height, td::int32 max_width, td::int32 image_height,
+                                                   td::int32 image_width, bool allow_pixel,
                                                    std::string data) override {
-    struct jpeg_decompress_struct cinfo;
-
-    JSAMPARRAY buffer;
-
-    struct jpeg_error_mgr jerr;
-
-    cinfo.err = jpeg_std_error(&jerr);
-
-    jpeg_create_decompress(&cinfo);
-
-    jpeg_mem_src(&cinfo, (const unsigned char *)data.data(), data.size());
-    jpeg_read_header(&cinfo, TRUE);
-    jpeg_start_decompress(&cinfo);
-
-    buffer =
-        (*cinfo.mem->alloc_sarray)((j_common_ptr)&cinfo, JPOOL_IMAGE, cinfo.output_width * cinfo.output_components, 1);
-    std::vector<unsigned char> r;
-    r.resize(cinfo.output_width * (size_t)cinfo.output_height * 3);
-    size_t pos = 0;
-
-    while (cinfo.output_scanline < cinfo.output_height) {
-      (void)jpeg_read_scanlines(&cinfo, buffer, 1);
-      unsigned char *pixel_row = (unsigned char *)(buffer[0]);
-      // iterate over the pixels:
-      for (unsigned int i = 0; i < 3 * cinfo.output_width; i++) {
-        r[pos++] = *pixel_row++;
-      }
-    }
-
-    auto v = ncvisual_from_rgb_packed((const void *)r.data(), cinfo.output_height, 3 * cinfo.output_width,
-                                      cinfo.output_width, 0xff);
-    if (!v) {
-      return nullptr;
-    }
-    return render_image_common(max_height, max_width, allow_pixel, v);
+    return start_image_decoding(max_height, max_width, image_height, image_width, allow_pixel,
+                                ImageDecodeJob::Source::JpegData, std::move(data));
   }
 
   void draw_rendered_image(td::int32 y, td::int32 x, RenderedImage &image) override {
+    if (static_cast<RenderedImageNotcurses &>(image).is_pending()) {
+      set_has_pending_images();
+      return hide_rendered_image(image);
+    }
     if (y + y_offset_ + image.height() < base_y_offset_ || y + y_offset_ >= base_y_offset_ + height_) {
       return hide_rendered_image(image);
     }
@@ -638,6 +687,13 @@ class WindowOutputterNotcurses : public WindowOutputter {
       ncplane_move_above(plane, rb_);
       static_cast<RenderedImageNotcurses &>(image).move_yx(y + y_offset_ + top_offset, x + x_offset_);
     }
+    if (static_cast<RenderedImageNotcurses &>(image).is_animated()) {
+      // the window must be redrawn, when the animation moves to the next frame
+      set_has_pending_images();
+      if (is_active_) {
+        animation_player().set_drawn(static_cast<RenderedImageNotcurses &>(image).animation());
+      }
+    }
   }
 
   void hide_rendered_image(RenderedImage &image) override {
@@ -663,6 +719,9 @@ class WindowOutputterNotcurses : public WindowOutputter {
   std::vector<td::uint32> fg_channels_;
   std::vector<td::uint32> bg_channels_;
   bool is_reversed_{false};
+  bool is_channels_dirty_{true};
+  td::uint64 channels_{0};
+  td::uint16 styles_{0};
 
   td::int32 cursor_y_{0};
   td::int32 cursor_x_{0};
@@ -767,50 +826,12 @@ class WindowOutputterEmptyNotcurses : public WindowOutputter {
   std::pair<td::int32, td::int32> rendered_image_height(td::int32 max_height, td::int32 max_width,
                                                         td::int32 image_height, td::int32 image_width,
                                                         std::string path) override {
-    struct ncvisual *v = nullptr;
-    SCOPE_EXIT {
-      if (v) {
-        ncvisual_destroy(v);
-      }
-    };
-    struct ncvisual_options opts = {.n = rb_,
-                                    .scaling = NCSCALE_NONE,
-                                    .y = 0,
-                                    .x = 0,
-                                    .begy = 0,
-                                    .begx = 0,
-                                    .leny = 0,
-                                    .lenx = 0,
-                                    .blitter = NCBLIT_PIXEL,
-                                    .flags = NCVISUAL_OPTION_CHILDPLANE,
-                                    .transcolor = 0,
-                                    .pxoffy = 0,
-                                    .pxoffx = 0};
-
-    struct ncvgeom geom;
-
-    CHECK(ncvisual_geom(nc_, v, &opts, &geom) >= 0);
-
-    if (!image_height || !image_width) {
-      /* we do not want to open file here */
-      image_height = 10;
-      image_width = 10;
+    /* we do not want to open file here */
+    auto size = image_pixel_size(image_height, image_width, path);
+    if (!size.first || !size.second) {
+      size = {10, 10};
     }
-
-    max_height *= geom.scaley;
-    max_width *= geom.scalex;
-
-    td::int32 real_height, real_width;
-
-    if (1ll * max_width * image_height > 1ll * max_height * image_width) {
-      real_height = max_height;
-      real_width = (int)(1ll * max_height * image_width / image_height);
-    } else {
-      real_height = (int)(1ll * max_width * image_height / image_width);
-      real_width = max_width;
-    }
-
-    return {(real_height + geom.scaley - 1) / geom.scaley, (real_width + geom.scalex - 1) / geom.scalex};
+    return fit_image_to_cells(max_height, max_width, size.first, size.second, cell_pixel_scale(nc_, rb_));
   }
 
  private:
@@ -903,8 +924,13 @@ struct BackendNotcurses : public Backend {
   struct ncplane *renderplane_{nullptr};
   Screen *screen_{nullptr};
   bool cursor_enabled_{true};
+  struct ncstats *stats_{nullptr};
 
   bool stop() override {
+    if (stats_) {
+      free(stats_);
+      stats_ = nullptr;
+    }
     if (nc_) {
       notcurses_stop(nc_);
       nc_ = nullptr;
@@ -915,6 +941,7 @@ struct BackendNotcurses : public Backend {
   }
 
   void on_resize() override {
+    reset_cell_pixel_scale();
     if (baseplane_) {
       ncplane_resize_maximize(baseplane_);
     }
@@ -946,6 +973,7 @@ struct BackendNotcurses : public Backend {
       }
 
       if (ni.id == NCKEY_RESIZE) {
+        reset_cell_pixel_scale();
         notcurses_refresh(nc_, nullptr, nullptr);
         screen_->on_resize(height(), width());
         continue;
@@ -994,7 +1022,22 @@ struct BackendNotcurses : public Backend {
       cursor_shape = rb->cursor_shape();
     }
 
+    if (!stats_) {
+      stats_ = notcurses_stats_alloc(nc_);
+    }
+    td::uint64 raster_bytes = 0;
+    if (stats_) {
+      notcurses_stats(nc_, stats_);
+      raster_bytes = stats_->raster_bytes;
+    }
+    auto render_start = td::Time::now();
     notcurses_render(nc_);
+    if (stats_) {
+      // rendering blocks while the terminal takes the output
+      notcurses_stats(nc_, stats_);
+      refresh_rate().on_frame_output(static_cast<td::int64>(stats_->raster_bytes - raster_bytes),
+                                     td::Time::now() - render_start);
+    }
 
     if (cursor_shape != WindowOutputter::CursorShape::None && cursor_y >= 0 && cursor_x >= 0) {
       notcurses_cursor_enable(nc_, cursor_y, cursor_x);
@@ -1012,6 +1055,21 @@ struct BackendNotcurses : public Backend {
     return notcurses_inputready_fd(nc_);
   }
 
+  bool collect_decoded_images() override {
+    auto is_decoded = image_decoder().collect_finished_jobs();
+    auto is_advanced = animation_player().tick();
+    return is_decoded || is_advanced;
+  }
+
+  td::Timestamp wakeup_at() override {
+    auto res = animation_player().wakeup_at();
+    // decoded images are polled for, because workers can't wake up the main loop
+    if (image_decoder().has_pending_jobs()) {
+      res.relax(td::Timestamp::in(0.02));
+    }
+    return res;
+  }
+
   void create_backend_window(std::shared_ptr<Window> window) override {
     struct ncplane_options plane_opts = {.y = 0,
                                          .x = 0,
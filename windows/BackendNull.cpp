@@ -0,0 +1,185 @@
+#include "BackendNull.h"
+#include "CellGrid.hpp"
+#include "Window.hpp"
+#include "Output.hpp"
+
+#include "td/utils/logging.h"
+
+#include <cstring>
+#include <memory>
+#include <unistd.h>
+
+namespace windows {
+
+class WindowOutputterNull : public WindowOutputter {
+ public:
+  td::int32 putstr_yx(td::int32 y, td::int32 x, const char *s, size_t len) override {
+    if (!len) {
+      len = strlen(s);
+    }
+    return (td::int32)len;
+  }
+  void cursor_move_yx(td::int32 y, td::int32 x, WindowOutputter::CursorShape cursor_shape) override {
+    cursor_y_ = y;
+    cursor_x_ = x;
+    cursor_shape_ = cursor_shape;
+  }
+  void set_fg_color(Color color) override {
+  }
+  void set_fg_color_rgb(ColorRGB color) override {
+  }
+  void unset_fg_color() override {
+  }
+  void set_bg_color(Color color) override {
+  }
+  void set_bg_color_rgb(ColorRGB color) override {
+  }
+  void unset_bg_color() override {
+  }
+  void set_bold(bool value) override {
+  }
+  void unset_bold() override {
+  }
+  void set_underline(bool value) override {
+  }
+  void unset_underline() override {
+  }
+  void set_italic(bool value) override {
+  }
+  void unset_italic() override {
+  }
+  void set_reverse(bool value) override {
+  }
+  void unset_reverse() override {
+  }
+  void set_strike(bool value) override {
+  }
+  void unset_strike() override {
+  }
+  void set_blink(bool value) override {
+  }
+  void unset_blink() override {
+  }
+  bool is_real() const override {
+    return false;
+  }
+  td::int32 local_cursor_y() const override {
+    return cursor_y_;
+  }
+  td::int32 local_cursor_x() const override {
+    return cursor_x_;
+  }
+  td::int32 global_cursor_y() const override {
+    return cursor_y_;
+  }
+  td::int32 global_cursor_x() const override {
+    return cursor_x_;
+  }
+  CursorShape cursor_shape() const override {
+    return cursor_shape_;
+  }
+  void translate(td::int32 delta_y, td::int32 delta_x) override {
+  }
+
+  std::unique_ptr<WindowOutputter> create_subwindow_outputter(BackendWindow *bw, td::int32 y_offset, td::int32 x_offset,
+                                                              td::int32 height, td::int32 width,
+                                                              bool is_active) override {
+    return std::make_unique<WindowOutputterNull>();
+  }
+  void update_cursor_position_from(WindowOutputter &from, BackendWindow *bw, td::int32 y_offset,
+                                   td::int32 x_offset) override {
+    cursor_y_ = from.global_cursor_y();
+    cursor_x_ = from.global_cursor_x();
+    cursor_shape_ = from.cursor_shape();
+  }
+  bool is_active() const override {
+    return false;
+  }
+
+ private:
+  td::int32 cursor_y_{0};
+  td::int32 cursor_x_{0};
+  CursorShape cursor_shape_{CursorShape::None};
+};
+
+struct BackendNull : public Backend {
+  td::int32 height_{0};
+  td::int32 width_{0};
+  // nobody ever writes to this pipe, its read end only serves as a never ready input fd and is owned by the caller
+  // of poll_fd()
+  int pipe_fds_[2]{-1, -1};
+  bool stopped_{false};
+  // if set, windows are really rendered into the grid instead of the outputter discarding everything
+  std::unique_ptr<CellGrid> grid_;
+
+  ~BackendNull() {
+    if (pipe_fds_[1] >= 0) {
+      ::close(pipe_fds_[1]);
+    }
+  }
+
+  bool stop() override {
+    if (stopped_) {
+      return false;
+    }
+    stopped_ = true;
+    return true;
+  }
+
+  void on_resize() override {
+  }
+
+  td::int32 height() override {
+    return height_;
+  }
+
+  td::int32 width() override {
+    return width_;
+  }
+
+  void tick() override {
+  }
+
+  void refresh(bool force, std::shared_ptr<Window> base_window) override {
+    if (!force && (!base_window->need_refresh() || !base_window->need_refresh_at().is_in_past())) {
+      return;
+    }
+    if (grid_) {
+      WindowOutputterGrid rb(grid_.get(), 0, 0, height_, width_, 0xdddddd, 0x000000, true);
+      base_window->render_wrap(rb, force);
+      grid_->set_cursor(rb.global_cursor_y(), rb.global_cursor_x(), rb.cursor_shape());
+      return;
+    }
+    WindowOutputterNull rb;
+    base_window->render_wrap(rb, force);
+  }
+
+  td::int32 poll_fd() override {
+    return pipe_fds_[0];
+  }
+
+  std::string snapshot() override {
+    return grid_ ? grid_->to_string() : std::string();
+  }
+};
+
+void init_null_backend(Screen *screen, td::int32 height, td::int32 width) {
+  auto backend = std::make_unique<BackendNull>();
+  backend->height_ = height;
+  backend->width_ = width;
+  CHECK(::pipe(backend->pipe_fds_) == 0);
+  set_empty_window_outputter(std::make_unique<WindowOutputterNull>());
+  screen->set_backend(std::move(backend));
+}
+
+void init_grid_backend(Screen *screen, td::int32 height, td::int32 width) {
+  auto backend = std::make_unique<BackendNull>();
+  backend->height_ = height;
+  backend->width_ = width;
+  backend->grid_ = std::make_unique<CellGrid>(height, width);
+  CHECK(::pipe(backend->pipe_fds_) == 0);
+  set_empty_window_outputter(std::make_unique<WindowOutputterNull>());
+  screen->set_backend(std::move(backend));
+}
+
+}  // namespace windows
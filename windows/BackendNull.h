@@ -0,0 +1,12 @@
+#pragma once
+
+#include "Screen.hpp"
+
+namespace windows {
+
+// backend without a terminal: windows are laid out and rendered into an outputter that discards everything
+void init_null_backend(Screen *screen, td::int32 height, td::int32 width);
+// backend without a terminal, which renders windows into an in-memory cell grid; Screen::snapshot() returns its text
+void init_grid_backend(Screen *screen, td::int32 height, td::int32 width);
+
+}  // namespace windows
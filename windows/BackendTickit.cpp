@@ -69,11 +69,23 @@ class WindowOutputterTickit : public WindowOutputter {
       len = strlen(s);
     }
     if (rb_) {
-      tickit_renderbuffer_setpen(rb_, pen_);
+      apply_pen();
       tickit_renderbuffer_textn_at(rb_, y + y_offset_, x + x_offset_, s, len);
     }
     return (td::int32)len;
   }
+  // the pen is set to the render buffer lazily, only when something is written with it
+  void pen_changed() {
+    output_stats().pen_requests++;
+    is_pen_dirty_ = true;
+  }
+  void apply_pen() {
+    if (rb_ && is_pen_dirty_) {
+      tickit_renderbuffer_setpen(rb_, pen_);
+      output_stats().pen_changes++;
+      is_pen_dirty_ = false;
+    }
+  }
   void cursor_move_yx(td::int32 y, td::int32 x, WindowOutputter::CursorShape cursor_shape) override {
     cursor_y_ = y + y_offset_;
     cursor_x_ = x + x_offset_;
@@ -81,93 +93,111 @@ class WindowOutputterTickit : public WindowOutputter {
   }
   void set_fg_color(Color color) override {
     if (pen_) {
+      pen_changed();
       tickit_pen_set_colour_attr(pen_, TickitPenAttr::TICKIT_PEN_FG, color_to_tickit(color));
     }
   }
   void set_fg_color_rgb(ColorRGB color) override {
     if (pen_) {
+      pen_changed();
       tickit_pen_set_colour_attr(pen_, TickitPenAttr::TICKIT_PEN_FG, color_to_tickit(Color::White));
     }
   }
   void unset_fg_color() override {
     if (pen_) {
+      pen_changed();
       tickit_pen_clear_attr(pen_, TickitPenAttr::TICKIT_PEN_FG);
       //tickit_pen_set_colour_attr(pen_, TickitPenAttr::TICKIT_PEN_FG, color_to_tickit(Color::White));
     }
   }
   void set_bg_color(Color color) override {
     if (pen_) {
+      pen_changed();
       tickit_pen_set_colour_attr(pen_, TickitPenAttr::TICKIT_PEN_BG, color_to_tickit(color));
     }
   }
   void set_bg_color_rgb(ColorRGB color) override {
     if (pen_) {
+      pen_changed();
       tickit_pen_set_colour_attr(pen_, TickitPenAttr::TICKIT_PEN_BG, color_to_tickit(Color::Black));
     }
   }
   void unset_bg_color() override {
     if (pen_) {
+      pen_changed();
       tickit_pen_clear_attr(pen_, TickitPenAttr::TICKIT_PEN_BG);
       //tickit_pen_set_colour_attr(pen_, TickitPenAttr::TICKIT_PEN_BG, color_to_tickit(Color::Black));
     }
   }
   void set_bold(bool value) override {
     if (pen_) {
+      pen_changed();
       tickit_pen_set_bool_attr(pen_, TickitPenAttr::TICKIT_PEN_BOLD, value ? 1 : 0);
     }
   }
   void unset_bold() override {
     if (pen_) {
+      pen_changed();
       tickit_pen_clear_attr(pen_, TickitPenAttr::TICKIT_PEN_BOLD);
     }
   }
   void set_underline(bool value) override {
     if (pen_) {
+      pen_changed();
       tickit_pen_set_bool_attr(pen_, TickitPenAttr::TICKIT_PEN_UNDER, value ? 1 : 0);
     }
   }
   void unset_underline() override {
     if (pen_) {
+      pen_changed();
       tickit_pen_clear_attr(pen_, TickitPenAttr::TICKIT_PEN_UNDER);
     }
   }
   void set_italic(bool value) override {
     if (pen_) {
+      pen_changed();
       tickit_pen_set_bool_attr(pen_, TickitPenAttr::TICKIT_PEN_ITALIC, value ? 1 : 0);
     }
   }
   void unset_italic() override {
     if (pen_) {
+      pen_changed();
       tickit_pen_clear_attr(pen_, TickitPenAttr::TICKIT_PEN_ITALIC);
     }
   }
   void set_reverse(bool value) override {
     if (pen_) {
+      pen_changed();
       tickit_pen_set_bool_attr(pen_, TickitPenAttr::TICKIT_PEN_REVERSE, value ? 1 : 0);
     }
   }
   void unset_reverse() override {
     if (pen_) {
+      pen_changed();
       tickit_pen_clear_attr(pen_, TickitPenAttr::TICKIT_PEN_REVERSE);
     }
   }
   void set_strike(bool value) override {
     if (pen_) {
+      pen_changed();
       tickit_pen_set_bool_attr(pen_, TickitPenAttr::TICKIT_PEN_STRIKE, value ? 1 : 0);
     }
   }
   void unset_strike() override {
     if (pen_) {
+      pen_changed();
       tickit_pen_clear_attr(pen_, TickitPenAttr::TICKIT_PEN_STRIKE);
     }
   }
   void set_blink(bool value) override {
     if (pen_) {
+      pen_changed();
       tickit_pen_set_bool_attr(pen_, TickitPenAttr::TICKIT_PEN_BLINK, value ? 1 : 0);
     }
   }
   void unset_blink() override {
     if (pen_) {
+      pen_changed();
       tickit_pen_clear_attr(pen_, TickitPenAttr::TICKIT_PEN_BLINK);
     }
   }
@@ -197,7 +227,7 @@ class WindowOutputterTickit : public WindowOutputter {
   std::unique_ptr<WindowOutputter> create_subwindow_outputter(BackendWindow *bw, td::int32 y_offset, td::int32 x_offset,
                                                               td::int32 height, td::int32 width,
                                                               bool is_active) override {
-    tickit_renderbuffer_setpen(rb_, pen_);
+    apply_pen();
     return std::make_unique<WindowOutputterTickit>(rb_, y_offset + y_offset_, x_offset + x_offset_, height, width,
                                                    is_active);
   }
@@ -215,6 +245,7 @@ class WindowOutputterTickit : public WindowOutputter {
 
  private:
   TickitRenderBuffer *rb_{nullptr};
+  bool is_pen_dirty_{true};
   int y_offset_;
   int x_offset_;
   int height_;
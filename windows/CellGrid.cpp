@@ -0,0 +1,119 @@
+#include "CellGrid.hpp"
+#include "unicode.h"
+
+#include "td/utils/logging.h"
+#include "td/utils/SliceBuilder.h"
+
+#include <algorithm>
+#include <cstring>
+
+namespace windows {
+
+CellGrid::CellGrid(td::int32 height, td::int32 width) : height_(0), width_(0) {
+  resize(height, width);
+}
+
+void CellGrid::resize(td::int32 height, td::int32 width) {
+  height_ = std::max(height, 0);
+  width_ = std::max(width, 0);
+  cells_.assign(static_cast<size_t>(height_) * width_, Cell());
+}
+
+std::string CellGrid::to_string() const {
+  std::string res;
+  for (td::int32 y = 0; y < height_; y++) {
+    auto line_begin = res.size();
+    for (td::int32 x = 0; x < width_; x++) {
+      res += cell(y, x).text;
+    }
+    while (res.size() > line_begin && res.back() == ' ') {
+      res.pop_back();
+    }
+    res += '\n';
+  }
+  res += PSTRING() << "cursor " << cursor_y_ << " " << cursor_x_ << " " << static_cast<td::int32>(cursor_shape_)
+                   << "\n";
+  return res;
+}
+
+WindowOutputterGrid::WindowOutputterGrid(CellGrid *grid, td::int32 y_offset, td::int32 x_offset, td::int32 height,
+                                         td::int32 width, td::uint32 default_fg, td::uint32 default_bg,
+                                         bool is_active)
+    : grid_(grid)
+    , base_y_offset_(y_offset)
+    , base_x_offset_(x_offset)
+    , y_offset_(y_offset)
+    , x_offset_(x_offset)
+    , height_(height)
+    , width_(width)
+    , is_active_(is_active) {
+  fg_colors_.push_back(default_fg);
+  bg_colors_.push_back(default_bg);
+}
+
+td::int32 WindowOutputterGrid::putstr_yx(td::int32 y, td::int32 x, const char *s, size_t len) {
+  if (!len) {
+    len = strlen(s);
+  }
+  y += y_offset_;
+  if (y < base_y_offset_ || y >= base_y_offset_ + height_ || y < 0 || y >= grid_->height()) {
+    return (td::int32)len;
+  }
+  x += x_offset_;
+  auto fg = fg_colors_.back();
+  auto bg = bg_colors_.back();
+  td::Slice data(s, len);
+  size_t pos = 0;
+  while (pos < data.size()) {
+    auto g = next_graphem(data, pos);
+    if (g.data.empty()) {
+      break;
+    }
+    pos += g.data.size();
+    if (g.width <= 0) {
+      continue;
+    }
+    // graphemes, which don't fit into the window completely, are dropped as by notcurses
+    if (x >= base_x_offset_ && x + g.width <= base_x_offset_ + width_ && x >= 0 && x + g.width <= grid_->width()) {
+      for (td::int32 i = 0; i < g.width; i++) {
+        auto &cell = grid_->cell(y, x + i);
+        cell.text = i == 0 ? g.data.str() : std::string();
+        cell.fg = fg;
+        cell.bg = bg;
+        cell.styles = styles_;
+      }
+    }
+    x += g.width;
+  }
+  return (td::int32)len;
+}
+
+void WindowOutputterGrid::set_fg_color(Color color) {
+  fg_colors_.push_back(color_to_rgb(color));
+}
+
+void WindowOutputterGrid::unset_fg_color() {
+  CHECK(fg_colors_.size() > 1);
+  fg_colors_.pop_back();
+}
+
+void WindowOutputterGrid::set_bg_color(Color color) {
+  bg_colors_.push_back(color_to_rgb(color));
+}
+
+void WindowOutputterGrid::unset_bg_color() {
+  CHECK(bg_colors_.size() > 1);
+  bg_colors_.pop_back();
+}
+
+std::unique_ptr<WindowOutputter> WindowOutputterGrid::create_subwindow_outputter(BackendWindow *bw,
+                                                                                 td::int32 y_offset,
+                                                                                 td::int32 x_offset, td::int32 height,
+                                                                                 td::int32 width, bool is_active) {
+  // there are no backend windows, so all windows are drawn into the same grid
+  return std::make_unique<WindowOutputterGrid>(grid_, y_offset + y_offset_, x_offset + x_offset_, height, width,
+                                               color_to_rgb(is_active ? Color::White : Color::Grey),
+                                               color_to_rgb(Color::Black), is_active);
+}
+
+}  // namespace windows
@@ -0,0 +1,186 @@
+#pragma once
+
+#include "Output.hpp"
+
+#include "td/utils/common.h"
+#include "td/utils/Slice.h"
+
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace windows {
+
+// screen contents in memory: what a terminal would show after the render. Used to render the window tree without
+// a terminal, e.g. to measure the render cost or to compare layouts
+class CellGrid {
+ public:
+  enum Style : td::uint16 { Bold = 1, Underline = 2, Italic = 4, Reverse = 8, Strike = 16, Blink = 32 };
+
+  struct Cell {
+    // grapheme in the cell; empty for the second cell of a wide grapheme
+    std::string text{" "};
+    td::uint32 fg{0xdddddd};
+    td::uint32 bg{0x000000};
+    td::uint16 styles{0};
+  };
+
+  CellGrid(td::int32 height, td::int32 width);
+
+  td::int32 height() const {
+    return height_;
+  }
+  td::int32 width() const {
+    return width_;
+  }
+  void resize(td::int32 height, td::int32 width);
+
+  const Cell &cell(td::int32 y, td::int32 x) const {
+    return cells_[static_cast<size_t>(y) * width_ + x];
+  }
+  Cell &cell(td::int32 y, td::int32 x) {
+    return cells_[static_cast<size_t>(y) * width_ + x];
+  }
+
+  void set_cursor(td::int32 y, td::int32 x, WindowOutputter::CursorShape shape) {
+    cursor_y_ = y;
+    cursor_x_ = x;
+    cursor_shape_ = shape;
+  }
+
+  // text of all lines without trailing spaces, followed by the cursor position
+  std::string to_string() const;
+
+ private:
+  td::int32 height_;
+  td::int32 width_;
+  std::vector<Cell> cells_;
+  td::int32 cursor_y_{-1};
+  td::int32 cursor_x_{-1};
+  WindowOutputter::CursorShape cursor_shape_{WindowOutputter::CursorShape::None};
+};
+
+// outputter writing into a cell grid. Follows WindowOutputterNotcurses: the same clipping, translation and color
+// stacks, so that windows are rendered the same way as on a terminal
+class WindowOutputterGrid : public WindowOutputter {
+ public:
+  WindowOutputterGrid(CellGrid *grid, td::int32 y_offset, td::int32 x_offset, td::int32 height, td::int32 width,
+                      td::uint32 default_fg, td::uint32 default_bg, bool is_active);
+
+  td::int32 putstr_yx(td::int32 y, td::int32 x, const char *s, size_t len) override;
+  void cursor_move_yx(td::int32 y, td::int32 x, WindowOutputter::CursorShape cursor_shape) override {
+    cursor_y_ = y + y_offset_;
+    cursor_x_ = x + x_offset_;
+    cursor_shape_ = cursor_shape;
+  }
+
+  void set_fg_color(Color color) override;
+  void set_fg_color_rgb(ColorRGB color) override {
+    fg_colors_.push_back(color.color);
+  }
+  void unset_fg_color() override;
+  void set_bg_color(Color color) override;
+  void set_bg_color_rgb(ColorRGB color) override {
+    bg_colors_.push_back(color.color);
+  }
+  void unset_bg_color() override;
+  void set_bold(bool value) override {
+    set_style(CellGrid::Bold, value);
+  }
+  void unset_bold() override {
+    set_style(CellGrid::Bold, false);
+  }
+  void set_underline(bool value) override {
+    set_style(CellGrid::Underline, value);
+  }
+  void unset_underline() override {
+    set_style(CellGrid::Underline, false);
+  }
+  void set_italic(bool value) override {
+    set_style(CellGrid::Italic, value);
+  }
+  void unset_italic() override {
+    set_style(CellGrid::Italic, false);
+  }
+  void set_reverse(bool value) override {
+    set_style(CellGrid::Reverse, value);
+  }
+  void unset_reverse() override {
+    set_style(CellGrid::Reverse, false);
+  }
+  void set_strike(bool value) override {
+    set_style(CellGrid::Strike, value);
+  }
+  void unset_strike() override {
+    set_style(CellGrid::Strike, false);
+  }
+  void set_blink(bool value) override {
+    set_style(CellGrid::Blink, value);
+  }
+  void unset_blink() override {
+    set_style(CellGrid::Blink, false);
+  }
+  bool is_real() const override {
+    return true;
+  }
+  td::int32 local_cursor_y() const override {
+    return cursor_y_ - base_y_offset_;
+  }
+  td::int32 local_cursor_x() const override {
+    return cursor_x_ - base_x_offset_;
+  }
+  td::int32 global_cursor_y() const override {
+    return cursor_y_;
+  }
+  td::int32 global_cursor_x() const override {
+    return cursor_x_;
+  }
+  CursorShape cursor_shape() const override {
+    return cursor_shape_;
+  }
+  void translate(td::int32 delta_y, td::int32 delta_x) override {
+    y_offset_ += delta_y;
+    x_offset_ += delta_x;
+  }
+
+  std::unique_ptr<WindowOutputter> create_subwindow_outputter(BackendWindow *bw, td::int32 y_offset, td::int32 x_offset,
+                                                              td::int32 height, td::int32 width,
+                                                              bool is_active) override;
+  void update_cursor_position_from(WindowOutputter &from, BackendWindow *bw, td::int32 y_offset,
+                                   td::int32 x_offset) override {
+    cursor_y_ = from.global_cursor_y();
+    cursor_x_ = from.global_cursor_x();
+    cursor_shape_ = from.cursor_shape();
+  }
+  bool is_active() const override {
+    return is_active_;
+  }
+
+ private:
+  void set_style(td::uint16 style, bool value) {
+    if (value) {
+      styles_ = static_cast<td::uint16>(styles_ | style);
+    } else {
+      styles_ = static_cast<td::uint16>(styles_ & ~style);
+    }
+  }
+
+  CellGrid *grid_;
+  td::int32 base_y_offset_;
+  td::int32 base_x_offset_;
+  td::int32 y_offset_;
+  td::int32 x_offset_;
+  td::int32 height_;
+  td::int32 width_;
+  bool is_active_;
+
+  std::vector<td::uint32> fg_colors_;
+  std::vector<td::uint32> bg_colors_;
+  td::uint16 styles_{0};
+
+  td::int32 cursor_y_{0};
+  td::int32 cursor_x_{0};
+  CursorShape cursor_shape_{CursorShape::None};
+};
+
+}  // namespace windows
@@ -0,0 +1,76 @@
+#include "ImageCache.hpp"
+
+#include "td/utils/logging.h"
+#include "td/utils/SliceBuilder.h"
+
+namespace windows {
+
+std::string ImageCache::make_key(td::Slice source, td::int32 max_pix_height, td::int32 max_pix_width) {
+  return PSTRING() << max_pix_height << "x" << max_pix_width << ":" << source;
+}
+
+std::shared_ptr<DecodedImage> ImageCache::get(const std::string &key) {
+  auto it = entries_.find(key);
+  if (it == entries_.end()) {
+    stats_.misses++;
+    return nullptr;
+  }
+  stats_.hits++;
+  lru_.splice(lru_.begin(), lru_, it->second);
+  return it->second->second;
+}
+
+void ImageCache::put(const std::string &key, std::shared_ptr<DecodedImage> image) {
+  CHECK(image);
+  auto size = image->size_in_bytes();
+  auto it = entries_.find(key);
+  if (it != entries_.end()) {
+    stats_.size -= it->second->second->size_in_bytes();
+    it->second->second = std::move(image);
+    lru_.splice(lru_.begin(), lru_, it->second);
+  } else {
+    lru_.emplace_front(key, std::move(image));
+    entries_.emplace(key, lru_.begin());
+  }
+  stats_.size += size;
+  evict();
+}
+
+void ImageCache::set_file_image_size(const std::string &path, td::int32 height, td::int32 width) {
+  // sizes are tiny, so they are just forgotten all at once in the unlikely case of too many different files
+  if (file_image_sizes_.size() >= (1 << 16)) {
+    file_image_sizes_.clear();
+  }
+  file_image_sizes_[path] = {height, width};
+}
+
+std::pair<td::int32, td::int32> ImageCache::file_image_size(const std::string &path) const {
+  auto it = file_image_sizes_.find(path);
+  if (it == file_image_sizes_.end()) {
+    return {0, 0};
+  }
+  return it->second;
+}
+
+void ImageCache::set_max_size(size_t max_size) {
+  stats_.max_size = max_size;
+  evict();
+}
+
+void ImageCache::evict() {
+  while (stats_.size > stats_.max_size && !lru_.empty()) {
+    auto &entry = lru_.back();
+    stats_.size -= entry.second->size_in_bytes();
+    stats_.evictions++;
+    entries_.erase(entry.first);
+    lru_.pop_back();
+  }
+  stats_.entries = entries_.size();
+}
+
+ImageCache &image_cache() {
+  static ImageCache instance;
+  return instance;
+}
+
+}  // namespace windows
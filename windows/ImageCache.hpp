@@ -0,0 +1,60 @@
+#pragma once
+
+#include "ImageDecoder.hpp"
+
+#include "td/utils/common.h"
+#include "td/utils/Slice.h"
+
+#include <list>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <utility>
+
+namespace windows {
+
+// LRU of decoded images shared by all windows, so that images are not decoded again after a window is reopened or
+// resized back. Images are kept while their total size fits into the budget; images evicted from the cache live
+// as long as they are drawn somewhere. Used only from the main thread
+class ImageCache {
+ public:
+  struct Stats {
+    td::int64 hits{0};
+    td::int64 misses{0};
+    td::int64 evictions{0};
+    size_t entries{0};
+    size_t size{0};
+    size_t max_size{0};
+  };
+
+  // key of an image from a file or from data with the given crc, scaled to fit into the given number of pixels.
+  // The blitter is chosen only when the image is drawn, so it isn't a part of the key
+  static std::string make_key(td::Slice source, td::int32 max_pix_height, td::int32 max_pix_width);
+
+  std::shared_ptr<DecodedImage> get(const std::string &key);
+  void put(const std::string &key, std::shared_ptr<DecodedImage> image);
+
+  // size in pixels of the image from the file, remembered after the image is decoded. Used to reserve space for images
+  // with unknown size without opening the file; returns {0, 0}, if the size is unknown
+  void set_file_image_size(const std::string &path, td::int32 height, td::int32 width);
+  std::pair<td::int32, td::int32> file_image_size(const std::string &path) const;
+
+  void set_max_size(size_t max_size);
+  const Stats &stats() const {
+    return stats_;
+  }
+
+ private:
+  void evict();
+
+  using Entry = std::pair<std::string, std::shared_ptr<DecodedImage>>;
+  // most recently used first
+  std::list<Entry> lru_;
+  std::unordered_map<std::string, std::list<Entry>::iterator> entries_;
+  std::unordered_map<std::string, std::pair<td::int32, td::int32>> file_image_sizes_;
+  Stats stats_{0, 0, 0, 0, 0, 64 << 20};
+};
+
+ImageCache &image_cache();
+
+}  // namespace windows
@@ -0,0 +1,166 @@
+#include "ImageDecoder.hpp"
+
+#include "td/utils/logging.h"
+#include "td/utils/ScopeGuard.h"
+
+#include <algorithm>
+#include <cstring>
+#include <notcurses/notcurses.h>
+#include <jpeglib.h>
+
+namespace windows {
+
+namespace {
+
+// decodes the image with DCT scaling to the smallest size, which is still not less than the drawn size
+struct ncvisual *decode_jpeg_data(const std::string &data, td::int32 max_pix_height, td::int32 max_pix_width) {
+  struct jpeg_decompress_struct cinfo;
+
+  struct jpeg_error_mgr jerr;
+
+  cinfo.err = jpeg_std_error(&jerr);
+
+  jpeg_create_decompress(&cinfo);
+  SCOPE_EXIT {
+    jpeg_destroy_decompress(&cinfo);
+  };
+
+  jpeg_mem_src(&cinfo, (const unsigned char *)data.data(), data.size());
+  jpeg_read_header(&cinfo, TRUE);
+  cinfo.out_color_space = JCS_RGB;
+  if (cinfo.image_height > 0 && cinfo.image_width > 0 && max_pix_height > 0 && max_pix_width > 0) {
+    auto size = fit_image_to_box(max_pix_height, max_pix_width, (td::int32)cinfo.image_height,
+                                 (td::int32)cinfo.image_width);
+    cinfo.scale_num = 8;
+    cinfo.scale_denom = 8;
+    for (unsigned int scale_num = 1; scale_num < 8; scale_num++) {
+      if ((cinfo.image_height * scale_num + 7) / 8 >= (unsigned int)size.first &&
+          (cinfo.image_width * scale_num + 7) / 8 >= (unsigned int)size.second) {
+        cinfo.scale_num = scale_num;
+        break;
+      }
+    }
+  }
+  jpeg_start_decompress(&cinfo);
+
+  size_t row_size = 3 * (size_t)cinfo.output_width;
+  std::vector<unsigned char> r(row_size * cinfo.output_height);
+  while (cinfo.output_scanline < cinfo.output_height) {
+    JSAMPROW row = r.data() + row_size * cinfo.output_scanline;
+    (void)jpeg_read_scanlines(&cinfo, &row, 1);
+  }
+  jpeg_finish_decompress(&cinfo);
+
+  return ncvisual_from_rgb_packed((const void *)r.data(), cinfo.output_height, (int)row_size, cinfo.output_width,
+                                  0xff);
+}
+
+}  // namespace
+
+std::pair<td::int32, td::int32> fit_image_to_box(td::int32 max_height, td::int32 max_width, td::int32 image_height,
+                                                 td::int32 image_width) {
+  td::int32 real_height, real_width;
+  if (1ll * max_width * image_height > 1ll * max_height * image_width) {
+    real_height = max_height;
+    real_width = (int)(1ll * max_height * image_width / image_height);
+  } else {
+    real_height = (int)(1ll * max_width * image_height / image_width);
+    real_width = max_width;
+  }
+  return {std::max(real_height, 1), std::max(real_width, 1)};
+}
+
+ImageDecodeJob::ImageDecodeJob(Source source, std::string path_or_data, td::int32 max_pix_height,
+                               td::int32 max_pix_width)
+    : source_(source)
+    , path_or_data_(std::move(path_or_data))
+    , max_pix_height_(max_pix_height)
+    , max_pix_width_(max_pix_width) {
+}
+
+DecodedImage::~DecodedImage() {
+  if (visual) {
+    ncvisual_destroy(visual);
+  }
+}
+
+void ImageDecodeJob::do_run() {
+  SCOPE_EXIT {
+    path_or_data_.clear();
+  };
+  auto v = source_ == Source::File ? ncvisual_from_file(path_or_data_.c_str())
+                                   : decode_jpeg_data(path_or_data_, max_pix_height_, max_pix_width_);
+  if (!v) {
+    return;
+  }
+
+  // without notcurses only the pixel size of the visual is returned
+  struct ncvgeom geom;
+  memset(&geom, 0, sizeof(geom));
+  if (ncvisual_geom(nullptr, v, nullptr, &geom) < 0 || !geom.pixx || !geom.pixy || max_pix_height_ <= 0 ||
+      max_pix_width_ <= 0) {
+    ncvisual_destroy(v);
+    return;
+  }
+  source_pix_height_ = (td::int32)geom.pixy;
+  source_pix_width_ = (td::int32)geom.pixx;
+
+  auto size = fit_image_to_box(max_pix_height_, max_pix_width_, source_pix_height_, source_pix_width_);
+  ncvisual_resize(v, size.first, size.second);
+
+  image_ = std::make_shared<DecodedImage>(v, size.first, size.second);
+}
+
+ImageDecoder::ImageDecoder(size_t threads_count) {
+  for (size_t i = 0; i < threads_count; i++) {
+    threads_.emplace_back([this] { run_worker(); });
+  }
+}
+
+ImageDecoder::~ImageDecoder() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    is_closed_ = true;
+    jobs_.clear();
+  }
+  cv_.notify_all();
+  for (auto &t : threads_) {
+    t.join();
+  }
+}
+
+void ImageDecoder::add_job(std::shared_ptr<DecoderJob> job) {
+  pending_jobs_++;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    jobs_.push_back(std::move(job));
+  }
+  cv_.notify_one();
+}
+
+void ImageDecoder::run_worker() {
+  while (true) {
+    std::shared_ptr<DecoderJob> job;
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      cv_.wait(lock, [&] { return is_closed_ || !jobs_.empty(); });
+      if (is_closed_) {
+        return;
+      }
+      job = std::move(jobs_.back());
+      jobs_.pop_back();
+    }
+    if (!job->is_cancelled()) {
+      job->run();
+      finished_jobs_++;
+    }
+    pending_jobs_--;
+  }
+}
+
+ImageDecoder &image_decoder() {
+  static ImageDecoder instance(std::max(1u, std::min(4u, std::thread::hardware_concurrency() / 2)));
+  return instance;
+}
+
+}  // namespace windows
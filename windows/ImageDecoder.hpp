@@ -0,0 +1,139 @@
+#pragma once
+
+#include "td/utils/common.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+struct ncvisual;
+
+namespace windows {
+
+// decoded image, scaled to the size it is drawn with. Visual is never changed after decoding, so it can be shared
+struct DecodedImage {
+  DecodedImage(struct ncvisual *visual, td::int32 pix_height, td::int32 pix_width)
+      : visual(visual), pix_height(pix_height), pix_width(pix_width) {
+  }
+  DecodedImage(const DecodedImage &) = delete;
+  DecodedImage &operator=(const DecodedImage &) = delete;
+  ~DecodedImage();
+
+  size_t size_in_bytes() const {
+    return 4 * static_cast<size_t>(pix_height) * static_cast<size_t>(pix_width);
+  }
+
+  struct ncvisual *visual;
+  td::int32 pix_height;
+  td::int32 pix_width;
+};
+
+// size of an image_height x image_width image, scaled to fit into max_height x max_width
+std::pair<td::int32, td::int32> fit_image_to_box(td::int32 max_height, td::int32 max_width, td::int32 image_height,
+                                                 td::int32 image_width);
+
+// work for the decoder threads. Results of the job can be used by the main thread only after is_ready() returns true
+class DecoderJob {
+ public:
+  DecoderJob() = default;
+  DecoderJob(const DecoderJob &) = delete;
+  DecoderJob &operator=(const DecoderJob &) = delete;
+  virtual ~DecoderJob() = default;
+
+  // called by a worker thread
+  void run() {
+    do_run();
+    is_ready_.store(true, std::memory_order_release);
+  }
+
+  bool is_ready() const {
+    return is_ready_.load(std::memory_order_acquire);
+  }
+  // the result is no longer needed, the job is skipped if it isn't started yet
+  void cancel() {
+    is_cancelled_.store(true, std::memory_order_relaxed);
+  }
+  bool is_cancelled() const {
+    return is_cancelled_.load(std::memory_order_relaxed);
+  }
+
+ protected:
+  virtual void do_run() = 0;
+
+ private:
+  std::atomic<bool> is_ready_{false};
+  std::atomic<bool> is_cancelled_{false};
+};
+
+// decodes an image and scales it to fit into max_pix_height x max_pix_width pixels
+class ImageDecodeJob : public DecoderJob {
+ public:
+  enum class Source { File, JpegData };
+  ImageDecodeJob(Source source, std::string path_or_data, td::int32 max_pix_height, td::int32 max_pix_width);
+
+  // can be called only after the job is ready; returns nullptr, if the image couldn't be decoded
+  std::shared_ptr<DecodedImage> release_image() {
+    return std::move(image_);
+  }
+  // size of the image before scaling; can be called only after the job is ready
+  td::int32 source_pix_height() const {
+    return source_pix_height_;
+  }
+  td::int32 source_pix_width() const {
+    return source_pix_width_;
+  }
+
+ protected:
+  void do_run() override;
+
+ private:
+  Source source_;
+  std::string path_or_data_;
+  td::int32 max_pix_height_;
+  td::int32 max_pix_width_;
+
+  std::shared_ptr<DecodedImage> image_;
+  td::int32 source_pix_height_{0};
+  td::int32 source_pix_width_{0};
+};
+
+// pool of threads decoding images, so that renders never wait for image decoding. The most recently added jobs are
+// run first: they belong to images, that are on the screen now
+class ImageDecoder {
+ public:
+  explicit ImageDecoder(size_t threads_count);
+  ImageDecoder(const ImageDecoder &) = delete;
+  ImageDecoder &operator=(const ImageDecoder &) = delete;
+  ~ImageDecoder();
+
+  void add_job(std::shared_ptr<DecoderJob> job);
+
+  // returns true, if some jobs were finished since the previous call
+  bool collect_finished_jobs() {
+    return finished_jobs_.exchange(0, std::memory_order_relaxed) > 0;
+  }
+  bool has_pending_jobs() const {
+    return pending_jobs_.load(std::memory_order_relaxed) > 0;
+  }
+
+ private:
+  void run_worker();
+
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  std::deque<std::shared_ptr<DecoderJob>> jobs_;
+  bool is_closed_{false};
+  std::atomic<size_t> pending_jobs_{0};
+  std::atomic<size_t> finished_jobs_{0};
+  std::vector<std::thread> threads_;
+};
+
+ImageDecoder &image_decoder();
+
+}  // namespace windows
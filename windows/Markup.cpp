@@ -0,0 +1,120 @@
+#include "Markup.hpp"
+
+#include "td/utils/logging.h"
+#include "td/utils/overloaded.h"
+
+#include <algorithm>
+
+namespace windows {
+
+MarkupSpans::MarkupSpans(const std::vector<MarkupElement> &elements) {
+  spans_.reserve(elements.size());
+  for (auto &el : elements) {
+    el->append_to(*this);
+  }
+}
+
+void MarkupSpans::append(const MarkupSpans &other, size_t pos_offset, size_t idx_offset) {
+  auto left_pads_offset = static_cast<td::uint32>(left_pads_.size());
+  auto images_offset = static_cast<td::uint32>(images_.size());
+  left_pads_.insert(left_pads_.end(), other.left_pads_.begin(), other.left_pads_.end());
+  images_.insert(images_.end(), other.images_.begin(), other.images_.end());
+  spans_.reserve(spans_.size() + other.spans_.size());
+  for (auto span : other.spans_) {
+    span.first_pos += static_cast<td::uint32>(pos_offset);
+    span.first_idx += static_cast<td::uint32>(idx_offset);
+    span.last_pos += static_cast<td::uint32>(pos_offset);
+    span.last_idx += static_cast<td::uint32>(idx_offset);
+    if (span.kind == MarkupKind::LeftPad) {
+      span.payload += left_pads_offset;
+    } else if (span.kind == MarkupKind::Image || span.kind == MarkupKind::ImageData) {
+      span.payload += images_offset;
+    }
+    spans_.push_back(span);
+  }
+  is_sorted_ = false;
+}
+
+void MarkupSpans::sort_events() const {
+  events_.resize(spans_.size() * 2);
+  for (size_t i = 0; i < events_.size(); i++) {
+    events_[i] = static_cast<td::uint32>(i);
+  }
+  // by position in the text; at the same position ends go before starts
+  std::sort(events_.begin(), events_.end(), [&](td::uint32 l, td::uint32 r) {
+    auto &l_span = spans_[event_span(l)];
+    auto &r_span = spans_[event_span(r)];
+    auto l_pos = is_event_start(l) ? l_span.first() : l_span.last();
+    auto r_pos = is_event_start(r) ? r_span.first() : r_span.last();
+    return l_pos < r_pos || (l_pos == r_pos && !is_event_start(l) && is_event_start(r));
+  });
+  is_sorted_ = true;
+}
+
+std::vector<MarkupElement> MarkupSpans::to_elements() const {
+  std::vector<MarkupElement> res;
+  res.reserve(spans_.size());
+  for (auto &span : spans_) {
+    auto first = span.first();
+    auto last = span.last();
+    switch (span.kind) {
+      case MarkupKind::FgColor:
+        res.push_back(std::make_shared<MarkupElementFgColor>(first, last, static_cast<Color>(span.payload)));
+        break;
+      case MarkupKind::FgColorRGB:
+        res.push_back(std::make_shared<MarkupElementFgColorRGB>(first, last, ColorRGB(span.payload)));
+        break;
+      case MarkupKind::BgColor:
+        res.push_back(std::make_shared<MarkupElementBgColor>(first, last, static_cast<Color>(span.payload)));
+        break;
+      case MarkupKind::BgColorRGB:
+        res.push_back(std::make_shared<MarkupElementBgColorRGB>(first, last, ColorRGB(span.payload)));
+        break;
+      case MarkupKind::Bold:
+        res.push_back(std::make_shared<MarkupElementBold>(first, last, span.payload != 0));
+        break;
+      case MarkupKind::Underline:
+        res.push_back(std::make_shared<MarkupElementUnderline>(first, last, span.payload != 0));
+        break;
+      case MarkupKind::Italic:
+        res.push_back(std::make_shared<MarkupElementItalic>(first, last, span.payload != 0));
+        break;
+      case MarkupKind::Reverse:
+        res.push_back(std::make_shared<MarkupElementReverse>(first, last, span.payload != 0));
+        break;
+      case MarkupKind::Strike:
+        res.push_back(std::make_shared<MarkupElementStrike>(first, last, span.payload != 0));
+        break;
+      case MarkupKind::Blink:
+        res.push_back(std::make_shared<MarkupElementBlink>(first, last, span.payload != 0));
+        break;
+      case MarkupKind::NoLb:
+        res.push_back(std::make_shared<MarkupElementNoLb>(first, last, span.payload != 0));
+        break;
+      case MarkupKind::LeftPad: {
+        auto &pad = left_pad(span);
+        pad.color.visit(td::overloaded(
+            [&](const Color &c) { res.push_back(std::make_shared<MarkupElementLeftPad>(first, last, pad.pad, c)); },
+            [&](const ColorRGB &c) {
+              res.push_back(std::make_shared<MarkupElementLeftPad>(first, last, pad.pad, c));
+            }));
+      } break;
+      case MarkupKind::Image:
+      case MarkupKind::ImageData: {
+        auto &img = image(span);
+        if (span.kind == MarkupKind::Image) {
+          res.push_back(std::make_shared<MarkupElementImage>(first, last, img.source, img.image_height,
+                                                             img.image_width, img.rendered_height,
+                                                             img.rendered_width, img.allow_pixel));
+        } else {
+          res.push_back(std::make_shared<MarkupElementImageData>(first, last, img.source, img.image_height,
+                                                                 img.image_width, img.rendered_height,
+                                                                 img.rendered_width, img.allow_pixel));
+        }
+      } break;
+    }
+  }
+  return res;
+}
+
+}  // namespace windows
@@ -4,11 +4,12 @@
 #include "td/utils/common.h"
 #include "Output.hpp"
 #include <memory>
+#include <string>
+#include <tuple>
+#include <vector>
 
 namespace windows {
 
-class TextEditBuilder;
-
 struct MarkupElementPos {
   size_t pos;
   size_t idx;
@@ -25,17 +26,136 @@ struct MarkupElementPos {
   }
 };
 
+enum class MarkupKind : td::uint8 {
+  FgColor,
+  FgColorRGB,
+  BgColor,
+  BgColorRGB,
+  Bold,
+  Underline,
+  Italic,
+  Reverse,
+  Strike,
+  Blink,
+  NoLb,
+  LeftPad,
+  Image,
+  ImageData
+};
+
+// markup of a range of the text. Payload is the color or the flag value or, for pads and images, an index in a side
+// table of MarkupSpans
+struct MarkupSpan {
+  td::uint32 first_pos;
+  td::uint32 first_idx;
+  td::uint32 last_pos;
+  td::uint32 last_idx;
+  td::uint32 payload;
+  MarkupKind kind;
+
+  MarkupElementPos first() const {
+    return MarkupElementPos(first_pos, first_idx);
+  }
+  MarkupElementPos last() const {
+    return MarkupElementPos(last_pos, last_idx);
+  }
+};
+
+class MarkupElementBase;
+using MarkupElement = std::shared_ptr<MarkupElementBase>;
+
+// markup of a text as plain values, so that it is copied and rendered without allocating an object per element.
+// Text is rendered by events: starts and ends of spans, which are sorted once after the markup is built
+class MarkupSpans {
+ public:
+  struct LeftPad {
+    std::string pad;
+    td::Variant<Color, ColorRGB> color;
+  };
+  struct Image {
+    // path to the file or the image data itself
+    std::string source;
+    td::int32 image_height;
+    td::int32 image_width;
+    td::int32 rendered_height;
+    td::int32 rendered_width;
+    bool allow_pixel;
+  };
+
+  MarkupSpans() = default;
+  explicit MarkupSpans(const std::vector<MarkupElement> &elements);
+
+  void add(MarkupElementPos first, MarkupElementPos last, MarkupKind kind, td::uint32 payload) {
+    spans_.push_back(MarkupSpan{static_cast<td::uint32>(first.pos), static_cast<td::uint32>(first.idx),
+                                static_cast<td::uint32>(last.pos), static_cast<td::uint32>(last.idx), payload, kind});
+    is_sorted_ = false;
+  }
+  // the pad is stored once and can be used by several spans
+  td::uint32 add_left_pad(std::string pad, td::Variant<Color, ColorRGB> color) {
+    left_pads_.push_back(LeftPad{std::move(pad), std::move(color)});
+    return static_cast<td::uint32>(left_pads_.size() - 1);
+  }
+  void add_image(MarkupElementPos first, MarkupElementPos last, bool is_data, Image image) {
+    images_.push_back(std::move(image));
+    add(first, last, is_data ? MarkupKind::ImageData : MarkupKind::Image, static_cast<td::uint32>(images_.size() - 1));
+  }
+  // adds markup of a text, which is inserted at pos_offset; indices of positions are increased by idx_offset
+  void append(const MarkupSpans &other, size_t pos_offset, size_t idx_offset);
+
+  size_t size() const {
+    return spans_.size();
+  }
+  bool empty() const {
+    return spans_.empty();
+  }
+  const MarkupSpan &operator[](size_t i) const {
+    return spans_[i];
+  }
+  const LeftPad &left_pad(const MarkupSpan &span) const {
+    return left_pads_[span.payload];
+  }
+  const Image &image(const MarkupSpan &span) const {
+    return images_[span.payload];
+  }
+
+  // an event is the index of the span multiplied by 2, plus 1 for the end of the span
+  static size_t event_span(td::uint32 event) {
+    return event >> 1;
+  }
+  static bool is_event_start(td::uint32 event) {
+    return (event & 1) == 0;
+  }
+  td::uint32 event_pos(td::uint32 event) const {
+    auto &span = spans_[event_span(event)];
+    return is_event_start(event) ? span.first_pos : span.last_pos;
+  }
+  // events in the order they are applied; sorts them if spans were added after the last call
+  const std::vector<td::uint32> &events() const {
+    if (!is_sorted_) {
+      sort_events();
+    }
+    return events_;
+  }
+  void sort_events() const;
+
+  // the same markup as separate elements for the code, which needs to change elements one by one
+  std::vector<MarkupElement> to_elements() const;
+
+ private:
+  std::vector<MarkupSpan> spans_;
+  std::vector<LeftPad> left_pads_;
+  std::vector<Image> images_;
+  mutable std::vector<td::uint32> events_;
+  mutable bool is_sorted_{true};
+};
+
 class MarkupElementBase {
  public:
   MarkupElementBase(MarkupElementPos first_pos, MarkupElementPos last_pos)
       : first_pos_(first_pos), last_pos_(last_pos) {
   }
   virtual ~MarkupElementBase() = default;
-  virtual void install(WindowOutputter &rb) const = 0;
-  virtual void uninstall(WindowOutputter &rb) const = 0;
-  virtual bool apply_to_text_edit() const {
-    return false;
-  }
+  virtual void append_to(MarkupSpans &spans) const = 0;
 
   auto first_pos() const {
     return first_pos_;
@@ -58,35 +178,14 @@ class MarkupElementBase {
   MarkupElementPos last_pos_;
 };
 
-class MarkupElementTextEdit : public MarkupElementBase {
- public:
-  MarkupElementTextEdit(MarkupElementPos first_pos, MarkupElementPos last_pos)
-      : MarkupElementBase(first_pos, last_pos) {
-  }
-  void install(WindowOutputter &rb) const override {
-    UNREACHABLE();
-  }
-  void uninstall(WindowOutputter &rb) const override {
-    UNREACHABLE();
-  }
-  bool apply_to_text_edit() const override {
-    return true;
-  }
-  virtual void install(TextEditBuilder &rb) const = 0;
-  virtual void uninstall(TextEditBuilder &rb) const = 0;
-};
-
 class MarkupElementFgColor : public MarkupElementBase {
  public:
   MarkupElementFgColor(MarkupElementPos first_pos, MarkupElementPos last_pos, Color color)
       : MarkupElementBase(first_pos, last_pos), color_(color) {
   }
 
-  void install(WindowOutputter &rb) const override {
-    rb.set_fg_color(color_);
-  }
-  void uninstall(WindowOutputter &rb) const override {
-    rb.unset_fg_color();
+  void append_to(MarkupSpans &spans) const override {
+    spans.add(first_pos(), last_pos(), MarkupKind::FgColor, static_cast<td::uint32>(color_));
   }
 
  private:
@@ -99,11 +198,8 @@ class MarkupElementFgColorRGB : public MarkupElementBase {
       : MarkupElementBase(first_pos, last_pos), color_(color) {
   }
 
-  void install(WindowOutputter &rb) const override {
-    rb.set_fg_color_rgb(color_);
-  }
-  void uninstall(WindowOutputter &rb) const override {
-    rb.unset_fg_color();
+  void append_to(MarkupSpans &spans) const override {
+    spans.add(first_pos(), last_pos(), MarkupKind::FgColorRGB, color_.color);
   }
 
  private:
@@ -116,11 +212,8 @@ class MarkupElementBgColor : public MarkupElementBase {
       : MarkupElementBase(first_pos, last_pos), color_(color) {
   }
 
-  void install(WindowOutputter &rb) const override {
-    rb.set_bg_color(color_);
-  }
-  void uninstall(WindowOutputter &rb) const override {
-    rb.unset_bg_color();
+  void append_to(MarkupSpans &spans) const override {
+    spans.add(first_pos(), last_pos(), MarkupKind::BgColor, static_cast<td::uint32>(color_));
   }
 
  private:
@@ -133,201 +226,88 @@ class MarkupElementBgColorRGB : public MarkupElementBase {
       : MarkupElementBase(first_pos, last_pos), color_(color) {
   }
 
-  void install(WindowOutputter &rb) const override {
-    rb.set_bg_color_rgb(color_);
-  }
-  void uninstall(WindowOutputter &rb) const override {
-    rb.unset_bg_color();
+  void append_to(MarkupSpans &spans) const override {
+    spans.add(first_pos(), last_pos(), MarkupKind::BgColorRGB, color_.color);
   }
 
  private:
   ColorRGB color_;
 };
 
-class MarkupElementBold : public MarkupElementBase {
- public:
-  MarkupElementBold(MarkupElementPos first_pos, MarkupElementPos last_pos, bool value)
-      : MarkupElementBase(first_pos, last_pos), value_(value) {
-  }
-
-  void install(WindowOutputter &rb) const override {
-    rb.set_bold(value_);
-  }
-  void uninstall(WindowOutputter &rb) const override {
-    rb.unset_bold();
-  }
-
- private:
-  bool value_;
-};
-
-class MarkupElementUnderline : public MarkupElementBase {
- public:
-  MarkupElementUnderline(MarkupElementPos first_pos, MarkupElementPos last_pos, bool value)
-      : MarkupElementBase(first_pos, last_pos), value_(value) {
-  }
-
-  void install(WindowOutputter &rb) const override {
-    rb.set_underline(value_);
-  }
-  void uninstall(WindowOutputter &rb) const override {
-    rb.unset_underline();
-  }
-
- private:
-  bool value_;
-};
-
-class MarkupElementItalic : public MarkupElementBase {
- public:
-  MarkupElementItalic(MarkupElementPos first_pos, MarkupElementPos last_pos, bool value)
-      : MarkupElementBase(first_pos, last_pos), value_(value) {
-  }
-
-  void install(WindowOutputter &rb) const override {
-    rb.set_italic(value_);
-  }
-  void uninstall(WindowOutputter &rb) const override {
-    rb.unset_italic();
-  }
-
- private:
-  bool value_;
-};
-
-class MarkupElementReverse : public MarkupElementBase {
- public:
-  MarkupElementReverse(MarkupElementPos first_pos, MarkupElementPos last_pos, bool value)
-      : MarkupElementBase(first_pos, last_pos), value_(value) {
-  }
-
-  void install(WindowOutputter &rb) const override {
-    rb.set_reverse(value_);
-  }
-  void uninstall(WindowOutputter &rb) const override {
-    rb.unset_reverse();
-  }
-
- private:
-  bool value_;
-};
-
-class MarkupElementStrike : public MarkupElementBase {
- public:
-  MarkupElementStrike(MarkupElementPos first_pos, MarkupElementPos last_pos, bool value)
-      : MarkupElementBase(first_pos, last_pos), value_(value) {
-  }
-
-  void install(WindowOutputter &rb) const override {
-    rb.set_strike(value_);
-  }
-  void uninstall(WindowOutputter &rb) const override {
-    rb.unset_strike();
-  }
-
- private:
-  bool value_;
-};
-
-class MarkupElementBlink : public MarkupElementBase {
+// bold, underline and other flags
+template <MarkupKind kind>
+class MarkupElementFlag : public MarkupElementBase {
  public:
-  MarkupElementBlink(MarkupElementPos first_pos, MarkupElementPos last_pos, bool value)
+  MarkupElementFlag(MarkupElementPos first_pos, MarkupElementPos last_pos, bool value)
       : MarkupElementBase(first_pos, last_pos), value_(value) {
   }
 
-  void install(WindowOutputter &rb) const override {
-    rb.set_blink(value_);
-  }
-  void uninstall(WindowOutputter &rb) const override {
-    rb.unset_blink();
+  void append_to(MarkupSpans &spans) const override {
+    spans.add(first_pos(), last_pos(), kind, value_ ? 1 : 0);
   }
 
  private:
   bool value_;
 };
 
-class MarkupElementNoLb : public MarkupElementTextEdit {
- public:
-  MarkupElementNoLb(MarkupElementPos first_pos, MarkupElementPos last_pos, bool value)
-      : MarkupElementTextEdit(first_pos, last_pos), value_(value) {
-  }
-
-  void install(TextEditBuilder &rb) const override;
-  void uninstall(TextEditBuilder &rb) const override;
-
- private:
-  bool value_;
-};
+using MarkupElementBold = MarkupElementFlag<MarkupKind::Bold>;
+using MarkupElementUnderline = MarkupElementFlag<MarkupKind::Underline>;
+using MarkupElementItalic = MarkupElementFlag<MarkupKind::Italic>;
+using MarkupElementReverse = MarkupElementFlag<MarkupKind::Reverse>;
+using MarkupElementStrike = MarkupElementFlag<MarkupKind::Strike>;
+using MarkupElementBlink = MarkupElementFlag<MarkupKind::Blink>;
+using MarkupElementNoLb = MarkupElementFlag<MarkupKind::NoLb>;
 
-class MarkupElementLeftPad : public MarkupElementTextEdit {
+class MarkupElementLeftPad : public MarkupElementBase {
  public:
   MarkupElementLeftPad(MarkupElementPos first_pos, MarkupElementPos last_pos, std::string pad, Color color)
-      : MarkupElementTextEdit(first_pos, last_pos), pad_(pad), color_(color) {
+      : MarkupElementBase(first_pos, last_pos), pad_(pad), color_(color) {
   }
   MarkupElementLeftPad(MarkupElementPos first_pos, MarkupElementPos last_pos, std::string pad, ColorRGB color)
-      : MarkupElementTextEdit(first_pos, last_pos), pad_(pad), color_(color) {
+      : MarkupElementBase(first_pos, last_pos), pad_(pad), color_(color) {
   }
 
-  void install(TextEditBuilder &rb) const override;
-  void uninstall(TextEditBuilder &rb) const override;
+  void append_to(MarkupSpans &spans) const override {
+    spans.add(first_pos(), last_pos(), MarkupKind::LeftPad, spans.add_left_pad(pad_, color_));
+  }
 
  private:
   std::string pad_;
   td::Variant<Color, ColorRGB> color_;
 };
 
-class MarkupElementImage : public MarkupElementTextEdit {
+class MarkupElementImage : public MarkupElementBase {
  public:
   MarkupElementImage(MarkupElementPos first_pos, MarkupElementPos last_pos, std::string image_path,
                      td::int32 image_height, td::int32 image_width, td::int32 rendered_height, td::int32 rendered_width,
                      bool allow_pixel)
-      : MarkupElementTextEdit(first_pos, last_pos)
-      , image_path_(std::move(image_path))
-      , image_height_(image_height)
-      , image_width_(image_width)
-      , rendered_height_(rendered_height)
-      , rendered_width_(rendered_width)
-      , allow_pixel_(allow_pixel) {
+      : MarkupElementBase(first_pos, last_pos)
+      , image_{std::move(image_path), image_height, image_width, rendered_height, rendered_width, allow_pixel} {
   }
 
-  void install(TextEditBuilder &rb) const override;
-  void uninstall(TextEditBuilder &rb) const override;
+  void append_to(MarkupSpans &spans) const override {
+    spans.add_image(first_pos(), last_pos(), false, image_);
+  }
 
  private:
-  std::string image_path_;
-  td::int32 image_height_;
-  td::int32 image_width_;
-  td::int32 rendered_height_;
-  td::int32 rendered_width_;
-  bool allow_pixel_;
+  MarkupSpans::Image image_;
 };
 
-class MarkupElementImageData : public MarkupElementTextEdit {
+class MarkupElementImageData : public MarkupElementBase {
  public:
   MarkupElementImageData(MarkupElementPos first_pos, MarkupElementPos last_pos, std::string image_data,
                          td::int32 image_height, td::int32 image_width, td::int32 rendered_height,
                          td::int32 rendered_width, bool allow_pixel)
-      : MarkupElementTextEdit(first_pos, last_pos)
-      , image_data_(std::move(image_data))
-      , image_height_(image_height)
-      , image_width_(image_width)
-      , rendered_height_(rendered_height)
-      , rendered_width_(rendered_width)
-      , allow_pixel_(allow_pixel) {
+      : MarkupElementBase(first_pos, last_pos)
+      , image_{std::move(image_data), image_height, image_width, rendered_height, rendered_width, allow_pixel} {
   }
 
-  void install(TextEditBuilder &rb) const override;
-  void uninstall(TextEditBuilder &rb) const override;
+  void append_to(MarkupSpans &spans) const override {
+    spans.add_image(first_pos(), last_pos(), true, image_);
+  }
 
  private:
-  std::string image_data_;
-  td::int32 image_height_;
-  td::int32 image_width_;
-  td::int32 rendered_height_;
-  td::int32 rendered_width_;
-  bool allow_pixel_;
+  MarkupSpans::Image image_;
 };
 
-using MarkupElement = std::shared_ptr<MarkupElementBase>;
-
 }  // namespace windows
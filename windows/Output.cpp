@@ -1,4 +1,5 @@
 #include "Output.hpp"
+#include <algorithm>
 #include <memory>
 #include <utility>
 #include <vector>
@@ -7,6 +8,13 @@
 
 namespace windows {
 
+td::uint32 color_to_rgb(Color color) {
+  static const td::uint32 palette[16] = {0x000000, 0xcc0403, 0x19cb00, 0xcecb00, 0x0d73cc, 0xcb1ed1,
+                                         0x0dcdcd, 0xdddddd, 0x767676, 0xf2201f, 0x23fd00, 0xfffd00,
+                                         0x1a8fff, 0xfd28ff, 0x14ffff, 0xffffff};
+  return palette[static_cast<td::int32>(color)];
+}
+
 static std::unique_ptr<WindowOutputter> empty_window_outputter_var;
 
 WindowOutputter &empty_window_outputter() {
@@ -17,4 +25,37 @@ void set_empty_window_outputter(std::unique_ptr<WindowOutputter> outputter) {
   empty_window_outputter_var = std::move(outputter);
 }
 
+OutputStats &output_stats() {
+  static OutputStats instance{};
+  return instance;
+}
+
+void RefreshRate::on_frame_output(td::int64 bytes, double duration) {
+  output_bytes_ += bytes;
+  // frames without output say nothing about the speed of the terminal
+  if (bytes <= 0) {
+    return;
+  }
+  if (frame_duration_ > 0) {
+    frame_bytes_ = frame_bytes_ * 0.8 + static_cast<double>(bytes) * 0.2;
+    frame_duration_ = frame_duration_ * 0.8 + duration * 0.2;
+  } else {
+    frame_bytes_ = static_cast<double>(bytes);
+    frame_duration_ = duration;
+  }
+  update_interval();
+}
+
+void RefreshRate::update_interval() {
+  // the terminal must not spend more than this share of time on output
+  auto max_output_share = is_low_bandwidth_ ? 0.2 : 0.5;
+  auto min_interval = is_low_bandwidth_ ? 0.25 : 0.1;
+  interval_ = std::min(std::max(frame_duration_ / max_output_share, min_interval), 2.0);
+}
+
+RefreshRate &refresh_rate() {
+  static RefreshRate instance;
+  return instance;
+}
+
 }  // namespace windows
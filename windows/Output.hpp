@@ -2,6 +2,8 @@
 
 #include "td/utils/Slice-decl.h"
 #include "td/utils/Slice.h"
+#include <algorithm>
+#include <cstring>
 #include <memory>
 
 namespace windows {
@@ -37,6 +39,9 @@ struct ColorRGB {
   td::uint32 color;
 };
 
+// rgb value of the color, as it is drawn by the backends
+td::uint32 color_to_rgb(Color color);
+
 class RenderedImage {
  public:
   virtual ~RenderedImage() = default;
@@ -55,6 +60,14 @@ class WindowOutputter {
   td::int32 putstr_yx(td::int32 y, td::int32 x, td::CSlice s) {
     return putstr_yx(y, x, s.c_str(), s.size());
   }
+  // writes a run of graphemes on one line, occupying width cells; s doesn't have to be zero-terminated. Runs of
+  // several graphemes consist of printable ascii characters, so the backend's widths match ours
+  virtual void putstr_run(td::int32 y, td::int32 x, td::Slice s, td::int32 width) {
+    if (s.empty()) {
+      return;
+    }
+    putstr_yx(y, x, s.data(), s.size());
+  }
   void erase_yx(td::int32 y, td::int32 x, td::int32 size) {
     if (!is_real()) {
       return;
@@ -71,11 +84,13 @@ class WindowOutputter {
     if (!is_real()) {
       return;
     }
-    char s[2];
-    s[0] = c;
-    s[1] = 0;
-    for (td::int32 i = 0; i < size; i++) {
-      putstr_yx(y, x + i, s, 1);
+    char s[64];
+    std::memset(s, c, sizeof(s));
+    while (size > 0) {
+      auto len = std::min(size, static_cast<td::int32>(sizeof(s)));
+      putstr_run(y, x, td::Slice(s, len), len);
+      x += len;
+      size -= len;
     }
   }
   void fill_yx(td::int32 y, td::int32 x, td::CSlice value, td::int32 size) {
@@ -171,20 +186,86 @@ class WindowOutputter {
                                                                 std::string path) {
     return {0, 0};
   }
-  virtual std::unique_ptr<RenderedImage> render_image(td::int32 max_height, td::int32 max_width, bool allow_pixel,
+  // image_height and image_width are the size of the image in pixels or 0, if it is unknown
+  virtual std::unique_ptr<RenderedImage> render_image(td::int32 max_height, td::int32 max_width,
+                                                      td::int32 image_height, td::int32 image_width, bool allow_pixel,
                                                       std::string path) {
     return nullptr;
   }
-  virtual std::unique_ptr<RenderedImage> render_image_data(td::int32 max_height, td::int32 max_width, bool allow_pixel,
-                                                           std::string data) {
+  virtual std::unique_ptr<RenderedImage> render_image_data(td::int32 max_height, td::int32 max_width,
+                                                           td::int32 image_height, td::int32 image_width,
+                                                           bool allow_pixel, std::string data) {
     return nullptr;
   }
   virtual void draw_rendered_image(td::int32 y, td::int32 x, RenderedImage &image) {
   }
   virtual void hide_rendered_image(RenderedImage &image) {
   }
+
+  // some image was drawn as an empty placeholder, because it is still being decoded, or an animation was drawn
+  bool has_pending_images() const {
+    return has_pending_images_;
+  }
+  void set_has_pending_images() {
+    has_pending_images_ = true;
+  }
+
+ private:
+  bool has_pending_images_{false};
 };
 
+// counters of all outputters, shown in the debug window
+struct OutputStats {
+  // pen changes requested by markup
+  td::int64 pen_requests{0};
+  // pen changes actually applied to the backend, all other requests were redundant
+  td::int64 pen_changes{0};
+};
+
+OutputStats &output_stats();
+
+// interval between redraws of a window, which weren't caused by input. The backend reports the size and duration of
+// the output of each frame, and the interval grows when the terminal can't take the output fast enough, e.g. over
+// a slow ssh connection, so that input isn't queued behind the output
+class RefreshRate {
+ public:
+  double interval() const {
+    return interval_;
+  }
+  void on_frame_output(td::int64 bytes, double duration);
+
+  // redraws are coalesced more aggressively and pixel images are not used
+  void set_low_bandwidth(bool value) {
+    is_low_bandwidth_ = value;
+    update_interval();
+  }
+  bool is_low_bandwidth() const {
+    return is_low_bandwidth_;
+  }
+
+  // bytes per second while a frame is written
+  double output_rate() const {
+    return frame_duration_ > 0 ? frame_bytes_ / frame_duration_ : 0;
+  }
+  double frame_duration() const {
+    return frame_duration_;
+  }
+  td::int64 output_bytes() const {
+    return output_bytes_;
+  }
+
+ private:
+  void update_interval();
+
+  bool is_low_bandwidth_{false};
+  double interval_{0.1};
+  double frame_bytes_{0};
+  double frame_duration_{0};
+  td::int64 output_bytes_{0};
+};
+
+RefreshRate &refresh_rate();
+
 void set_empty_window_outputter(std::unique_ptr<WindowOutputter> out);
 void create_empty_window_outputter_notcurses(void *notcurses, void *baseplane, void *renderplane);
 void create_empty_window_outputter_libtickit();
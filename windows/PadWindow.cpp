@@ -1,7 +1,9 @@
 #include "PadWindow.hpp"
 #include "td/utils/Slice-decl.h"
 #include "td/utils/StringBuilder.h"
+#include "td/utils/Random.h"
 #include "td/utils/ScopeGuard.h"
+#include <algorithm>
 #include <memory>
 #include <vector>
 
@@ -145,39 +147,229 @@ void PadWindow::on_resize(td::int32 old_height, td::int32 old_width, td::int32 n
     return;
   }
 
+  relayout(new_width);
+
+  if (old_height != new_height) {
+    if (pad_to_ == PadTo::Bottom) {
+      offset_from_window_top_ += (new_height - old_height);
+    }
+  }
+
+  adjust_cur_element(0);
+}
+
+void PadWindow::remeasure_elements() {
+  set_need_refresh();
+  pad_window_body_->set_need_refresh();
+  if (elements_.size() == 0) {
+    return;
+  }
+  for (auto &p : elements_) {
+    p.second->forget_heights();
+  }
+  relayout(width());
+  adjust_cur_element(0);
+}
+
+static td::int32 estimate_height(td::int32 height, td::int32 old_width, td::int32 new_width) {
+  // text is rewrapped, so the number of lines is roughly inversely proportional to the width
+  if (height <= 1 || old_width <= 0 || new_width <= 0 || old_width == new_width) {
+    return height;
+  }
+  auto h = ((td::int64)height * old_width + new_width - 1) / new_width;
+  return (td::int32)std::max<td::int64>(1, std::min<td::int64>(h, max_item_height()));
+}
+
+void PadWindow::relayout(td::int32 new_width) {
+  CHECK(cur_element_);
+  // measuring of all elements is too slow for long pads, so only elements around the current one are measured
+  // right away. Other elements get a cached height for this width or an estimation, which is refined later
+  auto old_cur_height = cur_element_->height;
+  lines_before_cur_element_ = 0;
+  lines_after_cur_element_ = 0;
+  bool is_before_cur = true;
   for (auto &p : elements_) {
     auto &el = *p.second;
-    auto old_height = el.height;
+    auto old_el_width = el.element->width();
     el.element->change_width(new_width);
-    el.height = el.element->render_fake(*this, empty_window_outputter(), cur_element_ == nullptr);
-    auto new_height = el.height;
-
-    if (el.element->is_less(*cur_element_->element)) {
-      lines_before_cur_element_ += new_height - old_height;
-    } else if (cur_element_->element->is_less(*el.element)) {
-      lines_after_cur_element_ += new_height - old_height;
+    auto h = el.cached_height(new_width);
+    if (h >= 0) {
+      store_element_height(el, h);
+      el.is_measured = true;
+    } else {
+      store_element_height(el, estimate_height(el.height, old_el_width, new_width));
+      el.is_measured = false;
+      has_unmeasured_elements_ = true;
+    }
+    if (&el == cur_element_) {
+      is_before_cur = false;
+    } else if (is_before_cur) {
+      lines_before_cur_element_ += el.height;
     } else {
-      CHECK(cur_element_ == &el);
-      auto p = offset_in_cur_element_ * 1.0 / old_height;
-      CHECK(p < 1.0);
-      offset_in_cur_element_ = (td::int32)(p * new_height);
+      lines_after_cur_element_ += el.height;
     }
   }
 
-  if (old_height != new_height) {
-    if (pad_to_ == PadTo::Bottom) {
-      offset_from_window_top_ += (new_height - old_height);
+  if (!cur_element_->is_measured) {
+    store_element_height(*cur_element_, measure_element(*cur_element_));
+  }
+  if (old_cur_height > 0) {
+    auto p = offset_in_cur_element_ * 1.0 / old_cur_height;
+    CHECK(p < 1.0);
+    offset_in_cur_element_ = (td::int32)(p * cur_element_->height);
+  }
+  if (offset_in_cur_element_ >= cur_element_->height) {
+    offset_in_cur_element_ = cur_element_->height > 0 ? cur_element_->height - 1 : 0;
+  }
+
+  reset_measure_cursor();
+  measure_elements_near_cur_element((td::int32)elements_.size(), 2 * effective_height());
+}
+
+td::int32 PadWindow::measure_element(ElementInfo &el) {
+  auto h = el.element->render_fake(*this, empty_window_outputter(), &el == cur_element_);
+  LOG_CHECK(h >= 0 && h <= max_item_height()) << h;
+  el.save_height(el.element->width(), h);
+  el.is_measured = true;
+  return h;
+}
+
+void PadWindow::set_element_height(ElementInfo &el, td::int32 new_height) {
+  auto old_height = el.height;
+  store_element_height(el, new_height);
+  if (&el == cur_element_) {
+    if (offset_in_cur_element_ >= new_height) {
+      offset_in_cur_element_ = new_height > 0 ? new_height - 1 : 0;
     }
+  } else if (el.element->is_less(*cur_element_->element)) {
+    lines_before_cur_element_ += new_height - old_height;
+    CHECK(lines_before_cur_element_ >= 0);
+  } else {
+    lines_after_cur_element_ += new_height - old_height;
+    CHECK(lines_after_cur_element_ >= 0);
   }
+}
 
-  adjust_cur_element(0);
+bool PadWindow::store_new_element_height(ElementInfo &el) {
+  // the current element is always measured, like in measure_element()
+  bool is_selected = &el == cur_element_;
+  if (!is_selected && !el.element->is_prepared()) {
+    store_element_height(el, 1);
+    el.is_measured = false;
+    has_unmeasured_elements_ = true;
+    // the element can be inserted among the elements already visited by the incremental pass
+    reset_measure_cursor();
+    return false;
+  }
+  auto h = el.element->render_fake(*this, empty_window_outputter(), is_selected);
+  LOG_CHECK(h >= 0 && h <= max_item_height()) << h;
+  el.save_height(el.element->width(), h);
+  store_element_height(el, h);
+  return true;
+}
+
+void PadWindow::measure_elements_near_cur_element(td::int32 max_elements, td::int32 max_lines) {
+  // elements are visited in both directions from the current one, so the nearest ones get real heights first
+  auto it = elements_.find(cur_element_->element.get());
+  CHECK(it != elements_.end());
+  auto up = it;
+  auto down = it;
+  down++;
+  td::int32 lines_up = 0;
+  td::int32 lines_down = 0;
+  bool up_done = up == elements_.begin();
+  bool down_done = down == elements_.end();
+  bool has_unprepared = false;
+  auto measure = [&](ElementInfo &el) {
+    if (!el.is_measured) {
+      if (&el != cur_element_ && !el.element->is_prepared()) {
+        has_unprepared = true;
+        return;
+      }
+      set_element_height(el, measure_element(el));
+      max_elements--;
+    }
+  };
+  measure(*cur_element_);
+  while (max_elements > 0 && (!up_done || !down_done)) {
+    if (!up_done) {
+      up--;
+      measure(*up->second);
+      lines_up += up->second->height;
+      up_done = up == elements_.begin() || lines_up >= max_lines;
+    }
+    if (!down_done && max_elements > 0) {
+      measure(*down->second);
+      lines_down += down->second->height;
+      down++;
+      down_done = down == elements_.end() || lines_down >= max_lines;
+    }
+  }
+  if (up_done && down_done && lines_up < max_lines && lines_down < max_lines && !has_unprepared) {
+    // whole pad was visited
+    has_unmeasured_elements_ = false;
+  }
+}
+
+bool PadWindow::measure_elements_incrementally(td::int32 max_elements, td::int32 max_visited) {
+  // the pass starts from the current element and continues where the previous render stopped, so measured elements
+  // aren't visited again on each render
+  if (!measure_up_) {
+    measure_up_ = measure_down_ = cur_element_->element.get();
+    measure_skipped_unprepared_ = false;
+  }
+  td::int32 measured = 0;
+  auto measure = [&](ElementInfo &el) {
+    if (!el.is_measured) {
+      if (&el != cur_element_ && !el.element->is_prepared()) {
+        measure_skipped_unprepared_ = true;
+        return;
+      }
+      set_element_height(el, measure_element(el));
+      measured++;
+    }
+  };
+  // the current element could be scrolled out of the visited part
+  measure(*cur_element_);
+  auto up = elements_.find(measure_up_);
+  auto down = elements_.find(measure_down_);
+  CHECK(up != elements_.end());
+  CHECK(down != elements_.end());
+  down++;
+  bool up_done = up == elements_.begin();
+  bool down_done = down == elements_.end();
+  while (measured < max_elements && max_visited > 0 && (!up_done || !down_done)) {
+    if (!up_done) {
+      up--;
+      measure(*up->second);
+      max_visited--;
+      up_done = up == elements_.begin();
+    }
+    if (!down_done) {
+      measure(*down->second);
+      max_visited--;
+      down++;
+      down_done = down == elements_.end();
+    }
+  }
+  if (up_done && down_done) {
+    // whole pad was visited; unprepared elements are measured by the next pass after on_elements_prepared()
+    if (!measure_skipped_unprepared_) {
+      has_unmeasured_elements_ = false;
+    }
+    reset_measure_cursor();
+    return measured > 0;
+  }
+  down--;
+  measure_up_ = up->first;
+  measure_down_ = down->first;
+  return true;
 }
 
 void PadWindow::change_element(PadWindowElement *elem) {
-  set_need_refresh();
-  pad_window_body_->set_need_refresh();
   auto it = elements_.find(elem);
   if (it == elements_.end()) {
+    set_need_refresh();
     return;
   }
 
@@ -185,9 +377,16 @@ void PadWindow::change_element(PadWindowElement *elem) {
 
   auto old_height = it->second->height;
 
-  el.height = el.element->render_fake(*this, empty_window_outputter(), it->second.get() == cur_element_);
+  el.forget_heights();
+  store_element_height(el, measure_element(el));
 
   auto new_height = it->second->height;
+  if (new_height == old_height) {
+    damage_element(el);
+    return;
+  }
+
+  set_need_refresh();
 
   if (cur_element_->element->is_less(*elem)) {
     lines_after_cur_element_ += new_height - old_height;
@@ -220,13 +419,13 @@ void PadWindow::change_element(std::shared_ptr<PadWindowElement> elem, std::func
   if (elem->is_less(*cur_element_->element)) {
     lines_before_cur_element_ -= it->second->height;
     CHECK(lines_before_cur_element_ >= 0);
-    auto ptr = std::move(it->second);
-    elements_.erase(it);
+    auto ptr = erase_element_info(it);
     change();
     if (elem->is_visible()) {
-      it = elements_.emplace(elem.get(), std::move(ptr)).first;
+      it = insert_element_info(std::move(ptr));
       auto &el = *it->second;
-      el.height = el.element->render_fake(*this, empty_window_outputter(), it->second.get() == cur_element_);
+      el.forget_heights();
+      store_element_height(el, measure_element(el));
       if (cur_element_->element->is_less(*elem)) {
         lines_after_cur_element_ += it->second->height;
       } else {
@@ -236,13 +435,13 @@ void PadWindow::change_element(std::shared_ptr<PadWindowElement> elem, std::func
   } else if (cur_element_->element->is_less(*elem)) {
     lines_after_cur_element_ -= it->second->height;
     CHECK(lines_after_cur_element_ >= 0);
-    auto ptr = std::move(it->second);
-    elements_.erase(it);
+    auto ptr = erase_element_info(it);
     change();
     if (elem->is_visible()) {
-      it = elements_.emplace(elem.get(), std::move(ptr)).first;
+      it = insert_element_info(std::move(ptr));
       auto &el = *it->second;
-      el.height = el.element->render_fake(*this, empty_window_outputter(), it->second.get() == cur_element_);
+      el.forget_heights();
+      store_element_height(el, measure_element(el));
       if (cur_element_->element->is_less(*elem)) {
         lines_after_cur_element_ += it->second->height;
       } else {
@@ -254,10 +453,9 @@ void PadWindow::change_element(std::shared_ptr<PadWindowElement> elem, std::func
     CHECK(cur_element_ == it->second.get());
     auto p = offset_in_cur_element_ * 1.0 / old_height;
     CHECK(p < 1.0);
-    auto ptr = std::move(it->second);
     auto next_el = it;
     next_el++;
-    elements_.erase(it);
+    auto ptr = erase_element_info(it);
     change();
     if (!elem->is_visible()) {
       if (elements_.size() != 0) {
@@ -280,7 +478,7 @@ void PadWindow::change_element(std::shared_ptr<PadWindowElement> elem, std::func
       adjust_cur_element(0);
       return;
     }
-    it = elements_.emplace(elem.get(), std::move(ptr)).first;
+    it = insert_element_info(std::move(ptr));
     auto &el = *it->second;
     bool unchanged_pos = false;
     if (next_el != elements_.begin() && el.element->is_visible()) {
@@ -290,15 +488,13 @@ void PadWindow::change_element(std::shared_ptr<PadWindowElement> elem, std::func
         unchanged_pos = true;
       }
     }
-    el.height = el.element->render_fake(*this, empty_window_outputter(), it->second.get() == cur_element_);
+    el.forget_heights();
+    store_element_height(el, measure_element(el));
     auto new_height = it->second->height;
     offset_in_cur_element_ = (td::int32)(p * new_height);
 
     if (!unchanged_pos) {
-      lines_before_cur_element_ = 0;
-      for (auto it3 = elements_.begin(); it3 != it; it3++) {
-        lines_before_cur_element_ += it3->second->height;
-      }
+      lines_before_cur_element_ = (td::int32)height_index_.lines_before(&el);
       lines_after_cur_element_ = tot_height - lines_before_cur_element_;
     }
   }
@@ -356,7 +552,7 @@ void PadWindow::delete_element(PadWindowElement *elem) {
     }
   }
 
-  elements_.erase(old_it);
+  erase_element_info(old_it);
 
   adjust_cur_element(0);
 }
@@ -372,21 +568,20 @@ void PadWindow::add_element(std::shared_ptr<PadWindowElement> element) {
     return;
   }
 
-  auto x = elements_.emplace(elem, std::make_unique<ElementInfo>(std::move(element)));
-  CHECK(x.second);
-  it = x.first;
+  it = insert_element_info(std::make_unique<ElementInfo>(std::move(element)));
 
   auto &el = *it->second;
   CHECK(el.element);
   el.element->change_width(width());
-
-  el.height = el.element->render_fake(*this, empty_window_outputter(), cur_element_ == nullptr);
-  LOG_CHECK(el.height >= 0 && el.height <= max_item_height()) << el.height;
+  bool is_first = !cur_element_;
+  if (is_first) {
+    cur_element_ = &el;
+  }
+  store_new_element_height(el);
 
   auto new_height = it->second->height;
 
-  if (!cur_element_) {
-    cur_element_ = &el;
+  if (is_first) {
     offset_in_cur_element_ = glued_to_ == GluedTo::Bottom ? cur_element_->height - 1 : 0;
     offset_from_window_top_ = offset_in_cur_element_;
   } else if (cur_element_->element->is_less(*elem)) {
@@ -400,6 +595,66 @@ void PadWindow::add_element(std::shared_ptr<PadWindowElement> element) {
   adjust_cur_element(0);
 }
 
+void PadWindow::add_elements(std::vector<std::shared_ptr<PadWindowElement>> elements) {
+  if (elements.size() == 0) {
+    return;
+  }
+  set_need_refresh();
+  pad_window_body_->set_need_refresh();
+
+  // in the pad order the position right after the previously inserted element is a good hint for the next one
+  std::sort(elements.begin(), elements.end(),
+            [](const std::shared_ptr<PadWindowElement> &l, const std::shared_ptr<PadWindowElement> &r) {
+              CHECK(l && r);
+              return l->is_less(*r);
+            });
+  // in an empty pad the first or the last element becomes current and must be measured right away
+  PadWindowElement *new_cur_element = nullptr;
+  if (!cur_element_) {
+    new_cur_element = (glued_to_ == GluedTo::Bottom ? elements.back() : elements.front()).get();
+  }
+  std::vector<ElementInfo *> added;
+  added.reserve(elements.size());
+  auto hint = elements_.end();
+  for (auto &element : elements) {
+    if (elements_.count(element.get())) {
+      LOG(WARNING) << "not adding, already an element";
+      continue;
+    }
+    auto it = insert_element_info(std::make_unique<ElementInfo>(std::move(element)), hint);
+    hint = std::next(it);
+
+    auto &el = *it->second;
+    el.element->change_width(width());
+    if (el.element.get() == new_cur_element) {
+      cur_element_ = &el;
+    }
+    store_new_element_height(el);
+    added.push_back(&el);
+  }
+  if (added.size() == 0) {
+    return;
+  }
+
+  if (new_cur_element) {
+    CHECK(cur_element_ && cur_element_->element.get() == new_cur_element);
+    offset_in_cur_element_ = glued_to_ == GluedTo::Bottom ? cur_element_->height - 1 : 0;
+    offset_from_window_top_ = offset_in_cur_element_;
+  }
+  for (auto el : added) {
+    if (el == cur_element_) {
+      continue;
+    }
+    if (el->element->is_less(*cur_element_->element)) {
+      lines_before_cur_element_ += el->height;
+    } else {
+      lines_after_cur_element_ += el->height;
+    }
+  }
+
+  adjust_cur_element(0);
+}
+
 void PadWindow::adjust_cur_element(td::int32 lines) {
   if (elements_.size() == 0) {
     request_top_elements();
@@ -553,15 +808,9 @@ void PadWindow::scroll_to_element(PadWindowElement *elptr, ScrollMode scroll_mod
   cur_element_ = el;
   offset_from_window_top_ = 0;
   offset_in_cur_element_ = 0;
-  lines_before_cur_element_ = 0;
-  lines_after_cur_element_ = 0;
-  for (auto &e : elements_) {
-    if (e.first->is_less(*elptr)) {
-      lines_before_cur_element_ += e.second->height;
-    } else if (elptr->is_less(*e.first)) {
-      lines_after_cur_element_ += e.second->height;
-    }
-  }
+  lines_before_cur_element_ = (td::int32)height_index_.lines_before(el);
+  lines_after_cur_element_ =
+      (td::int32)(height_index_.total_height() - lines_before_cur_element_ - cur_element_->height);
 
   if (lines_before_cur_element_ + cur_element_->height <= effective_height()) {
     glued_to_ = GluedTo::RelTop;
@@ -590,32 +839,49 @@ std::vector<std::shared_ptr<PadWindowElement>> PadWindow::get_visible_elements()
 
   std::vector<std::shared_ptr<PadWindowElement>> res;
 
-  auto l = lines_before_cur_element_;
-  auto it = elements_.find(cur_element_->element.get());
-  CHECK(it != elements_.end());
-  auto itf = it;
-  while (it != elements_.begin() && l > 0) {
-    it--;
-    l -= it->second->height;
+  td::int64 first_line = lines_before_cur_element_ + offset_in_cur_element_ - offset_from_window_top_;
+  if (first_line < 0) {
+    first_line = 0;
+  }
+  td::int64 offset_in_first_element;
+  auto node = height_index_.node_at_line(first_line, offset_in_first_element);
+  if (!node) {
+    return res;
   }
+  auto it = elements_.find(static_cast<ElementInfo *>(node)->element.get());
+  CHECK(it != elements_.end());
 
-  while (it != itf) {
+  auto l = -offset_in_first_element;
+  while (it != elements_.end() && l < effective_height()) {
     res.push_back(it->second->element);
+    l += it->second->height;
     it++;
   }
 
-  res.push_back(it->second->element);
-  it++;
+  return res;
+}
 
-  l = lines_after_cur_element_;
+td::int32 PadWindow::lines_over_window() const {
+  if (!cur_element_) {
+    return 0;
+  }
+  return std::max(0, lines_before_cur_element_ + offset_in_cur_element_ - offset_from_window_top_);
+}
 
-  while (it != elements_.end() && l > 0) {
-    res.push_back(it->second->element);
-    l -= it->second->height;
-    it++;
+td::int32 PadWindow::lines_under_window() const {
+  if (!cur_element_) {
+    return 0;
   }
+  return std::max(0, lines_after_cur_element_ + (cur_element_->height - offset_in_cur_element_) -
+                         (effective_height() - offset_from_window_top_));
+}
 
-  return res;
+td::int32 PadWindow::element_height(const PadWindowElement *el) const {
+  auto it = elements_.find(const_cast<PadWindowElement *>(el));
+  if (it == elements_.end()) {
+    return -1;
+  }
+  return it->second->height;
 }
 
 void PadWindow::render(WindowOutputter &rb, bool force) {
@@ -625,20 +891,8 @@ void PadWindow::render(WindowOutputter &rb, bool force) {
   }
 
   {
-    td::int32 lines_over_window =
-        (cur_element_ ? lines_before_cur_element_ + offset_in_cur_element_ - offset_from_window_top_ : 0);
-    td::int32 lines_under_window =
-        (cur_element_ ? lines_after_cur_element_ + (cur_element_->height - offset_in_cur_element_) -
-                            (effective_height() - offset_from_window_top_)
-                      : 0);
-
-    if (lines_over_window < 0) {
-      lines_over_window = 0;
-    }
-
-    if (lines_under_window < 0) {
-      lines_under_window = 0;
-    }
+    auto lines_over = lines_over_window();
+    auto lines_under = lines_under_window();
 
     td::CSlice text;
 
@@ -647,7 +901,7 @@ void PadWindow::render(WindowOutputter &rb, bool force) {
     if (glued_to_ == GluedTo::Top) {
       sb << "glued";
     } else {
-      sb << lines_over_window;
+      sb << lines_over;
     }
     sb << " ";
     sb << title() << "\n";
@@ -665,7 +919,7 @@ void PadWindow::render(WindowOutputter &rb, bool force) {
     if (glued_to_ == GluedTo::Bottom) {
       sb << "glued";
     } else {
-      sb << lines_under_window;
+      sb << lines_under;
     }
     sb << " ";
     sb << title() << "\n";
@@ -682,7 +936,60 @@ void PadWindow::render(WindowOutputter &rb, bool force) {
   rb.cursor_move_yx(0, 0, WindowOutputter::CursorShape::None);
 }
 
+void PadWindow::damage_element(ElementInfo &el) {
+  Window::set_need_refresh();
+  if (!is_fully_damaged_) {
+    damaged_elements_.insert(&el);
+  }
+  pad_window_body_->set_need_refresh_damaged();
+}
+
+bool PadWindow::render_damaged_elements(WindowOutputter &rb) {
+  // images are shown above the text and can't be attributed to elements, so they are redrawn only with the whole body
+  if (!cur_element_ || saved_images_.size() > 0) {
+    return false;
+  }
+  auto damaged_elements = std::move(damaged_elements_);
+  damaged_elements_.clear();
+  auto dir = SavedRenderedImagesDirectory(std::move(saved_images_));
+  for (auto el : damaged_elements) {
+    auto offset = static_cast<td::int32>(height_index_.lines_before(el) - lines_before_cur_element_) +
+                  offset_from_window_top_ - offset_in_cur_element_;
+    auto top = std::max(offset, 0);
+    auto bottom = std::min(offset + el->height, effective_height());
+    if (top >= bottom) {
+      continue;
+    }
+    // the element is rendered to an outputter clipped to its rows, so that the rest of the body is left intact
+    auto clipped_rb = rb.create_subwindow_outputter(nullptr, top, 0, bottom - top, width(), rb.is_active());
+    clipped_rb->translate(offset - top, 0);
+    auto x = el->element->render(*this, *clipped_rb, dir, el == cur_element_);
+    clipped_rb->untranslate(offset - top, 0);
+    el->save_height(el->element->width(), x);
+    if (x != el->height) {
+      // rows below the element are stale now
+      set_element_height(*el, x);
+      set_need_refresh();
+      break;
+    }
+  }
+  saved_images_ = dir.release();
+  rb.cursor_move_yx(body_cursor_y_, body_cursor_x_, body_cursor_shape_);
+  return true;
+}
+
 void PadWindow::render_body(WindowOutputter &rb, bool force) {
+  if (!force && !is_fully_damaged_ && render_damaged_elements(rb)) {
+    return;
+  }
+  damaged_elements_.clear();
+  is_fully_damaged_ = false;
+  SCOPE_EXIT {
+    body_cursor_y_ = rb.local_cursor_y();
+    body_cursor_x_ = rb.local_cursor_x();
+    body_cursor_shape_ = rb.cursor_shape();
+  };
+
   if (!elements_.size()) {
     rb.erase_rect(0, 0, effective_height(), width());
     return;
@@ -718,17 +1025,10 @@ void PadWindow::render_body(WindowOutputter &rb, bool force) {
     CHECK(x >= 0 && x <= max_item_height());
     offset += x;
 
+    it->second->save_height(it->second->element->width(), x);
+    it->second->is_measured = true;
     if (x != it->second->height) {
-      if (it->second->element->is_less(*cur_element_->element)) {
-        lines_before_cur_element_ += x - it->second->height;
-      } else if (cur_element_->element->is_less(*it->second->element)) {
-        lines_after_cur_element_ += x - it->second->height;
-      } else {
-        if (offset_in_cur_element_ >= x) {
-          offset_in_cur_element_ = x > 0 ? x - 1 : 0;
-        }
-      }
-      it->second->height = x;
+      set_element_height(*it->second, x);
 
       set_need_refresh();
       pad_window_body_->set_need_refresh();
@@ -737,6 +1037,13 @@ void PadWindow::render_body(WindowOutputter &rb, bool force) {
     it++;
   }
 
+  if (has_unmeasured_elements_ &&
+      measure_elements_incrementally(max_measured_elements_per_render(), max_visited_elements_per_render())) {
+    // positions of elements could change, remaining elements are measured during next renders
+    set_need_refresh();
+    pad_window_body_->set_need_refresh();
+  }
+
   if (offset < effective_height()) {
     rb.erase_rect(offset, 0, effective_height() - offset, width());
     request_bottom_elements();
@@ -749,6 +1056,221 @@ void PadWindow::render_body(WindowOutputter &rb, bool force) {
   saved_images_ = dir.release();
 }
 
+PadWindow::ElementsMap::iterator PadWindow::insert_element_info(std::unique_ptr<ElementInfo> info) {
+  return insert_element_info(std::move(info), elements_.end());
+}
+
+PadWindow::ElementsMap::iterator PadWindow::insert_element_info(std::unique_ptr<ElementInfo> info,
+                                                                ElementsMap::iterator hint) {
+  auto node = info.get();
+  auto height = info->height;
+  auto old_size = elements_.size();
+  auto it = elements_.emplace_hint(hint, info->element.get(), std::move(info));
+  CHECK(elements_.size() == old_size + 1);
+  PadWindowHeightIndexNode *prev = nullptr;
+  if (it != elements_.begin()) {
+    auto prev_it = it;
+    prev_it--;
+    prev = prev_it->second.get();
+  }
+  height_index_.insert_after(prev, node, height);
+  return it;
+}
+
+std::unique_ptr<PadWindow::ElementInfo> PadWindow::erase_element_info(ElementsMap::iterator it) {
+  if (it->first == measure_up_ || it->first == measure_down_) {
+    reset_measure_cursor();
+  }
+  auto info = std::move(it->second);
+  height_index_.erase(info.get());
+  damaged_elements_.erase(info.get());
+  elements_.erase(it);
+  return info;
+}
+
+void PadWindow::store_element_height(ElementInfo &el, td::int32 height) {
+  el.height = height;
+  height_index_.set_height(&el, height);
+}
+
+td::int32 PadWindow::ElementInfo::cached_height(td::int32 width) const {
+  for (auto &m : measured_heights_) {
+    if (m.width == width) {
+      return m.height;
+    }
+  }
+  return -1;
+}
+
+void PadWindow::ElementInfo::save_height(td::int32 width, td::int32 height) {
+  size_t pos = measured_heights_.size() - 1;
+  for (size_t i = 0; i < measured_heights_.size(); i++) {
+    if (measured_heights_[i].width == width) {
+      pos = i;
+      break;
+    }
+  }
+  for (size_t i = pos; i > 0; i--) {
+    measured_heights_[i] = measured_heights_[i - 1];
+  }
+  measured_heights_[0].width = width;
+  measured_heights_[0].height = height;
+}
+
+void PadWindow::ElementInfo::forget_heights() {
+  measured_heights_.fill(MeasuredHeight());
+}
+
+void PadWindowHeightIndex::update(Node *node) {
+  node->subtree_height = node->node_height + (node->left ? node->left->subtree_height : 0) +
+                         (node->right ? node->right->subtree_height : 0);
+}
+
+void PadWindowHeightIndex::rotate_up(Node *node) {
+  auto parent = node->parent;
+  CHECK(parent);
+  auto grandparent = parent->parent;
+  if (parent->left == node) {
+    parent->left = node->right;
+    if (node->right) {
+      node->right->parent = parent;
+    }
+    node->right = parent;
+  } else {
+    CHECK(parent->right == node);
+    parent->right = node->left;
+    if (node->left) {
+      node->left->parent = parent;
+    }
+    node->left = parent;
+  }
+  parent->parent = node;
+  node->parent = grandparent;
+  if (!grandparent) {
+    root_ = node;
+  } else if (grandparent->left == parent) {
+    grandparent->left = node;
+  } else {
+    grandparent->right = node;
+  }
+  // sums of the grandparent and above are unchanged
+  update(parent);
+  update(node);
+}
+
+void PadWindowHeightIndex::insert_after(Node *prev, Node *node, td::int32 height) {
+  node->left = nullptr;
+  node->right = nullptr;
+  node->priority = td::Random::fast_uint32();
+  node->node_height = height;
+  node->subtree_height = height;
+  if (!root_) {
+    node->parent = nullptr;
+    root_ = node;
+    return;
+  }
+
+  // the node becomes a leaf right after prev in the in-order traversal
+  Node *parent;
+  bool is_left;
+  if (!prev) {
+    parent = root_;
+    while (parent->left) {
+      parent = parent->left;
+    }
+    is_left = true;
+  } else if (!prev->right) {
+    parent = prev;
+    is_left = false;
+  } else {
+    parent = prev->right;
+    while (parent->left) {
+      parent = parent->left;
+    }
+    is_left = true;
+  }
+  node->parent = parent;
+  if (is_left) {
+    parent->left = node;
+  } else {
+    parent->right = node;
+  }
+  for (auto p = parent; p; p = p->parent) {
+    p->subtree_height += height;
+  }
+
+  while (node->parent && node->parent->priority < node->priority) {
+    rotate_up(node);
+  }
+}
+
+void PadWindowHeightIndex::erase(Node *node) {
+  while (node->left || node->right) {
+    Node *child;
+    if (!node->left) {
+      child = node->right;
+    } else if (!node->right) {
+      child = node->left;
+    } else {
+      child = node->left->priority > node->right->priority ? node->left : node->right;
+    }
+    rotate_up(child);
+  }
+
+  for (auto p = node->parent; p; p = p->parent) {
+    p->subtree_height -= node->node_height;
+  }
+  if (!node->parent) {
+    root_ = nullptr;
+  } else if (node->parent->left == node) {
+    node->parent->left = nullptr;
+  } else {
+    node->parent->right = nullptr;
+  }
+  node->parent = nullptr;
+}
+
+void PadWindowHeightIndex::set_height(Node *node, td::int32 height) {
+  auto delta = height - node->node_height;
+  if (!delta) {
+    return;
+  }
+  node->node_height = height;
+  for (auto p = node; p; p = p->parent) {
+    p->subtree_height += delta;
+  }
+}
+
+td::int64 PadWindowHeightIndex::lines_before(const Node *node) const {
+  td::int64 res = node->left ? node->left->subtree_height : 0;
+  for (auto cur = node; cur->parent; cur = cur->parent) {
+    auto parent = cur->parent;
+    if (parent->right == cur) {
+      res += parent->node_height + (parent->left ? parent->left->subtree_height : 0);
+    }
+  }
+  return res;
+}
+
+PadWindowHeightIndexNode *PadWindowHeightIndex::node_at_line(td::int64 line, td::int64 &offset_in_node) const {
+  auto cur = root_;
+  while (cur) {
+    auto left_height = cur->left ? cur->left->subtree_height : 0;
+    if (line < left_height) {
+      cur = cur->left;
+      continue;
+    }
+    line -= left_height;
+    if (line < cur->node_height) {
+      offset_in_node = line;
+      return cur;
+    }
+    line -= cur->node_height;
+    cur = cur->right;
+  }
+  return nullptr;
+}
+
 td::int32 PadWindowElement::render_plain_text(WindowOutputter &rb, td::Slice text, td::int32 width,
                                               td::int32 max_height, bool is_selected,
                                               SavedRenderedImagesDirectory *images) {
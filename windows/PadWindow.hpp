@@ -4,10 +4,12 @@
 #include "Window.hpp"
 #include "TextEdit.hpp"
 #include "td/utils/logging.h"
+#include <array>
 #include <memory>
 #include <vector>
 #include <functional>
 #include <map>
+#include <set>
 
 namespace windows {
 
@@ -17,6 +19,16 @@ static constexpr td::int32 max_item_height() {
   return 10000;
 }
 
+// number of elements with estimated heights, that are measured during one render of the window
+static constexpr td::int32 max_measured_elements_per_render() {
+  return 64;
+}
+
+// number of elements, that are visited while looking for elements to measure during one render of the window
+static constexpr td::int32 max_visited_elements_per_render() {
+  return 1024;
+}
+
 class PadWindowElement {
  public:
   virtual ~PadWindowElement() = default;
@@ -41,6 +53,11 @@ class PadWindowElement {
   virtual bool is_visible() const {
     return true;
   }
+  // false, if the element is still being prepared in background and is expensive to measure now. Such elements get an
+  // estimated height and are measured when they are prepared or shown
+  virtual bool is_prepared() const {
+    return true;
+  }
 
   virtual void handle_input(PadWindow &root, const InputEvent &info) {
   }
@@ -58,20 +75,74 @@ class PadWindowElement {
   td::int32 width_;
 };
 
+// node of PadWindowHeightIndex
+struct PadWindowHeightIndexNode {
+  PadWindowHeightIndexNode *parent{nullptr};
+  PadWindowHeightIndexNode *left{nullptr};
+  PadWindowHeightIndexNode *right{nullptr};
+  td::uint32 priority{0};
+  td::int32 node_height{0};
+  td::int64 subtree_height{0};
+};
+
+// treap of pad elements in the pad order, that keeps sums of heights of subtrees. Gives the number of lines before
+// an element and the element at a line in O(log n). Nodes are owned by the caller
+class PadWindowHeightIndex {
+ public:
+  using Node = PadWindowHeightIndexNode;
+
+  // prev == nullptr inserts the node first
+  void insert_after(Node *prev, Node *node, td::int32 height);
+  void erase(Node *node);
+  void set_height(Node *node, td::int32 height);
+  void clear() {
+    root_ = nullptr;
+  }
+
+  td::int64 lines_before(const Node *node) const;
+  // returns nullptr, if line is out of range
+  Node *node_at_line(td::int64 line, td::int64 &offset_in_node) const;
+  td::int64 total_height() const {
+    return root_ ? root_->subtree_height : 0;
+  }
+
+ private:
+  static void update(Node *node);
+  void rotate_up(Node *node);
+
+  Node *root_{nullptr};
+};
+
 class PadWindow : public Window {
  public:
   PadWindow();
-  struct ElementInfo {
+  struct ElementInfo : public PadWindowHeightIndexNode {
     ElementInfo(std::shared_ptr<PadWindowElement> element) : element(std::move(element)) {
     }
     std::shared_ptr<PadWindowElement> element;
-    td::int32 height;
+    // changed only by store_element_height, so that the height index is kept in sync
+    td::int32 height{0};
+    // false, if height is only an estimation for the current width of the element
+    bool is_measured{true};
+
+    // returns -1, if the element was not measured at this width since the last change
+    td::int32 cached_height(td::int32 width) const;
+    void save_height(td::int32 width, td::int32 height);
+    void forget_heights();
 
-    void update();
+   private:
+    struct MeasuredHeight {
+      td::int32 width{-1};
+      td::int32 height{0};
+    };
+    // a few most recently used widths, most recent first
+    std::array<MeasuredHeight, 3> measured_heights_;
   };
   enum class GluedTo { Top, RelTop, RelBottom, Bottom, None };
   enum class PadTo { Top, Bottom };
   void on_resize(td::int32 old_height, td::int32 old_width, td::int32 new_height, td::int32 new_width) override;
+  // heights of all elements must be recalculated, even if the width is unchanged
+  void remeasure_elements();
 
   virtual void request_top_elements() {
   }
@@ -95,6 +166,14 @@ class PadWindow : public Window {
   void change_element(std::shared_ptr<PadWindowElement> el, std::function<void()> change);
   void delete_element(PadWindowElement *el);
   void add_element(std::shared_ptr<PadWindowElement> element);
+  // adds a batch of elements; scroll state is adjusted and more elements are requested only once for the whole batch
+  void add_elements(std::vector<std::shared_ptr<PadWindowElement>> elements);
+  // some elements became prepared and can be measured now
+  void on_elements_prepared() {
+    if (has_unmeasured_elements_) {
+      set_need_refresh();
+    }
+  }
 
   void scroll_up(td::int32 lines);
   void scroll_down(td::int32 lines);
@@ -135,6 +214,7 @@ class PadWindow : public Window {
   }
 
   void clear() {
+    height_index_.clear();
     elements_.clear();
     cur_element_ = nullptr;
     if (pad_to_ == PadTo::Top) {
@@ -146,6 +226,9 @@ class PadWindow : public Window {
     offset_from_window_top_ = 0;
     lines_after_cur_element_ = 0;
     lines_before_cur_element_ = 0;
+    has_unmeasured_elements_ = false;
+    reset_measure_cursor();
+    damage_all();
   }
 
   void unglue() {
@@ -169,6 +252,12 @@ class PadWindow : public Window {
     return height() - 2;
   }
 
+  // numbers of pad lines above and below the visible part of the pad
+  td::int32 lines_over_window() const;
+  td::int32 lines_under_window() const;
+  // returns -1, if there is no such element
+  td::int32 element_height(const PadWindowElement *el) const;
+
   void set_title(std::string title) {
     title_ = std::move(title);
   }
@@ -198,6 +287,18 @@ class PadWindow : public Window {
     void render(WindowOutputter &rb, bool force) override {
       win_->render_body(rb, force);
     }
+    void set_need_refresh() override {
+      win_->damage_all();
+      Window::set_need_refresh();
+    }
+    void set_need_refresh_force() override {
+      win_->damage_all();
+      Window::set_need_refresh_force();
+    }
+    // only rows of damaged elements are redrawn during the next render
+    void set_need_refresh_damaged() {
+      Window::set_need_refresh();
+    }
 
    private:
     PadWindow *win_;
@@ -208,7 +309,38 @@ class PadWindow : public Window {
       return l->is_less(*r);
     }
   };
-  std::map<PadWindowElement *, std::unique_ptr<ElementInfo>, Compare> elements_;
+  using ElementsMap = std::map<PadWindowElement *, std::unique_ptr<ElementInfo>, Compare>;
+  ElementsMap elements_;
+  PadWindowHeightIndex height_index_;
+
+  ElementsMap::iterator insert_element_info(std::unique_ptr<ElementInfo> info);
+  ElementsMap::iterator insert_element_info(std::unique_ptr<ElementInfo> info, ElementsMap::iterator hint);
+  std::unique_ptr<ElementInfo> erase_element_info(ElementsMap::iterator it);
+  void store_element_height(ElementInfo &el, td::int32 height);
+
+  void relayout(td::int32 new_width);
+  td::int32 measure_element(ElementInfo &el);
+  void set_element_height(ElementInfo &el, td::int32 new_height);
+  void measure_elements_near_cur_element(td::int32 max_elements, td::int32 max_lines);
+  // continues the pass over the pad from the elements, where the previous call stopped; returns false, if nothing
+  // changed and the pass is finished
+  bool measure_elements_incrementally(td::int32 max_elements, td::int32 max_visited);
+  // a new pass will start from the current element
+  void reset_measure_cursor() {
+    measure_up_ = nullptr;
+    measure_down_ = nullptr;
+  }
+  // unprepared elements are inserted with an estimated height
+  bool store_new_element_height(ElementInfo &el);
+
+  void damage_all() {
+    is_fully_damaged_ = true;
+    damaged_elements_.clear();
+  }
+  // element was changed without changing its height, so positions of all elements on the screen are unchanged
+  void damage_element(ElementInfo &el);
+  // returns false, if the whole body must be redrawn instead
+  bool render_damaged_elements(WindowOutputter &rb);
 
   td::int32 lines_before_cur_element_{0};
   td::int32 lines_after_cur_element_{0};
@@ -216,11 +348,23 @@ class PadWindow : public Window {
   td::int32 offset_from_window_top_{0};
   ElementInfo *cur_element_{nullptr};
 
+  bool has_unmeasured_elements_{false};
+  // first and last elements visited by the current incremental pass; all elements between them were visited
+  PadWindowElement *measure_up_{nullptr};
+  PadWindowElement *measure_down_{nullptr};
+  bool measure_skipped_unprepared_{false};
+
+  bool is_fully_damaged_{true};
+  std::set<ElementInfo *> damaged_elements_;
+  td::int32 body_cursor_y_{0};
+  td::int32 body_cursor_x_{0};
+  WindowOutputter::CursorShape body_cursor_shape_{WindowOutputter::CursorShape::None};
+
   GluedTo glued_to_{GluedTo::Top};
   PadTo pad_to_{PadTo::Top};
 
   std::string title_;
-  std::shared_ptr<Window> pad_window_body_;
+  std::shared_ptr<PadWindowBody> pad_window_body_;
 
   SavedRenderedImages saved_images_;
 };
@@ -8,6 +8,7 @@
 #include "BackendTickit.h"
 #endif
 #include "BackendNotcurses.h"
+#include "BackendNull.h"
 
 #include <memory>
 
@@ -145,6 +146,10 @@ void Screen::init() {
 #else
     UNREACHABLE();
 #endif
+  } else if (backend_type_ == BackendType::Null) {
+    init_null_backend(this, 60, 200);
+  } else if (backend_type_ == BackendType::Grid) {
+    init_grid_backend(this, 60, 200);
   } else {
     init_notcurses_backend(this);
   }
@@ -222,12 +227,15 @@ td::Timestamp Screen::loop() {
   }
 
   backend_->tick();
+  if (backend_->collect_decoded_images()) {
+    base_window_->refresh_pending_images_rec();
+  }
   refresh(false);
-  if (!base_window_->need_refresh()) {
-    return td::Timestamp::never();
-  } else {
-    return base_window_->need_refresh_at();
+  auto t = backend_->wakeup_at();
+  if (base_window_->need_refresh()) {
+    t.relax(base_window_->need_refresh_at());
   }
+  return t;
 }
 
 void Screen::handle_input(const InputEvent &info) {
@@ -290,6 +298,10 @@ void Screen::refresh(bool force) {
   backend_->refresh(force, base_window_);
 }
 
+std::string Screen::snapshot() {
+  return backend_ ? backend_->snapshot() : std::string();
+}
+
 td::int32 Screen::poll_fd() {
   if (backend_) {
     return backend_->poll_fd();
@@ -5,6 +5,7 @@
 #include "td/utils/int_types.h"
 #include "td/utils/Status.h"
 #include <memory>
+#include <string>
 #include <utility>
 #include <vector>
 #include <list>
@@ -27,15 +28,28 @@ class Backend {
   virtual void tick() = 0;
   virtual void refresh(bool force, std::shared_ptr<Window> base_window) = 0;
   virtual td::int32 poll_fd() = 0;
+  // returns true, if some images were decoded in background or animations moved to the next frame since the previous
+  // call
+  virtual bool collect_decoded_images() {
+    return false;
+  }
+  // time, when the backend needs to be polled again even if there is no input
+  virtual td::Timestamp wakeup_at() {
+    return td::Timestamp::never();
+  }
   virtual void create_backend_window(std::shared_ptr<Window> window) {
   }
   virtual void delete_backend_window(Window *window) {
   }
+  // text of the rendered screen, if the backend keeps it in memory
+  virtual std::string snapshot() {
+    return std::string();
+  }
 };
 
 class Screen {
  public:
-  enum class BackendType { Auto, Notcurses, Tickit };
+  enum class BackendType { Auto, Notcurses, Tickit, Null, Grid };
   class Callback {
    public:
     virtual ~Callback() = default;
@@ -64,6 +78,7 @@ class Screen {
   void change_layout(std::shared_ptr<WindowLayout> window_layout);
 
   td::int32 poll_fd();
+  std::string snapshot();
 
   void set_backend(std::unique_ptr<Backend> backend) {
     backend_ = std::move(backend);
@@ -0,0 +1,368 @@
+#include "StickerAnimation.hpp"
+
+#include "td/utils/logging.h"
+#include "td/utils/ScopeGuard.h"
+#include "td/utils/SharedSlice.h"
+#include "td/utils/SliceBuilder.h"
+
+#include "rlottie/inc/rlottie.h"
+
+#include <algorithm>
+#include <notcurses/notcurses.h>
+#include <utility>
+#include <zlib.h>
+
+namespace windows {
+
+namespace {
+
+// frames of animations with higher frame rate are skipped
+constexpr double MaxAnimationFrameRate = 30;
+// number of following frames, which are rendered in advance
+constexpr size_t AnimationFramesAhead = 4;
+
+void update_cost(double &cost, double value) {
+  cost = cost > 0 ? cost * 0.9 + value * 0.1 : value;
+}
+
+}  // namespace
+
+struct AnimationSource {
+  AnimationSource(std::string path, td::int32 max_pix_height, td::int32 max_pix_width)
+      : path(std::move(path)), max_pix_height(max_pix_height), max_pix_width(max_pix_width) {
+  }
+
+  std::string path;
+  td::int32 max_pix_height;
+  td::int32 max_pix_width;
+
+  // set by the first job; the animation is used only by the job, that is running now
+  std::unique_ptr<rlottie::Animation> animation;
+  td::int32 source_pix_height{0};
+  td::int32 source_pix_width{0};
+  td::int32 pix_height{0};
+  td::int32 pix_width{0};
+  size_t total_frames{0};
+  // number of frames, which are shown; 0 if the animation couldn't be loaded
+  size_t frames_count{0};
+  double frame_duration{0};
+};
+
+class AnimationFramesJob : public DecoderJob {
+ public:
+  AnimationFramesJob(std::shared_ptr<AnimationSource> source, std::vector<size_t> frame_ids)
+      : source_(std::move(source)), frame_ids_(std::move(frame_ids)) {
+  }
+
+  // rendered frames; frames, which couldn't be rendered, are nullptr
+  std::vector<std::pair<size_t, std::shared_ptr<DecodedImage>>> release_frames() {
+    return std::move(frames_);
+  }
+  double cost_per_frame() const {
+    return frame_ids_.size() ? elapsed_ / static_cast<double>(frame_ids_.size()) : 0;
+  }
+
+ protected:
+  void do_run() override;
+
+ private:
+  static bool load(AnimationSource &source);
+
+  std::shared_ptr<AnimationSource> source_;
+  std::vector<size_t> frame_ids_;
+  std::vector<std::pair<size_t, std::shared_ptr<DecodedImage>>> frames_;
+  double elapsed_{0};
+};
+
+bool AnimationFramesJob::load(AnimationSource &source) {
+  auto f = gzopen(source.path.c_str(), "rb");
+  if (!f) {
+    LOG(ERROR) << "failed to read tgs";
+    return false;
+  }
+  SCOPE_EXIT {
+    gzclose_r(f);
+  };
+
+  td::UniqueSlice buf(1 << 20);
+  auto r = gzread(f, buf.as_mutable_slice().data(), (unsigned int)buf.size());
+  if (r < 0) {
+    LOG(ERROR) << "failed to uncompress tgs: " << r;
+    return false;
+  }
+  if ((unsigned int)r >= buf.size()) {
+    LOG(ERROR) << "uncompressed sticker is bigger than " << buf.size();
+    return false;
+  }
+
+  auto animation = rlottie::Animation::loadFromData(buf.as_slice().truncate(r).str(), source.path);
+  if (!animation) {
+    LOG(ERROR) << "failed to parse animation";
+    return false;
+  }
+
+  size_t width = 0, height = 0;
+  animation->size(width, height);
+  if (!width || !height || !animation->totalFrame() || source.max_pix_height <= 0 || source.max_pix_width <= 0) {
+    LOG(ERROR) << "empty animation";
+    return false;
+  }
+  source.source_pix_height = (td::int32)height;
+  source.source_pix_width = (td::int32)width;
+  auto size = fit_image_to_box(source.max_pix_height, source.max_pix_width, source.source_pix_height,
+                               source.source_pix_width);
+  source.pix_height = size.first;
+  source.pix_width = size.second;
+
+  source.total_frames = animation->totalFrame();
+  source.frames_count = source.total_frames;
+  auto frame_rate = animation->frameRate();
+  if (frame_rate > MaxAnimationFrameRate) {
+    source.frames_count =
+        std::max<size_t>(1, static_cast<size_t>(static_cast<double>(source.total_frames) * MaxAnimationFrameRate /
+                                                frame_rate));
+  }
+  auto duration = animation->duration();
+  source.frame_duration =
+      duration > 0 ? duration / static_cast<double>(source.frames_count) : 1.0 / MaxAnimationFrameRate;
+  source.animation = std::move(animation);
+  return true;
+}
+
+void AnimationFramesJob::do_run() {
+  auto start = td::Time::now();
+  SCOPE_EXIT {
+    elapsed_ = td::Time::now() - start;
+  };
+  if (!source_->animation && !load(*source_)) {
+    return;
+  }
+
+  auto height = source_->pix_height;
+  auto width = source_->pix_width;
+  std::vector<td::uint32> buffer(static_cast<size_t>(height) * static_cast<size_t>(width));
+  rlottie::Surface surface(buffer.data(), width, height, width * 4);
+  for (auto frame_id : frame_ids_) {
+    if (is_cancelled()) {
+      break;
+    }
+    source_->animation->renderSync(frame_id * source_->total_frames / source_->frames_count, surface);
+    // rlottie renders ARGB32, which is BGRA in memory
+    auto v = ncvisual_from_bgra(buffer.data(), height, width * 4, width);
+    if (!v) {
+      LOG(ERROR) << "failed to create ncvisual";
+    }
+    frames_.emplace_back(frame_id, v ? std::make_shared<DecodedImage>(v, height, width) : nullptr);
+  }
+}
+
+StickerAnimation::StickerAnimation(std::string path, td::int32 max_pix_height, td::int32 max_pix_width)
+    : source_(std::make_shared<AnimationSource>(std::move(path), max_pix_height, max_pix_width)) {
+  job_ = std::make_shared<AnimationFramesJob>(source_, std::vector<size_t>{0});
+  image_decoder().add_job(job_);
+}
+
+StickerAnimation::~StickerAnimation() {
+  if (job_) {
+    job_->cancel();
+  }
+  for (auto &frame : frames_) {
+    if (frame) {
+      animation_player().remove_frames_size(frame->size_in_bytes());
+    }
+  }
+}
+
+bool StickerAnimation::update() {
+  if (!job_ || !job_->is_ready()) {
+    return false;
+  }
+  auto job = std::move(job_);
+  if (!frames_.size()) {
+    if (!source_->frames_count) {
+      is_failed_ = true;
+      return false;
+    }
+    frames_.resize(source_->frames_count);
+  }
+  animation_player().add_render_cost(job->cost_per_frame());
+
+  bool is_added = false;
+  for (auto &frame : job->release_frames()) {
+    if (frame.second) {
+      set_frame(frame.first, std::move(frame.second));
+      is_added = true;
+    }
+  }
+  if (!frames_[0]) {
+    frames_.clear();
+    is_failed_ = true;
+  }
+  return is_added;
+}
+
+td::int32 StickerAnimation::source_pix_height() const {
+  return frames_.size() ? source_->source_pix_height : 0;
+}
+
+td::int32 StickerAnimation::source_pix_width() const {
+  return frames_.size() ? source_->source_pix_width : 0;
+}
+
+double StickerAnimation::frame_duration() const {
+  return source_->frame_duration;
+}
+
+bool StickerAnimation::is_next_frame_ready() const {
+  return is_animated() && frames_[(current_frame_ + 1) % frames_.size()] != nullptr;
+}
+
+bool StickerAnimation::advance() {
+  if (!is_animated()) {
+    return false;
+  }
+  auto next_frame = (current_frame_ + 1) % frames_.size();
+  if (!frames_[next_frame]) {
+    return false;
+  }
+  auto prev_frame = current_frame_;
+  current_frame_ = next_frame;
+  // the first frame is kept to be shown when the animation is paused
+  if (prev_frame != 0 && animation_player().is_over_frames_budget()) {
+    set_frame(prev_frame, nullptr);
+  }
+  return true;
+}
+
+void StickerAnimation::request_frames() {
+  if (job_ || !is_animated()) {
+    return;
+  }
+  std::vector<size_t> frame_ids;
+  for (size_t i = 1; i <= AnimationFramesAhead && i < frames_.size(); i++) {
+    auto frame_id = (current_frame_ + i) % frames_.size();
+    if (!frames_[frame_id]) {
+      frame_ids.push_back(frame_id);
+    }
+  }
+  if (!frame_ids.size()) {
+    return;
+  }
+  job_ = std::make_shared<AnimationFramesJob>(source_, std::move(frame_ids));
+  image_decoder().add_job(job_);
+}
+
+void StickerAnimation::set_frame(size_t frame_id, std::shared_ptr<DecodedImage> frame) {
+  auto &old_frame = frames_[frame_id];
+  if (old_frame) {
+    animation_player().remove_frames_size(old_frame->size_in_bytes());
+  }
+  old_frame = std::move(frame);
+  if (old_frame) {
+    animation_player().add_frames_size(old_frame->size_in_bytes());
+  }
+}
+
+std::shared_ptr<StickerAnimation> AnimationPlayer::get_animation(const std::string &path, td::int32 max_pix_height,
+                                                                 td::int32 max_pix_width) {
+  std::string key = PSTRING() << max_pix_height << "x" << max_pix_width << ":" << path;
+  auto &weak_animation = animations_[key];
+  auto animation = weak_animation.lock();
+  if (!animation) {
+    animation = std::make_shared<StickerAnimation>(path, max_pix_height, max_pix_width);
+    weak_animation = animation;
+  }
+  if (animations_.size() >= 1024) {
+    for (auto it = animations_.begin(); it != animations_.end();) {
+      if (it->second.expired()) {
+        it = animations_.erase(it);
+      } else {
+        it++;
+      }
+    }
+  }
+  return animation;
+}
+
+void AnimationPlayer::set_drawn(std::shared_ptr<StickerAnimation> animation) {
+  if (!is_enabled() || !animation->is_animated() || animation->is_drawn_) {
+    return;
+  }
+  animation->is_drawn_ = true;
+  if (!animation->next_frame_at_) {
+    animation->next_frame_at_ = td::Timestamp::in(std::max(animation->frame_duration(), min_frame_interval()));
+  }
+  drawn_.push_back(std::move(animation));
+}
+
+bool AnimationPlayer::tick() {
+  bool is_changed = false;
+  auto min_interval = min_frame_interval();
+  for (size_t i = 0; i < drawn_.size();) {
+    auto animation = drawn_[i].lock();
+    bool is_playing = false;
+    if (animation) {
+      animation->update();
+      is_playing = is_enabled() && animation->is_animated();
+      if (is_playing && animation->next_frame_at_.is_in_past() && animation->advance()) {
+        // the next frame is scheduled only after the current one is drawn
+        is_changed = true;
+        is_playing = false;
+        animation->next_frame_at_ = td::Timestamp::in(std::max(animation->frame_duration(), min_interval));
+      }
+      animation->request_frames();
+      if (!is_playing) {
+        animation->is_drawn_ = false;
+      }
+    }
+    if (is_playing) {
+      i++;
+    } else {
+      drawn_[i] = std::move(drawn_.back());
+      drawn_.pop_back();
+    }
+  }
+  stats_.playing = drawn_.size();
+  stats_.frame_cost = frame_cost();
+  stats_.min_frame_interval = min_interval;
+  return is_changed;
+}
+
+td::Timestamp AnimationPlayer::wakeup_at() const {
+  td::Timestamp res;
+  for (auto &weak_animation : drawn_) {
+    auto animation = weak_animation.lock();
+    // while the next frame is rendered, the main loop is woken up by the decoder
+    if (animation && animation->is_next_frame_ready()) {
+      res.relax(animation->next_frame_at_);
+    }
+  }
+  return res;
+}
+
+void AnimationPlayer::add_render_cost(double seconds_per_frame) {
+  update_cost(render_cost_, seconds_per_frame);
+}
+
+void AnimationPlayer::add_draw_cost(double seconds) {
+  update_cost(draw_cost_, seconds);
+}
+
+double AnimationPlayer::frame_cost() const {
+  // frames are rendered again only if they don't fit into the frames budget
+  return draw_cost_ + (is_over_frames_budget() ? render_cost_ : 0);
+}
+
+double AnimationPlayer::min_frame_interval() const {
+  if (!is_enabled()) {
+    return 0;
+  }
+  return static_cast<double>(std::max<size_t>(drawn_.size(), 1)) * frame_cost() / cpu_budget_;
+}
+
+AnimationPlayer &animation_player() {
+  static AnimationPlayer instance;
+  return instance;
+}
+
+}  // namespace windows
@@ -0,0 +1,134 @@
+#pragma once
+
+#include "ImageDecoder.hpp"
+
+#include "td/utils/common.h"
+#include "td/utils/Time.h"
+
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace windows {
+
+struct AnimationSource;
+class AnimationFramesJob;
+
+// frames of an animated sticker, rendered by the decoder threads at the size the sticker is drawn with. Rendered
+// frames are kept while the total size of frames of all animations fits into the budget of the player, so that
+// short animations are rendered only once. Used only from the main thread
+class StickerAnimation {
+ public:
+  StickerAnimation(std::string path, td::int32 max_pix_height, td::int32 max_pix_width);
+  StickerAnimation(const StickerAnimation &) = delete;
+  StickerAnimation &operator=(const StickerAnimation &) = delete;
+  ~StickerAnimation();
+
+  // collects frames rendered by the worker; returns true, if some frames were added
+  bool update();
+
+  // the first frame isn't rendered yet
+  bool is_loading() const {
+    return !is_failed_ && !frames_.size();
+  }
+  bool is_animated() const {
+    return frames_.size() > 1;
+  }
+  // nullptr until the first frame is rendered or if the sticker couldn't be rendered
+  std::shared_ptr<DecodedImage> current_frame() const {
+    return frames_.size() ? frames_[current_frame_] : nullptr;
+  }
+  // size of the animation before scaling, known after the first frame is rendered
+  td::int32 source_pix_height() const;
+  td::int32 source_pix_width() const;
+
+ private:
+  friend class AnimationPlayer;
+
+  double frame_duration() const;
+  bool is_next_frame_ready() const;
+  // switches to the next frame, if it is rendered; returns true, if the frame is changed
+  bool advance();
+  // starts rendering of the following frames, if they are missing and nothing is being rendered now
+  void request_frames();
+  void set_frame(size_t frame_id, std::shared_ptr<DecodedImage> frame);
+
+  std::shared_ptr<AnimationSource> source_;
+  std::shared_ptr<AnimationFramesJob> job_;
+  std::vector<std::shared_ptr<DecodedImage>> frames_;
+  size_t current_frame_{0};
+  bool is_failed_{false};
+
+  // state of the playback
+  bool is_drawn_{false};
+  td::Timestamp next_frame_at_;
+};
+
+// drives animations of visible stickers. An animation moves to the next frame only after its current frame was drawn
+// by an active window, so animations which are offscreen or in inactive windows are paused. Frame rate of all
+// animations is lowered together, so that drawing and rendering of frames fits into the CPU budget
+class AnimationPlayer {
+ public:
+  struct Stats {
+    size_t playing{0};
+    size_t frames_size{0};
+    double frame_cost{0};
+    double min_frame_interval{0};
+  };
+
+  // animations of the same sticker of the same size share frames
+  std::shared_ptr<StickerAnimation> get_animation(const std::string &path, td::int32 max_pix_height,
+                                                  td::int32 max_pix_width);
+
+  // the current frame of the animation is shown on the screen
+  void set_drawn(std::shared_ptr<StickerAnimation> animation);
+
+  // advances animations, which are due; returns true, if some frames were changed and windows must be redrawn
+  bool tick();
+  td::Timestamp wakeup_at() const;
+
+  // percent of one core, which can be spent on animations; 0 disables animations, only the first frames are shown
+  void set_cpu_budget(td::int32 percent) {
+    cpu_budget_ = percent * 0.01;
+  }
+  bool is_enabled() const {
+    return cpu_budget_ > 0;
+  }
+  void add_render_cost(double seconds_per_frame);
+  void add_draw_cost(double seconds);
+
+  // total size of rendered frames kept to be shown again; above it, frames are dropped after they are shown
+  void set_max_frames_size(size_t max_frames_size) {
+    max_frames_size_ = max_frames_size;
+  }
+  bool is_over_frames_budget() const {
+    return stats_.frames_size > max_frames_size_;
+  }
+  void add_frames_size(size_t size) {
+    stats_.frames_size += size;
+  }
+  void remove_frames_size(size_t size) {
+    stats_.frames_size -= size;
+  }
+
+  const Stats &stats() const {
+    return stats_;
+  }
+
+ private:
+  double frame_cost() const;
+  double min_frame_interval() const;
+
+  std::map<std::string, std::weak_ptr<StickerAnimation>> animations_;
+  std::vector<std::weak_ptr<StickerAnimation>> drawn_;
+  double cpu_budget_{0.25};
+  double render_cost_{0};
+  double draw_cost_{0};
+  size_t max_frames_size_{32 << 20};
+  Stats stats_;
+};
+
+AnimationPlayer &animation_player();
+
+}  // namespace windows
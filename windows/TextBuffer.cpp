@@ -0,0 +1,135 @@
+#include "TextBuffer.hpp"
+
+#include "td/utils/logging.h"
+
+#include <algorithm>
+#include <cstring>
+
+namespace windows {
+
+void TextBuffer::assign(td::Slice text) {
+  data_ = text.str();
+  gap_begin_ = gap_end_ = data_.size();
+  breaks_before_gap_.clear();
+  breaks_after_gap_.clear();
+  for (size_t i = 0; i < data_.size(); i++) {
+    if (data_[i] == '\n') {
+      breaks_before_gap_.push_back(i);
+    }
+  }
+}
+
+void TextBuffer::insert(size_t pos, td::Slice text) {
+  if (text.empty()) {
+    return;
+  }
+  move_gap(pos);
+  reserve_gap(text.size());
+  std::memcpy(&data_[gap_begin_], text.data(), text.size());
+  for (size_t i = 0; i < text.size(); i++) {
+    if (text[i] == '\n') {
+      breaks_before_gap_.push_back(gap_begin_ + i);
+    }
+  }
+  gap_begin_ += text.size();
+}
+
+void TextBuffer::erase(size_t pos, size_t len) {
+  if (len == 0) {
+    return;
+  }
+  CHECK(pos + len <= size());
+  move_gap(pos);
+  auto text_size = size();
+  while (!breaks_after_gap_.empty() && text_size - breaks_after_gap_.back() < pos + len) {
+    breaks_after_gap_.pop_back();
+  }
+  gap_end_ += len;
+}
+
+std::string TextBuffer::str() const {
+  std::string res;
+  res.reserve(size());
+  res.append(data_, 0, gap_begin_);
+  res.append(data_, gap_end_, std::string::npos);
+  return res;
+}
+
+td::Slice TextBuffer::text_before(size_t pos) {
+  move_gap(pos);
+  return td::Slice(data_.data(), gap_begin_);
+}
+
+td::Slice TextBuffer::text_after(size_t pos) {
+  move_gap(pos);
+  return td::Slice(data_.data() + gap_end_, data_.size() - gap_end_);
+}
+
+size_t TextBuffer::line_begin(size_t pos) const {
+  if (pos <= gap_begin_) {
+    auto it = std::lower_bound(breaks_before_gap_.begin(), breaks_before_gap_.end(), pos);
+    return it == breaks_before_gap_.begin() ? 0 : *(it - 1) + 1;
+  }
+  auto text_size = size();
+  // the break before pos, which is the farthest from the end of the text
+  auto it = std::upper_bound(breaks_after_gap_.begin(), breaks_after_gap_.end(), text_size - pos);
+  if (it != breaks_after_gap_.end()) {
+    return text_size - *it + 1;
+  }
+  return breaks_before_gap_.empty() ? 0 : breaks_before_gap_.back() + 1;
+}
+
+size_t TextBuffer::line_end(size_t pos) const {
+  if (pos < gap_begin_) {
+    auto it = std::lower_bound(breaks_before_gap_.begin(), breaks_before_gap_.end(), pos);
+    if (it != breaks_before_gap_.end()) {
+      return *it;
+    }
+  }
+  auto text_size = size();
+  // the break at or after pos, which is the closest to pos
+  auto it = std::upper_bound(breaks_after_gap_.begin(), breaks_after_gap_.end(), text_size - pos);
+  if (it != breaks_after_gap_.begin()) {
+    return text_size - *(it - 1);
+  }
+  return text_size;
+}
+
+void TextBuffer::move_gap(size_t pos) {
+  CHECK(pos <= size());
+  auto text_size = size();
+  if (pos < gap_begin_) {
+    auto len = gap_begin_ - pos;
+    std::memmove(&data_[gap_end_ - len], &data_[pos], len);
+    while (!breaks_before_gap_.empty() && breaks_before_gap_.back() >= pos) {
+      breaks_after_gap_.push_back(text_size - breaks_before_gap_.back());
+      breaks_before_gap_.pop_back();
+    }
+    gap_begin_ -= len;
+    gap_end_ -= len;
+  } else if (pos > gap_begin_) {
+    auto len = pos - gap_begin_;
+    std::memmove(&data_[gap_begin_], &data_[gap_end_], len);
+    while (!breaks_after_gap_.empty() && text_size - breaks_after_gap_.back() < pos) {
+      breaks_before_gap_.push_back(text_size - breaks_after_gap_.back());
+      breaks_after_gap_.pop_back();
+    }
+    gap_begin_ += len;
+    gap_end_ += len;
+  }
+}
+
+void TextBuffer::reserve_gap(size_t len) {
+  if (gap_end_ - gap_begin_ >= len) {
+    return;
+  }
+  auto text_after_gap = data_.size() - gap_end_;
+  auto new_capacity = std::max(data_.size() * 2, size() + len + 16);
+  std::string new_data(new_capacity, '\0');
+  std::memcpy(&new_data[0], data_.data(), gap_begin_);
+  std::memcpy(&new_data[new_capacity - text_after_gap], data_.data() + gap_end_, text_after_gap);
+  data_ = std::move(new_data);
+  gap_end_ = new_capacity - text_after_gap;
+}
+
+}  // namespace windows
@@ -0,0 +1,60 @@
+#pragma once
+
+#include "td/utils/common.h"
+#include "td/utils/Slice.h"
+
+#include <string>
+#include <vector>
+
+namespace windows {
+
+// text of an editor: a gap buffer with positions of line breaks. Edits near the previous edit and lookups of line
+// boundaries don't depend on the text size
+class TextBuffer {
+ public:
+  TextBuffer() = default;
+  explicit TextBuffer(td::Slice text) {
+    assign(text);
+  }
+
+  void assign(td::Slice text);
+
+  size_t size() const {
+    return data_.size() - (gap_end_ - gap_begin_);
+  }
+  bool empty() const {
+    return size() == 0;
+  }
+  char operator[](size_t pos) const {
+    return data_[pos < gap_begin_ ? pos : pos + (gap_end_ - gap_begin_)];
+  }
+
+  void insert(size_t pos, td::Slice text);
+  void erase(size_t pos, size_t len);
+
+  // a copy of the whole text; doesn't move the gap
+  std::string str() const;
+  // the text before or after pos; moves the gap to pos, so cursor moves and edits at the cursor don't move the text
+  td::Slice text_before(size_t pos);
+  td::Slice text_after(size_t pos);
+
+  // beginning of the line containing pos
+  size_t line_begin(size_t pos) const;
+  // position of the '\n' ending the line containing pos, or size() for the last line
+  size_t line_end(size_t pos) const;
+
+ private:
+  void move_gap(size_t pos);
+  void reserve_gap(size_t len);
+
+  std::string data_;
+  size_t gap_begin_{0};
+  size_t gap_end_{0};
+  // line breaks before the gap, as positions in the text; ascending
+  std::vector<size_t> breaks_before_gap_;
+  // line breaks after the gap, as distances from the end of the text, which don't change on edits at the gap;
+  // ascending, so the break next to the gap is the last one
+  std::vector<size_t> breaks_after_gap_;
+};
+
+}  // namespace windows
@@ -1,4 +1,5 @@
 #include "TextEdit.hpp"
+#include "TextLayoutCache.hpp"
 #include "td/utils/Status.h"
 #include "td/utils/StringBuilder.h"
 #include "td/utils/Variant.h"
@@ -27,7 +28,7 @@ bool TextEdit::move_cursor_right(bool allow_change_line) {
     if (text_[pos_] == '\n' && !allow_change_line) {
       return false;
     }
-    auto x = next_graphem(td::Slice(text_), pos_);
+    auto x = next_graphem(text_.text_after(pos_), 0);
     if (x.width == -2) {
       return false;
     }
@@ -51,7 +52,7 @@ bool TextEdit::move_cursor_left(bool allow_change_line) {
   }
 
   while (pos_ > 0) {
-    auto x = prev_graphem(td::Slice(text_), pos_);
+    auto x = prev_graphem(text_.text_before(pos_), pos_);
     if (x.width == -2) {
       return false;
     }
@@ -72,12 +73,21 @@ bool TextEdit::move_cursor_left(bool allow_change_line) {
   return true;
 }
 
-td::int32 TextEdit::go_to_beginning_of_line() {
-  td::int32 pos = 0;
-  while (move_cursor_left(false)) {
-    pos++;
+td::int32 TextEdit::column() {
+  auto saved_pos = pos_;
+  pos_ = text_.line_begin(pos_);
+  td::int32 res = 0;
+  while (pos_ < saved_pos && move_cursor_right(false)) {
+    res++;
   }
-  return pos;
+  pos_ = saved_pos;
+  return res;
+}
+
+td::int32 TextEdit::go_to_beginning_of_line() {
+  auto res = column();
+  pos_ = text_.line_begin(pos_);
+  return res;
 }
 
 td::int32 TextEdit::go_to_end_of_line() {
@@ -107,17 +117,22 @@ bool TextEdit::move_cursor_right(td::int32 cnt, bool allow_change_line) {
 }
 
 void TextEdit::move_cursor_down() {
-  auto c = go_to_beginning_of_line();
-  go_to_end_of_line();
-  move_cursor_right(true);
-  go_to_beginning_of_line();
+  auto line_end = text_.line_end(pos_);
+  if (line_end == text_.size()) {
+    return;
+  }
+  auto c = column();
+  pos_ = line_end + 1;
   move_cursor_right(c, false);
 }
 
 void TextEdit::move_cursor_up() {
-  auto c = go_to_beginning_of_line();
-  move_cursor_left(true);
-  go_to_beginning_of_line();
+  auto line_begin = text_.line_begin(pos_);
+  if (line_begin == 0) {
+    return;
+  }
+  auto c = column();
+  pos_ = text_.line_begin(line_begin - 1);
   move_cursor_right(c, false);
 }
 
@@ -127,7 +142,7 @@ bool TextEdit::move_cursor_prev_word(bool allow_change_line) {
   }
   bool is_first = true;
   do {
-    auto c = prev_graphem(td::Slice(text_), pos_);
+    auto c = prev_graphem(text_.text_before(pos_), pos_);
     if (!allow_change_line && (c.first_codepoint == '\n' || c.first_codepoint == '\r')) {
       return true;
     }
@@ -137,7 +152,7 @@ bool TextEdit::move_cursor_prev_word(bool allow_change_line) {
     is_first = false;
   } while (move_cursor_left(true));
   do {
-    auto c = prev_graphem(td::Slice(text_), pos_);
+    auto c = prev_graphem(text_.text_before(pos_), pos_);
     if (!allow_change_line && (c.first_codepoint == '\n' || c.first_codepoint == '\r')) {
       return true;
     }
@@ -153,7 +168,7 @@ bool TextEdit::move_cursor_next_word(bool allow_change_line) {
     return false;
   }
   do {
-    auto c = next_graphem(td::Slice(text_), pos_);
+    auto c = next_graphem(text_.text_after(pos_), 0);
     if (!allow_change_line && (c.first_codepoint == '\n' || c.first_codepoint == '\r')) {
       return true;
     }
@@ -165,7 +180,7 @@ bool TextEdit::move_cursor_next_word(bool allow_change_line) {
     return true;
   }
   do {
-    auto c = next_graphem(td::Slice(text_), pos_);
+    auto c = next_graphem(text_.text_after(pos_), 0);
     if (!allow_change_line && (c.first_codepoint == '\n' || c.first_codepoint == '\r')) {
       return true;
     }
@@ -177,8 +192,9 @@ bool TextEdit::move_cursor_next_word(bool allow_change_line) {
 }
 
 void TextEdit::insert_char(const char *ch) {
-  text_.insert(pos_, ch);
-  pos_ += strlen(ch);
+  td::Slice data(ch);
+  text_.insert(pos_, data);
+  pos_ += data.size();
 }
 
 void TextEdit::remove_next_char() {
@@ -200,7 +216,7 @@ void TextEdit::remove_prev_char() {
 
 void TextEdit::clear_before_cursor(bool allow_change_line) {
   if (allow_change_line) {
-    text_ = text_.substr(pos_);
+    text_.erase(0, pos_);
     pos_ = 0;
     return;
   }
@@ -208,19 +224,19 @@ void TextEdit::clear_before_cursor(bool allow_change_line) {
   while (pos_ > 0 && (text_[pos_ - 1] != '\n' && text_[pos_ - 1] != '\r')) {
     pos_--;
   }
-  text_ = text_.substr(0, pos_) + text_.substr(saved_pos);
+  text_.erase(pos_, saved_pos - pos_);
 }
 
 void TextEdit::clear_after_cursor(bool allow_change_line) {
   if (allow_change_line) {
-    text_ = text_.substr(0, pos_);
+    text_.erase(pos_, text_.size() - pos_);
     return;
   }
   auto saved_pos = pos_;
   while (pos_ < text_.size() && (text_[pos_] != '\n' && text_[pos_] != '\r')) {
     pos_++;
   }
-  text_ = text_.substr(0, saved_pos) + text_.substr(pos_);
+  text_.erase(saved_pos, pos_ - saved_pos);
   pos_ = saved_pos;
 }
 
@@ -228,7 +244,7 @@ void TextEdit::clear_word_before_cursor(bool allow_change_line) {
   auto saved_pos = pos_;
   move_cursor_prev_word(allow_change_line);
   if (pos_ != saved_pos) {
-    text_ = text_.substr(0, pos_) + text_.substr(saved_pos);
+    text_.erase(pos_, saved_pos - pos_);
   }
 }
 
@@ -236,39 +252,163 @@ void TextEdit::clear_word_after_cursor(bool allow_change_line) {
   auto saved_pos = pos_;
   move_cursor_next_word(allow_change_line);
   if (pos_ != saved_pos) {
-    text_ = text_.substr(0, saved_pos) + text_.substr(pos_);
+    text_.erase(saved_pos, pos_ - saved_pos);
     pos_ = saved_pos;
   }
 }
 
 std::string TextEdit::export_data() {
-  return text_;
+  return text_.str();
 }
 
 td::int32 TextEdit::render(WindowOutputter &rb, td::int32 width, bool is_selected, bool is_password,
                            SavedRenderedImagesDirectory *rendered_images, td::int32 pad_width, std::string pad_char) {
-  return render(rb, width, text_, pos_, std::vector<MarkupElement>(), is_selected, is_password, rendered_images,
-                pad_width, pad_char);
+  auto text_before = text_.text_before(pos_);
+  auto text_after = text_.text_after(pos_);
+  return render(rb, width, text_before, text_after, pos_, MarkupSpans(), is_selected, is_password, rendered_images,
+                pad_width, std::move(pad_char), false);
+}
+
+namespace {
+
+void apply_markup_to_outputter(WindowOutputter &rb, const MarkupSpan &span, bool is_start) {
+  switch (span.kind) {
+    case MarkupKind::FgColor:
+    case MarkupKind::FgColorRGB:
+      if (!is_start) {
+        rb.unset_fg_color();
+      } else if (span.kind == MarkupKind::FgColor) {
+        rb.set_fg_color(static_cast<Color>(span.payload));
+      } else {
+        rb.set_fg_color_rgb(ColorRGB(span.payload));
+      }
+      break;
+    case MarkupKind::BgColor:
+    case MarkupKind::BgColorRGB:
+      if (!is_start) {
+        rb.unset_bg_color();
+      } else if (span.kind == MarkupKind::BgColor) {
+        rb.set_bg_color(static_cast<Color>(span.payload));
+      } else {
+        rb.set_bg_color_rgb(ColorRGB(span.payload));
+      }
+      break;
+    case MarkupKind::Bold:
+      is_start ? rb.set_bold(span.payload != 0) : rb.unset_bold();
+      break;
+    case MarkupKind::Underline:
+      is_start ? rb.set_underline(span.payload != 0) : rb.unset_underline();
+      break;
+    case MarkupKind::Italic:
+      is_start ? rb.set_italic(span.payload != 0) : rb.unset_italic();
+      break;
+    case MarkupKind::Reverse:
+      is_start ? rb.set_reverse(span.payload != 0) : rb.unset_reverse();
+      break;
+    case MarkupKind::Strike:
+      is_start ? rb.set_strike(span.payload != 0) : rb.unset_strike();
+      break;
+    case MarkupKind::Blink:
+      is_start ? rb.set_blink(span.payload != 0) : rb.unset_blink();
+      break;
+    case MarkupKind::NoLb:
+    case MarkupKind::LeftPad:
+    case MarkupKind::Image:
+    case MarkupKind::ImageData:
+      UNREACHABLE();
+  }
 }
 
+}  // namespace
+
 class TextEditBuilder {
  public:
   TextEditBuilder(WindowOutputter &rb, td::int32 width, bool is_password, SavedRenderedImagesDirectory *images)
-      : rb_(rb), width_(width), is_password_(is_password) {
+      : rb_(rb), is_real_(rb.is_real()), width_(width), is_password_(is_password) {
     if (images) {
       old_images_ = std::move(images->old_images);
       images_ = std::move(images->new_images);
     }
   }
   ~TextEditBuilder() {
+    flush_run();
+  }
+  // consecutive printable ascii characters of the same style are written to the outputter with one call. Other
+  // graphemes are written one by one at the position computed here, because the backend can assign them another
+  // width, e.g. when widths are overridden in the config
+  void flush_run() {
+    if (run_size_ > 0) {
+      rb_.putstr_run(run_y_, run_x_, td::Slice(run_begin_, run_size_), run_width_);
+      if (layout_) {
+        record_run();
+      }
+      run_size_ = 0;
+    }
+  }
+  // calls to the outputter are recorded into the layout; offsets of runs are counted from the beginning of the text
+  void record_layout(TextLayout *layout, td::Slice text) {
+    layout_ = layout;
+    layout_text_ = text;
+  }
+  void record_run() {
+    TextLayout::Op op;
+    op.y = run_y_;
+    op.x = run_x_;
+    op.width = run_width_;
+    op.size = static_cast<td::uint32>(run_size_);
+    if (run_begin_ >= layout_text_.begin() && run_begin_ + run_size_ <= layout_text_.end()) {
+      op.type = TextLayout::Op::Type::Run;
+      op.begin = static_cast<td::uint32>(run_begin_ - layout_text_.begin());
+    } else {
+      op.type = TextLayout::Op::Type::PoolRun;
+      op.begin = static_cast<td::uint32>(layout_->pool.size());
+      layout_->pool.append(run_begin_, run_size_);
+    }
+    layout_->ops.push_back(op);
+  }
+  void record_op(TextLayout::Op::Type type, td::int32 y, td::int32 x, td::int32 width, td::uint32 begin) {
+    if (layout_) {
+      TextLayout::Op op;
+      op.type = type;
+      op.y = y;
+      op.x = x;
+      op.width = width;
+      op.begin = begin;
+      layout_->ops.push_back(op);
+    }
+  }
+  void add_to_run(td::Slice data, td::int32 width, bool is_ascii) {
+    if (!is_real_ || data.empty()) {
+      return;
+    }
+    if (run_size_ > 0 && run_is_ascii_ && is_ascii && run_y_ == cur_line_ && run_x_ + run_width_ == cur_line_pos_ &&
+        run_begin_ + run_size_ == data.data()) {
+      run_size_ += data.size();
+      run_width_ += width;
+      return;
+    }
+    flush_run();
+    run_begin_ = data.data();
+    run_size_ = data.size();
+    run_y_ = cur_line_;
+    run_x_ = cur_line_pos_;
+    run_width_ = width;
+    run_is_ascii_ = is_ascii;
   }
   void print_pad_left() {
     if (pad_left_.size() > 0) {
+      flush_run();
       pad_left_color_.visit(td::overloaded([&](const Color &c) { rb_.set_fg_color(c); },
                                            [&](const ColorRGB &c) { rb_.set_fg_color_rgb(c); }));
+      if (layout_) {
+        record_op(TextLayout::Op::Type::SetPadColor, 0, 0, 0, static_cast<td::uint32>(layout_->colors.size()));
+        layout_->colors.push_back(pad_left_color_);
+      }
       auto width = utf8_string_width(pad_left_);
       add_utf8(pad_left_, width, false);
+      flush_run();
       rb_.unset_fg_color();
+      record_op(TextLayout::Op::Type::UnsetPadColor, 0, 0, 0, 0);
     }
   }
   void cond_start_new_line() {
@@ -282,10 +422,15 @@ class TextEditBuilder {
     }
   }
   void start_new_line() {
+    flush_run();
     rb_.erase_yx(cur_line_, cur_line_pos_, width_ - cur_line_pos_);
+    record_op(TextLayout::Op::Type::Erase, cur_line_, cur_line_pos_, width_ - cur_line_pos_, 0);
     for (int i = 0; i < pad_width_; i++) {
       rb_.putstr_yx(cur_line_, width_ + i, pad_char_.c_str(), pad_char_.size());
     }
+    if (pad_width_ > 0) {
+      record_op(TextLayout::Op::Type::PadChars, cur_line_, 0, 0, 0);
+    }
     cur_line_++;
     cur_line_pos_ = 0;
 
@@ -304,10 +449,11 @@ class TextEditBuilder {
     }
 
     if (!is_password_) {
-      rb_.putstr_yx(cur_line_, cur_line_pos_, data.data(), data.size());
+      add_to_run(data, width, printable_ascii_prefix(data, 0) == data.size());
       cur_line_pos_ += width;
     } else {
-      rb_.putstr_yx(cur_line_, cur_line_pos_, "*", 1);
+      td::Slice star(password_stars_ + std::min<size_t>(cur_line_pos_, sizeof(password_stars_) - 2), 1);
+      add_to_run(star, 1, printable_ascii_prefix(star, 0) == 1);
       cur_line_pos_++;
     }
 
@@ -317,6 +463,32 @@ class TextEditBuilder {
     }
   }
 
+  // printable ascii characters, one column each; cursor_offset is position of the cursor in data or -1
+  void add_ascii(td::Slice data, size_t cursor_offset) {
+    while (data.size() > 0) {
+      if (soft_lb_ || is_password_ || cur_line_pos_ >= width_) {
+        if (nolb_ && !soft_lb_ && cur_line_pos_ >= width_) {
+          return;
+        }
+        add_utf8(data.substr(0, 1), 1, cursor_offset == 0);
+        data.remove_prefix(1);
+        cursor_offset = cursor_offset == 0 ? static_cast<size_t>(-1) : cursor_offset - 1;
+        continue;
+      }
+      auto size = std::min(data.size(), static_cast<size_t>(width_ - cur_line_pos_));
+      add_to_run(data.substr(0, size), static_cast<td::int32>(size), true);
+      if (cursor_offset < size) {
+        cursor_y_ = cur_line_;
+        cursor_x_ = cur_line_pos_ + static_cast<td::int32>(cursor_offset);
+        cursor_offset = static_cast<size_t>(-1);
+      } else if (cursor_offset != static_cast<size_t>(-1)) {
+        cursor_offset -= size;
+      }
+      cur_line_pos_ += static_cast<td::int32>(size);
+      data.remove_prefix(size);
+    }
+  }
+
   void pad_left(td::int32 size, bool has_cursor) {
     if (size < 0) {
       return;
@@ -415,6 +587,7 @@ class TextEditBuilder {
     if (nolb_) {
       return;
     }
+    flush_run();
     if (rb_.is_real()) {
       std::unique_ptr<RenderedImage> image;
 
@@ -433,7 +606,8 @@ class TextEditBuilder {
 
       cond_start_new_line();
       if (!image) {
-        image = rb_.render_image(render_height, std::min(width_, render_width), allow_pixel, path);
+        image = rb_.render_image(render_height, std::min(width_, render_width), image_height, image_width, allow_pixel,
+                                 path);
       }
       if (image) {
         rb_.transparent_rect(cur_line_, 0, image->height(), width_);
@@ -451,6 +625,7 @@ class TextEditBuilder {
 
   void install_photo_data(std::string data, td::int32 image_height, td::int32 image_width, td::int32 render_height,
                           td::int32 render_width, bool allow_pixel) {
+    flush_run();
     if (rb_.is_real()) {
       std::unique_ptr<RenderedImage> image;
 
@@ -471,7 +646,8 @@ class TextEditBuilder {
 
       cond_start_new_line();
       if (!image) {
-        image = rb_.render_image_data(render_height, std::min(width_, render_width), allow_pixel, data);
+        image = rb_.render_image_data(render_height, std::min(width_, render_width), image_height, image_width,
+                                      allow_pixel, data);
       }
       if (image) {
         rb_.transparent_rect(cur_line_, 0, image->height(), width_);
@@ -487,20 +663,51 @@ class TextEditBuilder {
     }
   }
 
-  void add_markup(const MarkupElement &me) {
-    if (me->apply_to_text_edit()) {
-      static_cast<MarkupElementTextEdit *>(me.get())->install(*this);
-    } else {
-      me->install(rb_);
+  // applies the start or the end of a markup span
+  void apply_markup(const MarkupSpans &markup, td::uint32 event) {
+    flush_run();
+    auto &span = markup[MarkupSpans::event_span(event)];
+    bool is_start = MarkupSpans::is_event_start(event);
+    switch (span.kind) {
+      case MarkupKind::NoLb:
+        if (is_start) {
+          install_nolb(span.payload != 0);
+        } else {
+          uninstall_nolb();
+        }
+        break;
+      case MarkupKind::LeftPad: {
+        auto &pad = markup.left_pad(span);
+        set_left_pad(is_start ? pad.pad : std::string(), pad.color);
+      } break;
+      case MarkupKind::Image:
+      case MarkupKind::ImageData:
+        if (is_start) {
+          auto &image = markup.image(span);
+          if (span.kind == MarkupKind::Image) {
+            install_photo(image.source, image.image_height, image.image_width, image.rendered_height,
+                          image.rendered_width, image.allow_pixel);
+          } else {
+            install_photo_data(image.source, image.image_height, image.image_width, image.rendered_height,
+                               image.rendered_width, image.allow_pixel);
+          }
+        }
+        break;
+      default:
+        apply_markup_to_outputter(rb_, span, is_start);
+        record_op(TextLayout::Op::Type::Markup, 0, 0, 0, event);
     }
   }
 
-  void del_markup(const MarkupElement &me) {
-    if (me->apply_to_text_edit()) {
-      static_cast<MarkupElementTextEdit *>(me.get())->uninstall(*this);
+  // the whole text is shown reversed
+  void set_selected(bool value) {
+    flush_run();
+    if (value) {
+      rb_.set_reverse(true);
     } else {
-      me->uninstall(rb_);
+      rb_.unset_reverse();
     }
+    record_op(TextLayout::Op::Type::Selection, 0, 0, 0, value ? 1 : 0);
   }
 
   td::int32 height() const {
@@ -555,6 +762,7 @@ class TextEditBuilder {
 
  private:
   WindowOutputter &rb_;
+  bool is_real_;
   td::int32 width_;
   td::int32 pad_width_{0};
   std::string pad_char_;
@@ -566,6 +774,16 @@ class TextEditBuilder {
   td::int32 nolb_{0};
   bool soft_lb_{false};
 
+  const char *run_begin_{nullptr};
+  size_t run_size_{0};
+  td::int32 run_y_{0};
+  td::int32 run_x_{0};
+  td::int32 run_width_{0};
+  bool run_is_ascii_{false};
+  TextLayout *layout_{nullptr};
+  td::Slice layout_text_;
+  static constexpr char password_stars_[] = "****************************************************************";
+
   std::string pad_left_;
   td::Variant<Color, ColorRGB> pad_left_color_{Color::White};
 
@@ -573,50 +791,175 @@ class TextEditBuilder {
   std::map<std::string, std::vector<std::unique_ptr<RenderedImage>>> images_;
 };
 
-td::int32 TextEdit::render(WindowOutputter &rb, td::int32 width, td::Slice text, size_t pos,
-                           const std::vector<MarkupElement> &input_markup, bool is_selected, bool is_password,
-                           SavedRenderedImagesDirectory *rendered_images, td::int32 pad_width, std::string pad_char) {
-  struct Action {
-    Action(MarkupElementPos pos, bool enable, MarkupElement el) : pos(pos), enable(enable), el(el) {
-    }
-    MarkupElementPos pos;
-    bool enable;
-    MarkupElement el;
-    bool operator<(const Action &other) const {
-      return pos < other.pos || (pos == other.pos && !enable && other.enable);
+namespace {
+
+void combine_hash(td::uint64 &hash, td::uint64 value) {
+  hash = (hash ^ value) * 0x100000001b3ULL;
+}
+
+// returns false, if the layout can't be cached
+bool make_layout_key(TextLayoutCache::Key &key, td::int32 width, td::Slice text, size_t pos,
+                     const MarkupSpans &markup, bool is_selected, bool is_password, td::int32 pad_width,
+                     const std::string &pad_char) {
+  td::uint64 hash = 0xcbf29ce484222325ULL;
+  // values of colors and flags aren't hashed, because they are taken from the markup, when the layout is replayed
+  for (size_t i = 0; i < markup.size(); i++) {
+    auto &span = markup[i];
+    combine_hash(hash, span.first_pos);
+    combine_hash(hash, span.first_idx);
+    combine_hash(hash, span.last_pos);
+    combine_hash(hash, span.last_idx);
+    combine_hash(hash, static_cast<td::uint64>(span.kind));
+    switch (span.kind) {
+      case MarkupKind::NoLb:
+        combine_hash(hash, span.payload);
+        break;
+      case MarkupKind::LeftPad: {
+        auto &pad = markup.left_pad(span);
+        combine_hash(hash, std::hash<std::string>()(pad.pad));
+        pad.color.visit(td::overloaded([&](const Color &c) { combine_hash(hash, static_cast<td::uint64>(c)); },
+                                       [&](const ColorRGB &c) { combine_hash(hash, (1ULL << 32) | c.color); }));
+      } break;
+      case MarkupKind::Image:
+      case MarkupKind::ImageData:
+        // height of the image depends on the blitter and on the known size of the image
+        return false;
+      default:
+        break;
     }
-  };
-  std::vector<Action> actions;
-  for (auto &m : input_markup) {
-    actions.emplace_back(m->first_pos(), true, m);
-    actions.emplace_back(m->last_pos(), false, m);
   }
-  if (is_selected) {
-    auto reverse_markup =
-        std::make_shared<MarkupElementReverse>(MarkupElementPos(0, 0), MarkupElementPos(text.size() + 1, 0), true);
-    actions.emplace_back(reverse_markup->first_pos(), true, reverse_markup);
-    actions.emplace_back(reverse_markup->last_pos(), false, reverse_markup);
+  combine_hash(hash, is_selected);
+  combine_hash(hash, is_password);
+  combine_hash(hash, pad_width);
+  combine_hash(hash, std::hash<std::string>()(pad_char));
+
+  key.text_hash = td::crc64(text);
+  key.markup_hash = hash;
+  key.text_size = text.size();
+  key.pos = pos;
+  key.width = width;
+  return true;
+}
+
+void replay_layout(WindowOutputter &rb, const TextLayout &layout, td::int32 width, td::Slice text,
+                   const MarkupSpans &markup, td::int32 pad_width, const std::string &pad_char) {
+  for (auto &op : layout.ops) {
+    switch (op.type) {
+      case TextLayout::Op::Type::Run:
+        rb.putstr_run(op.y, op.x, text.substr(op.begin, op.size), op.width);
+        break;
+      case TextLayout::Op::Type::PoolRun:
+        rb.putstr_run(op.y, op.x, td::Slice(layout.pool).substr(op.begin, op.size), op.width);
+        break;
+      case TextLayout::Op::Type::Erase:
+        rb.erase_yx(op.y, op.x, op.width);
+        break;
+      case TextLayout::Op::Type::PadChars:
+        for (td::int32 i = 0; i < pad_width; i++) {
+          rb.putstr_yx(op.y, width + i, pad_char.c_str(), pad_char.size());
+        }
+        break;
+      case TextLayout::Op::Type::Markup:
+        apply_markup_to_outputter(rb, markup[MarkupSpans::event_span(op.begin)], MarkupSpans::is_event_start(op.begin));
+        break;
+      case TextLayout::Op::Type::Selection:
+        if (op.begin) {
+          rb.set_reverse(true);
+        } else {
+          rb.unset_reverse();
+        }
+        break;
+      case TextLayout::Op::Type::SetPadColor:
+        layout.colors[op.begin].visit(td::overloaded([&](const Color &c) { rb.set_fg_color(c); },
+                                                     [&](const ColorRGB &c) { rb.set_fg_color_rgb(c); }));
+        break;
+      case TextLayout::Op::Type::UnsetPadColor:
+        rb.unset_fg_color();
+        break;
+    }
   }
+}
+
+}  // namespace
+
+td::int32 TextEdit::render(WindowOutputter &rb, td::int32 width, td::Slice text, size_t pos,
+                           const std::vector<MarkupElement> &markup, bool is_selected, bool is_password,
+                           SavedRenderedImagesDirectory *rendered_images, td::int32 pad_width, std::string pad_char) {
+  return render(rb, width, text, pos, MarkupSpans(markup), is_selected, is_password, rendered_images, pad_width,
+                std::move(pad_char));
+}
+
+td::int32 TextEdit::render(WindowOutputter &rb, td::int32 width, td::Slice text, size_t pos, const MarkupSpans &markup,
+                           bool is_selected, bool is_password, SavedRenderedImagesDirectory *rendered_images,
+                           td::int32 pad_width, std::string pad_char) {
+  return render(rb, width, text, td::Slice(), pos, markup, is_selected, is_password, rendered_images, pad_width,
+                std::move(pad_char), true);
+}
 
-  std::sort(actions.begin(), actions.end());
-  size_t actions_pos = 0;
+td::int32 TextEdit::render(WindowOutputter &rb, td::int32 width, td::Slice text_before, td::Slice text_after,
+                           size_t pos, const MarkupSpans &markup, bool is_selected, bool is_password,
+                           SavedRenderedImagesDirectory *rendered_images, td::int32 pad_width, std::string pad_char,
+                           bool allow_layout_cache) {
+  auto &events = markup.events();
+  size_t events_pos = 0;
+
+  // runs of a cached layout point into the text, so it must be contiguous
+  CHECK(!allow_layout_cache || text_after.empty());
+  TextLayoutCache::Key layout_key;
+  bool use_layout_cache =
+      allow_layout_cache && text_layout_cache().is_enabled() &&
+      make_layout_key(layout_key, width, text_before, pos, markup, is_selected, is_password, pad_width, pad_char);
+  if (use_layout_cache) {
+    auto layout = text_layout_cache().get(layout_key, rb.is_real());
+    if (layout) {
+      if (rb.is_real()) {
+        replay_layout(rb, *layout, width, text_before, markup, pad_width, pad_char);
+      }
+      rb.cursor_move_yx(layout->cursor_y, layout->cursor_x, WindowOutputter::CursorShape::Block);
+      return layout->height;
+    }
+  }
 
+  TextLayout layout;
   TextEditBuilder builder(rb, width, is_password, rendered_images);
   builder.set_pad(pad_width, pad_char);
+  if (use_layout_cache && rb.is_real()) {
+    layout.has_ops = true;
+    builder.record_layout(&layout, text_before);
+  }
+  if (is_selected) {
+    builder.set_selected(true);
+  }
 
+  auto text_size = text_before.size() + text_after.size();
+  // the part of the text containing cur_pos and its position in the text
+  td::Slice part = text_before;
+  size_t part_pos = 0;
   size_t cur_pos = 0;
-  while (cur_pos <= text.size()) {
-    while (actions_pos < actions.size() && actions[actions_pos].pos.pos <= cur_pos) {
-      if (actions[actions_pos].enable) {
-        builder.add_markup(actions[actions_pos++].el);
-      } else {
-        builder.del_markup(actions[actions_pos++].el);
-      }
+  while (cur_pos <= text_size) {
+    while (events_pos < events.size() && markup.event_pos(events[events_pos]) <= cur_pos) {
+      builder.apply_markup(markup, events[events_pos++]);
     }
-    if (cur_pos == text.size()) {
+    if (cur_pos == text_size) {
       break;
     }
-    auto x = next_graphem(text, cur_pos);
+    if (cur_pos == part_pos + part.size()) {
+      part = text_after;
+      part_pos = cur_pos;
+    }
+    auto part_offset = cur_pos - part_pos;
+    auto ascii_size = printable_ascii_prefix(part, part_offset);
+    if (ascii_size > 0) {
+      // the run stops at the next markup change
+      if (events_pos < events.size()) {
+        ascii_size = std::min<size_t>(ascii_size, markup.event_pos(events[events_pos]) - cur_pos);
+      }
+      builder.add_ascii(part.substr(part_offset, ascii_size),
+                        pos >= cur_pos ? pos - cur_pos : static_cast<size_t>(-1));
+      cur_pos += ascii_size;
+      continue;
+    }
+    auto x = next_graphem(part, part_offset);
     if (x.first_codepoint >= LEFT_ALIGN_BLOCK_START && x.first_codepoint <= LEFT_ALIGN_BLOCK_END) {
       builder.pad_left(x.first_codepoint - LEFT_ALIGN_BLOCK_START, cur_pos == pos);
     } else if (x.first_codepoint >= RIGHT_ALIGN_BLOCK_START && x.first_codepoint <= RIGHT_ALIGN_BLOCK_END) {
@@ -636,40 +979,23 @@ td::int32 TextEdit::render(WindowOutputter &rb, td::int32 width, td::Slice text,
     }
     cur_pos += x.data.size();
   }
-  builder.complete(pos == text.size(), rendered_images);
-  while (actions_pos < actions.size()) {
-    if (actions[actions_pos].enable) {
-      builder.add_markup(actions[actions_pos++].el);
-    } else {
-      builder.del_markup(actions[actions_pos++].el);
-    }
+  builder.complete(pos == text_size, rendered_images);
+  while (events_pos < events.size()) {
+    builder.apply_markup(markup, events[events_pos++]);
+  }
+  if (is_selected) {
+    builder.set_selected(false);
   }
   rb.cursor_move_yx(builder.cursor_y(), builder.cursor_x(), WindowOutputter::CursorShape::Block);
+  if (use_layout_cache) {
+    builder.flush_run();
+    builder.record_layout(nullptr, td::Slice());
+    layout.height = builder.height() - 1;
+    layout.cursor_y = builder.cursor_y();
+    layout.cursor_x = builder.cursor_x();
+    text_layout_cache().put(layout_key, std::move(layout));
+  }
   return builder.height() - 1;
 }
 
-void MarkupElementLeftPad::install(TextEditBuilder &rb) const {
-  rb.set_left_pad(pad_, color_);
-}
-void MarkupElementLeftPad::uninstall(TextEditBuilder &rb) const {
-  rb.set_left_pad("", color_);
-}
-
-void MarkupElementNoLb::install(TextEditBuilder &rb) const {
-  rb.install_nolb(value_);
-}
-void MarkupElementNoLb::uninstall(TextEditBuilder &rb) const {
-  rb.uninstall_nolb();
-}
-void MarkupElementImage::install(TextEditBuilder &rb) const {
-  rb.install_photo(image_path_, image_height_, image_width_, rendered_height_, rendered_width_, allow_pixel_);
-}
-void MarkupElementImage::uninstall(TextEditBuilder &rb) const {
-}
-void MarkupElementImageData::install(TextEditBuilder &rb) const {
-  rb.install_photo_data(image_data_, image_height_, image_width_, rendered_height_, rendered_width_, allow_pixel_);
-}
-void MarkupElementImageData::uninstall(TextEditBuilder &rb) const {
-}
-
 }  // namespace windows
@@ -2,6 +2,7 @@
 
 #include "Markup.hpp"
 #include "Output.hpp"
+#include "TextBuffer.hpp"
 
 #include "td/utils/int_types.h"
 #include "td/utils/Slice.h"
@@ -37,11 +38,11 @@ class TextEdit {
  public:
   TextEdit() {
   }
-  TextEdit(std::string text) : text_(std::move(text)) {
+  TextEdit(std::string text) : text_(text) {
     pos_ = text_.size();
   }
   void replace_text(std::string text) {
-    text_ = text;
+    text_.assign(text);
     pos_ = text_.size();
   }
   void clear() {
@@ -69,6 +70,10 @@ class TextEdit {
   void clear_word_before_cursor(bool allow_change_line);
   void clear_word_after_cursor(bool allow_change_line);
 
+  static td::int32 render(WindowOutputter &rb, td::int32 width, td::Slice text, size_t pos,
+                          const MarkupSpans &markup, bool is_selected, bool is_password,
+                          SavedRenderedImagesDirectory *rendered_images = nullptr, td::int32 pad_width = 0,
+                          std::string pad_char = " ");
   static td::int32 render(WindowOutputter &rb, td::int32 width, td::Slice text, size_t pos,
                           const std::vector<MarkupElement> &markup, bool is_selected, bool is_password,
                           SavedRenderedImagesDirectory *rendered_images = nullptr, td::int32 pad_width = 0,
@@ -78,11 +83,21 @@ class TextEdit {
                    std::string pad_char = " ");
 
   bool is_empty() const {
-    return text_.size() == 0;
+    return text_.empty();
   }
 
  private:
-  std::string text_;
+  // number of cursor moves from the beginning of the line
+  td::int32 column();
+
+  // the text is text_before followed by text_after, so that the text of the editor is rendered without moving its gap.
+  // The text of the editor changes on every key press, so its layouts aren't cached
+  static td::int32 render(WindowOutputter &rb, td::int32 width, td::Slice text_before, td::Slice text_after, size_t pos,
+                          const MarkupSpans &markup, bool is_selected, bool is_password,
+                          SavedRenderedImagesDirectory *rendered_images, td::int32 pad_width, std::string pad_char,
+                          bool allow_layout_cache);
+
+  TextBuffer text_;
   size_t pos_{0};
 };
 
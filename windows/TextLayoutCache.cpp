@@ -0,0 +1,55 @@
+#include "TextLayoutCache.hpp"
+
+namespace windows {
+
+const TextLayout *TextLayoutCache::get(const Key &key, bool need_ops) {
+  auto it = entries_.find(key);
+  if (it == entries_.end() || (need_ops && !it->second->second.has_ops)) {
+    stats_.misses++;
+    return nullptr;
+  }
+  stats_.hits++;
+  lru_.splice(lru_.begin(), lru_, it->second);
+  return &it->second->second;
+}
+
+void TextLayoutCache::put(const Key &key, TextLayout layout) {
+  if (!is_enabled()) {
+    return;
+  }
+  auto size = layout.size_in_bytes();
+  auto it = entries_.find(key);
+  if (it != entries_.end()) {
+    stats_.size -= it->second->second.size_in_bytes();
+    it->second->second = std::move(layout);
+    lru_.splice(lru_.begin(), lru_, it->second);
+  } else {
+    lru_.emplace_front(key, std::move(layout));
+    entries_.emplace(key, lru_.begin());
+  }
+  stats_.size += size;
+  evict();
+}
+
+void TextLayoutCache::set_max_size(size_t max_size) {
+  stats_.max_size = max_size;
+  evict();
+}
+
+void TextLayoutCache::evict() {
+  while (stats_.size > stats_.max_size && !lru_.empty()) {
+    auto &entry = lru_.back();
+    stats_.size -= entry.second.size_in_bytes();
+    stats_.evictions++;
+    entries_.erase(entry.first);
+    lru_.pop_back();
+  }
+  stats_.entries = entries_.size();
+}
+
+TextLayoutCache &text_layout_cache() {
+  static TextLayoutCache instance;
+  return instance;
+}
+
+}  // namespace windows
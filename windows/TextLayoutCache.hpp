@@ -0,0 +1,105 @@
+#pragma once
+
+#include "Output.hpp"
+
+#include "td/utils/common.h"
+#include "td/utils/Variant.h"
+
+#include <list>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace windows {
+
+// result of TextEdit::render: the height and the calls to the outputter, so that the same text is drawn again
+// without segmentation and line wrapping
+struct TextLayout {
+  struct Op {
+    enum class Type : td::uint8 { Run, PoolRun, Erase, PadChars, Markup, Selection, SetPadColor, UnsetPadColor };
+    Type type;
+    td::int32 y{0};
+    td::int32 x{0};
+    td::int32 width{0};
+    // Run: bytes of the text; PoolRun: bytes of the pool; Markup: markup event; Selection: 1 to set, 0 to unset;
+    // SetPadColor: index of the color
+    td::uint32 begin{0};
+    td::uint32 size{0};
+  };
+
+  td::int32 height{0};
+  td::int32 cursor_y{-1};
+  td::int32 cursor_x{-1};
+  // height probes don't record the calls, such layouts can be used only by other height probes
+  bool has_ops{false};
+  std::vector<Op> ops;
+  // text of runs, which aren't parts of the rendered text, e.g. left pads
+  std::string pool;
+  std::vector<td::Variant<Color, ColorRGB>> colors;
+
+  size_t size_in_bytes() const {
+    return sizeof(TextLayout) + ops.capacity() * sizeof(Op) + pool.capacity() +
+           colors.capacity() * sizeof(td::Variant<Color, ColorRGB>);
+  }
+};
+
+// LRU of layouts of rendered texts. Used only from the main thread
+class TextLayoutCache {
+ public:
+  struct Key {
+    td::uint64 text_hash;
+    // hash of positions and layout properties of markup elements, of selection and of pad
+    td::uint64 markup_hash;
+    size_t text_size;
+    size_t pos;
+    td::int32 width;
+
+    bool operator==(const Key &other) const {
+      return text_hash == other.text_hash && markup_hash == other.markup_hash && text_size == other.text_size &&
+             pos == other.pos && width == other.width;
+    }
+  };
+
+  struct Stats {
+    td::int64 hits{0};
+    td::int64 misses{0};
+    td::int64 evictions{0};
+    size_t entries{0};
+    size_t size{0};
+    size_t max_size{0};
+  };
+
+  // returns nullptr, if there is no layout or if it has no calls and they are needed; the layout is valid till the
+  // next put
+  const TextLayout *get(const Key &key, bool need_ops);
+  void put(const Key &key, TextLayout layout);
+
+  bool is_enabled() const {
+    return stats_.max_size > 0;
+  }
+  void set_max_size(size_t max_size);
+  const Stats &stats() const {
+    return stats_;
+  }
+
+ private:
+  struct KeyHash {
+    size_t operator()(const Key &key) const {
+      return static_cast<size_t>(key.text_hash ^ (key.markup_hash * 31) ^ (static_cast<td::uint64>(key.width) << 48) ^
+                                 key.pos);
+    }
+  };
+
+  void evict();
+
+  using Entry = std::pair<Key, TextLayout>;
+  // most recently used first
+  std::list<Entry> lru_;
+  std::unordered_map<Key, std::list<Entry>::iterator, KeyHash> entries_;
+  Stats stats_{0, 0, 0, 0, 0, 8 << 20};
+};
+
+TextLayoutCache &text_layout_cache();
+
+}  // namespace windows
@@ -37,6 +37,7 @@ void Window::render_wrap(WindowOutputter &rb, bool force) {
 
   set_refreshed();
   render(rb, force);
+  has_pending_images_ = rb.has_pending_images();
   render_subwindows(rb, force);
 
   saved_cursor_y_ = rb.local_cursor_y();
@@ -66,8 +66,9 @@ class Window {
     }
     need_refresh_ = true;
     if (refreshed_at_) {
-      if (refreshed_at_.in() >= -0.1) {
-        refresh_at_ = td::Timestamp::at(refresh_at_.at() + 0.1);
+      auto interval = refresh_rate().interval();
+      if (refreshed_at_.in() >= -interval) {
+        refresh_at_ = td::Timestamp::at(refreshed_at_.at() + interval);
       } else {
         refresh_at_ = td::Timestamp::now();
       }
@@ -216,6 +217,17 @@ class Window {
     }
   }
 
+  // called when some images were decoded or animations were advanced, windows which were rendered with image
+  // placeholders or animations must be redrawn
+  void refresh_pending_images_rec() {
+    if (has_pending_images_) {
+      set_need_refresh();
+    }
+    for (auto &w : subwindows_) {
+      w->refresh_pending_images_rec();
+    }
+  }
+
   void set_backend_window(std::unique_ptr<BackendWindow> window) {
     backend_window_ = std::move(window);
     if (backend_window_) {
@@ -246,6 +258,7 @@ class Window {
   td::int32 y_offset_{0};
   td::int32 x_offset_{0};
   std::atomic<bool> need_refresh_{true};
+  bool has_pending_images_{false};
 
   td::int32 saved_cursor_y_{0};
   td::int32 saved_cursor_x_{0};
@@ -7,6 +7,10 @@
 #include "td/utils/int_types.h"
 #include "td/utils/unicode.h"
 #include "td/utils/logging.h"
+#include <array>
+#include <atomic>
+#include <cstring>
+#include <map>
 
 namespace {
 const unsigned char *next_utf8(const unsigned char *ptr, const unsigned char *end, td::uint32 &code) {
@@ -53,50 +57,140 @@ const unsigned char *next_utf8(const unsigned char *ptr, const unsigned char *en
   }
 }
 
-bool wide_emojis{false};
-std::vector<UnicodeWidthBlock> override_blocks;
+bool is_control_char(td::int32 op) {
+  return (op >= LEFT_ALIGN_BLOCK_START && op <= LEFT_ALIGN_BLOCK_END) ||
+         (op >= RIGHT_ALIGN_BLOCK_START && op <= RIGHT_ALIGN_BLOCK_END) || (op == SOFT_LINE_BREAK_CP);
+}
+
+bool is_regional_indicator(td::int32 value) {
+  return value >= 0x1f1e6 && value <= 0x1f1ff;
+}
+
+constexpr td::int32 MaxCodepoint = 0x10ffff;
+
+// properties of all codepoints with overrides from the config applied. The bmp is stored as a two-level table with
+// equal pages shared, other planes as sorted ranges of codepoints with equal properties
+class CodepointWidthTable {
+ public:
+  // width + 1 in the lower bits
+  enum Flags : td::uint8 { WidthMask = 3, MakesWide = 4, RegionalIndicator = 8, ControlChar = 16 };
+
+  CodepointWidthTable(bool wide_emojis, std::vector<UnicodeWidthBlock> blocks) {
+    std::sort(blocks.begin(), blocks.end(),
+              [&](const UnicodeWidthBlock &l, const UnicodeWidthBlock &r) { return l.begin < r.begin; });
+    auto calc = [&](td::int32 cp) -> td::uint8 {
+      td::uint8 res = 0;
+      if (wide_emojis && cp == 0xFE0F) {
+        res |= MakesWide;
+      }
+      if (is_regional_indicator(cp)) {
+        res |= RegionalIndicator;
+      }
+      if (is_control_char(cp)) {
+        res |= ControlChar;
+      }
+      return static_cast<td::uint8>(res | (calc_width(blocks, cp) + 1));
+    };
+
+    std::map<std::array<td::uint8, 256>, td::uint16> page_ids;
+    for (td::int32 page = 0; page < 256; page++) {
+      std::array<td::uint8, 256> values;
+      for (td::int32 i = 0; i < 256; i++) {
+        values[i] = calc(page * 256 + i);
+      }
+      auto it = page_ids.emplace(values, static_cast<td::uint16>(pages_.size())).first;
+      if (it->second == pages_.size()) {
+        pages_.push_back(values);
+      }
+      page_index_[page] = it->second;
+    }
+
+    for (td::int32 cp = 0x10000; cp <= MaxCodepoint; cp++) {
+      auto value = calc(cp);
+      if (ranges_.empty() || ranges_.back().value != value) {
+        ranges_.push_back(Range{cp, value});
+      }
+    }
 
-td::int32 my_wcwidth(td::int32 cp) {
-  if (cp < 0x20 || (cp >= 0x80 && cp < 0xa0)) {
-    return -1;
+    ascii_fast_path_ = true;
+    for (td::int32 cp = 0x20; cp < 0x7f; cp++) {
+      if (get(cp) != 2) {
+        ascii_fast_path_ = false;
+      }
+    }
   }
-  td::int32 l = -1;
-  td::int32 r = (td::int32)override_blocks.size();
-  while (r - l > 1) {
-    auto x = (r + l) / 2;
-    if (cp < override_blocks[x].begin) {
-      r = x;
-    } else if (cp > override_blocks[x].end) {
-      l = x;
-    } else {
-      return override_blocks[x].width;
+
+  td::uint8 get(td::int32 cp) const {
+    if (cp < 0x10000) {
+      return pages_[page_index_[cp >> 8]][cp & 255];
+    }
+    if (cp > MaxCodepoint) {
+      return static_cast<td::uint8>(utf8proc_charwidth(cp) + 1);
     }
+    auto it = std::upper_bound(ranges_.begin(), ranges_.end(), cp,
+                               [](td::int32 x, const Range &r) { return x < r.begin; });
+    return (--it)->value;
   }
-  return utf8proc_charwidth(cp);
-}
 
-bool is_control_char(td::int32 op) {
-  return (op >= LEFT_ALIGN_BLOCK_START && op <= LEFT_ALIGN_BLOCK_END) ||
-         (op >= RIGHT_ALIGN_BLOCK_START && op <= RIGHT_ALIGN_BLOCK_END) || (op == SOFT_LINE_BREAK_CP);
-}
+  bool ascii_fast_path() const {
+    return ascii_fast_path_;
+  }
 
-}  // namespace
+  static td::int32 width(td::uint8 value) {
+    return static_cast<td::int32>(value & WidthMask) - 1;
+  }
 
-void enable_wide_emojis() {
-  wide_emojis = true;
-}
+ private:
+  static td::int32 calc_width(const std::vector<UnicodeWidthBlock> &blocks, td::int32 cp) {
+    if (cp < 0x20 || (cp >= 0x80 && cp < 0xa0)) {
+      return -1;
+    }
+    td::int32 l = -1;
+    td::int32 r = (td::int32)blocks.size();
+    while (r - l > 1) {
+      auto x = (r + l) / 2;
+      if (cp < blocks[x].begin) {
+        r = x;
+      } else if (cp > blocks[x].end) {
+        l = x;
+      } else {
+        return blocks[x].width;
+      }
+    }
+    return utf8proc_charwidth(cp);
+  }
 
-void override_unicode_width(std::vector<UnicodeWidthBlock> blocks) {
-  std::sort(blocks.begin(), blocks.end(),
-            [&](const UnicodeWidthBlock &l, const UnicodeWidthBlock &r) { return l.begin < r.begin; });
-  override_blocks = std::move(blocks);
+  struct Range {
+    td::int32 begin;
+    td::uint8 value;
+  };
+
+  std::array<td::uint16, 256> page_index_;
+  std::vector<std::array<td::uint8, 256>> pages_;
+  std::vector<Range> ranges_;
+  bool ascii_fast_path_{true};
+};
+
+// tables are never freed, so that a lookup running concurrently with a rebuild reads a valid table
+std::atomic<const CodepointWidthTable *> current_width_table{nullptr};
+
+const CodepointWidthTable &width_table() {
+  auto table = current_width_table.load(std::memory_order_acquire);
+  if (!table) {
+    static const CodepointWidthTable default_table(false, {});
+    return default_table;
+  }
+  return *table;
 }
 
-static bool is_regional_indicator(td::int32 value) {
-  return value >= 0x1f1e6 && value <= 0x1f1ff;
+}  // namespace
+
+void configure_unicode_width(bool wide_emojis, std::vector<UnicodeWidthBlock> blocks) {
+  current_width_table.store(new CodepointWidthTable(wide_emojis, std::move(blocks)), std::memory_order_release);
 }
 
 Graphem next_graphem(td::Slice data, size_t pos) {
+  auto &table = width_table();
   auto cur = data.ubegin() + pos;
   auto first = cur;
   auto last = data.uend();
@@ -118,8 +212,9 @@ Graphem next_graphem(td::Slice data, size_t pos) {
     if (is_first) {
       first_codepoint = code;
     }
-    bool control_symbol = is_control_char(code);
-    auto width = my_wcwidth(code);
+    auto value = table.get(code);
+    bool control_symbol = (value & CodepointWidthTable::ControlChar) != 0;
+    auto width = CodepointWidthTable::width(value);
     if (width < 0) {
       if (is_first) {
         return Graphem{
@@ -129,7 +224,7 @@ Graphem next_graphem(td::Slice data, size_t pos) {
       }
     } else if (width == 0 && !control_symbol) {
       cur_codepoints++;
-      if (wide_emojis && code == 0xFE0F && cur_width == 1) {
+      if ((value & CodepointWidthTable::MakesWide) && cur_width == 1) {
         cur_width++;
       }
       cur = next;
@@ -144,7 +239,8 @@ Graphem next_graphem(td::Slice data, size_t pos) {
           break;
         }
       } else {
-        if (graphems_cnt == 1 && is_regional_indicator(base_codepoint) && is_regional_indicator(code)) {
+        if (graphems_cnt == 1 && is_regional_indicator(base_codepoint) &&
+            (value & CodepointWidthTable::RegionalIndicator)) {
           graphems_cnt++;
           cur_width = 2;
           cur_codepoints++;
@@ -162,7 +258,37 @@ Graphem next_graphem(td::Slice data, size_t pos) {
                  .first_codepoint = first_codepoint};
 }
 
+size_t printable_ascii_prefix(td::Slice data, size_t pos) {
+  if (pos >= data.size() || !width_table().ascii_fast_path()) {
+    return 0;
+  }
+  auto begin = data.ubegin() + pos;
+  auto cur = begin;
+  auto end = data.uend();
+  // 8 bytes at a time: a word is skipped if none of its bytes is below 0x20, 0x7f or not ascii
+  constexpr td::uint64 ones = 0x0101010101010101ULL;
+  constexpr td::uint64 highs = 0x8080808080808080ULL;
+  while (end - cur >= 8) {
+    td::uint64 w;
+    std::memcpy(&w, cur, 8);
+    auto del = w ^ (ones * 0x7f);
+    if (((w | ((w - ones * 0x20) & ~w) | ((del - ones) & ~del)) & highs) != 0) {
+      break;
+    }
+    cur += 8;
+  }
+  while (cur < end && *cur >= 0x20 && *cur < 0x7f) {
+    cur++;
+  }
+  // combining characters, variation selectors and zwj after the last character belong to its grapheme
+  if (cur < end && *cur >= 0x80 && cur > begin) {
+    cur--;
+  }
+  return cur - begin;
+}
+
 Graphem prev_graphem(td::Slice data, size_t pos) {
+  auto &table = width_table();
   auto cur = data.ubegin() + pos;
   auto first = cur;
   auto last = data.ubegin();
@@ -183,7 +309,8 @@ Graphem prev_graphem(td::Slice data, size_t pos) {
           .data = td::Slice(first, cur), .width = -2, .unicode_codepoints = 1, .first_codepoint = (td::int32)code};
     }
     bool is_first = cur_codepoints == 0;
-    auto width = my_wcwidth(code);
+    auto value = table.get(code);
+    auto width = CodepointWidthTable::width(value);
     if (width < 0) {
       if (is_first) {
         return Graphem{
@@ -193,7 +320,7 @@ Graphem prev_graphem(td::Slice data, size_t pos) {
       }
     } else if (width == 0) {
       cur_codepoints++;
-      if (wide_emojis && code == 0xFE0F) {
+      if (value & CodepointWidthTable::MakesWide) {
         cur_width++;
       }
     } else {
@@ -350,6 +477,12 @@ td::uint32 utf8_code_to_str(td::int32 code, char buf[6]) {
 td::int32 utf8_string_width(td::Slice data) {
   td::int32 res = 0;
   while (data.size() > 0) {
+    auto ascii_size = printable_ascii_prefix(data, 0);
+    if (ascii_size > 0) {
+      res += (td::int32)ascii_size;
+      data.remove_prefix(ascii_size);
+      continue;
+    }
     auto x = next_graphem(data, 0);
     if (x.width >= 0) {
       res += x.width;
@@ -45,8 +45,11 @@ struct UnicodeCounter {
 
 Graphem next_graphem(td::Slice data, size_t pos);
 Graphem prev_graphem(td::Slice data, size_t pos);
-void enable_wide_emojis();
-void override_unicode_width(std::vector<UnicodeWidthBlock> blocks);
+// number of bytes from pos, which are printable ascii characters, each of them being a grapheme of width 1
+size_t printable_ascii_prefix(td::Slice data, size_t pos);
+// wide_emojis: VS16 makes the preceding character wide; blocks override widths of codepoints. Builds the width
+// table, so it should be called once at startup
+void configure_unicode_width(bool wide_emojis, std::vector<UnicodeWidthBlock> blocks);
 Graphem next_graphems(td::Slice data, size_t pos = 0, size_t limit_bytes = (size_t)-1, td::int32 limit_width = -1,
                       td::int32 limit_graphems = -1, td::int32 limit_codepoints = -1);
 td::Slice get_utf8_string_substring(td::Slice text, size_t from, size_t to);